@@ -1,29 +1,173 @@
 #pragma once
 
 #include "types.hpp"
+#include "heap.hpp"
+#include "gc.hpp"
+#include "method_body.hpp"
+#include "method_table.hpp"
+#include "tables.hpp"
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_map>
-#include <list>
+#include <vector>
 #include <functional>
 #include <cstring>
+#include <algorithm>
 #include "logger.hpp"
+#include "memory.hpp"
 
 namespace ili {
 
-    struct VariableBase {
-        Type type;
+    // Field operand of a quickened instruction, resolved once from its token
+    struct ResolvedField {
+        u32 fieldIndex;
+        SignatureElementType type;
+        u32 offset;
+        u32 size;
+
+        // Only set for static fields
+        u8 *staticAddress;
+        u32 typeIndex;
+
+        // Type arguments of the declaring type if that is a generic instance
+        const GenericContext *instantiation;
+    };
+
+    struct InlineCacheEntry {
+        MethodTable *methodTable;
+        u32 target;
+        const GenericContext *genericContext;
+    };
+
+    // Operand of a quickened callvirt. Every call site gets its own so it can cache the targets it dispatched to
+    struct VirtualCall {
+        static constexpr u32 NoSlot = 0xFFFF'FFFF;
+        static constexpr u32 PolymorphicCacheSize = 4;
+
+        u32 methodToken = 0;
+
+        // vtable slot to dispatch through, NoSlot for non-virtual methods and methods of other assemblies
+        u32 slot = NoSlot;
+
+        // Number of stack slots the arguments following 'this' take up
+        u32 thisDepth = 0;
+
+        // Set for methods declared by interfaces and for methods of other assemblies, which might be declared by one
+        u32 interfaceMethodId = 0;
+
+        // Methods of generic types run with the type arguments of the instance's type, even if they aren't virtual
+        bool hasGenericOwner = false;
+
+        // Type arguments of the called method itself, if it's a generic method
+        const GenericContext *genericContext = nullptr;
+
+        // Invoke of a delegate type, which has no body and calls the delegate's targets instead
+        bool isDelegateInvoke = false;
+
+        // Inline cache of the types seen at this site. With one entry the site is monomorphic and the entry's target
+        // can be called directly, up to PolymorphicCacheSize entries it is polymorphic. Sites that see more types
+        // become megamorphic and stop caching
+        InlineCacheEntry cache[PolymorphicCacheSize] = { };
+        u32 cacheSize = 0;
+        bool megamorphic = false;
+
+        u64 hits = 0;
+        u64 misses = 0;
+
+        bool isDispatched() const {
+            return this->slot != NoSlot || this->interfaceMethodId != 0 || this->hasGenericOwner;
+        }
+    };
+
+    // Operand of a quickened call. The called body, or the native function for methods of other assemblies, is
+    // looked up once per site instead of on every call
+    struct DirectCall {
+        u32 methodToken = 0;
+        const GenericContext *genericContext = nullptr;
+
+        MethodBody *body = nullptr;
+        std::function<void()> *native = nullptr;
+    };
+
+    // Operand of a quickened castclass or isinst
+    struct TypeCheck {
+        MethodTable *type;
+
+        // Interfaces can't use the type display, the type of the last instance that passed is remembered instead
+        MethodTable *lastHit;
     };
 
-    template<typename T>
-    struct Variable : public VariableBase {
-        T value;
+    // Operand of a quickened call to the runtime provided methods of a multidimensional array type. Constructors
+    // take either the length of every dimension or pairs of lower bound and length
+    struct ArrayAccessor {
+        enum class Kind : u8 {
+            Get,
+            Set,
+            Address,
+            Construct,
+            ConstructWithLowerBounds
+        };
+
+        MethodTable *arrayType;
+        Kind kind;
     };
 
-    struct HeapReference {
-        u8 *heapPointer;
-        size_t size;
+    struct InvokerValue {
+        MethodTable *type;
+        SignatureElementType storageType;
+        u32 size;
+    };
+
+    // Calls a method on behalf of reflection, e.g. MethodInfo.Invoke or Activator.CreateInstance. Built once per method
+    // from its signature, invoking it only unboxes the arguments and boxes the return value
+    struct MethodInvoker {
+        u32 methodToken;
+        const GenericContext *genericContext;
+        bool hasThis;
+
+        // Methods of value types get a pointer into the boxed target as their 'this'
+        bool isValueTypeMethod;
+
+        std::vector<InvokerValue> parameters;
+
+        // Type is nullptr for methods returning void
+        InvokerValue returnValue;
+    };
+
+    // Where an active method keeps its arguments, locals and evaluation stack. Method::run links the frames of all
+    // active methods, innermost first, so the garbage collector can find the references in them
+    struct Frame {
+        Frame *caller = nullptr;
+        const MethodBody *body = nullptr;
+
+        u8 *arguments = nullptr;
+        u8 *locals = nullptr;
+        u8 *stackBase = nullptr;
+        Type *typeFrameBase = nullptr;
+        Type *typeStackBase = nullptr;
+
+        // Exception the frame's handlers are currently dispatching
+        u64 exception = 0;
+
+        // Exceptions of unwinds that got interrupted by a leave or a throw inside one of their finally handlers,
+        // innermost last
+        std::vector<u64> suspendedExceptions;
+    };
+
+    // Static field storage of a type or generic instantiation
+    struct StaticArea {
+        u32 typeDefIndex;
+        const GenericContext *instantiation;
+        u8 *data;
+    };
+
+    enum class TypeInitialization : u8 {
+        Pending,
+        Running,
+        Done,
+        Failed
     };
 
     class Method;
@@ -31,10 +175,15 @@ namespace ili {
 
 
     struct Context {
+        // Every value on the evaluation stack occupies one slot, no matter how wide its type is
+        static constexpr size_t StackSlotSize = 8;
+
         DLL *dll = nullptr;
 
-        u8 *heap = nullptr;
-        std::list<HeapReference> heapReferences;
+        Heap heap;
+
+        // The part of the nursery this context's thread allocates from
+        Heap::AllocationBuffer allocationBuffer;
 
         u8 *stackPointer = nullptr;
         u8 *framePointer = nullptr;
@@ -44,14 +193,327 @@ namespace ili {
         Type *typeFramePointer = nullptr;
         Type *typeStack;
 
+        // Innermost active frame, see Frame
+        Frame *currentFrame = nullptr;
+
         std::unordered_map<std::string, std::function<void()>> nativeFunctions;
 
+        std::unordered_map<u32, MethodBody> methodBodies;
+
+        // Instantiation cache. Every distinct set of type arguments exists once so contexts can be compared by
+        // address, bodies are shared by all instantiations with the same canonical form
+        std::unordered_map<std::string, std::unique_ptr<GenericContext>> genericContexts;
+        std::unordered_map<std::string, MethodBody> genericMethodBodies;
+        std::unordered_map<std::string, std::unique_ptr<MethodTable>> genericMethodTables;
+
+        // Set while an exception travels from a returning frame to its caller
+        bool exceptionPending = false;
+        u64 exception = 0;
+
+        // Boxes of small Int32 values and of both Booleans are allocated once and shared by every box instruction
+        static constexpr s32 BoxCacheMin = -128;
+        static constexpr s32 BoxCacheMax = 1023;
+        u64 boxedInt32Cache[BoxCacheMax - BoxCacheMin + 1] = { 0 };
+        u64 boxedBooleanCache[2] = { 0 };
+
+        std::unordered_map<u32, std::unique_ptr<MethodTable>> methodTables;
+        std::unordered_map<std::string, std::unique_ptr<MethodTable>> arrayMethodTables;
+
+        // Operand of quickened newarr, ldelema, ldelem and stelem
+        std::vector<MethodTable*> arrayTypes;
+
+        std::vector<ArrayAccessor> arrayAccessors;
+
+        // Operand of quickened ldtoken and typeof
+        std::vector<MethodTable*> tokenTypes;
+
+        // Types of the objects reflection hands out. Their instances live on the heap like any other object
+        std::unique_ptr<MethodTable> runtimeTypeTable;
+        std::unique_ptr<MethodTable> runtimeMethodInfoTable;
+
+        // Both keyed by instantiation key, see getInstantiationKey
+        std::unordered_map<std::string, std::unique_ptr<MethodInvoker>> methodInvokers;
+        std::unordered_map<std::string, u64> methodInfos;
+
+        // vtable slot of every virtual MethodDef whose declaring type got its MethodTable built already
+        std::unordered_map<u32, u32> vtableSlots;
+
+        // Interface methods are numbered in the order they are first seen, IDs start at 1
+        std::unordered_map<u32, u32> interfaceMethodIds;
+
+        std::vector<VirtualCall> virtualCalls;
+
+        std::vector<DirectCall> directCalls;
+
+        std::vector<TypeCheck> typeChecks;
+
+        // Never shrinks so delegates can point into it
+        std::deque<MethodEntry> methodEntries;
+        std::unordered_map<std::string, u32> methodEntryIndices;
+
+        std::vector<ResolvedField> resolvedFields;
+        std::unordered_map<u32, u32> resolvedFieldIndices;
+
+        // Profiled runs count every instance field access and write the counts to a field profile when they finish.
+        // Field instructions then aren't quickened into the offset carrying forms, which can't tell fields apart.
+        // Enabled with --profile-fields
+        bool fieldProfiling = false;
+        std::vector<u64> fieldAccessCounts;
+
+        // Operands that mean something different in every instantiation of the code using them can't be quickened.
+        // They are resolved once per token and instantiation instead, see getInstantiationKey
+        std::unordered_map<std::string, u32> genericVirtualCallIndices;
+        std::unordered_map<std::string, u32> genericDirectCallIndices;
+        std::unordered_map<std::string, u32> genericTypeCheckIndices;
+        std::unordered_map<std::string, u32> genericFieldIndices;
+        std::unordered_map<std::string, u32> genericArrayAccessorIndices;
+
+        // Storage of static fields, one zero initialized block per TypeDef and generic instantiation
+        std::unordered_map<u32, std::unique_ptr<u8[]>> staticAreas;
+        std::unordered_map<std::string, std::unique_ptr<u8[]>> genericStaticAreas;
+        std::vector<StaticArea> allocatedStaticAreas;
+
+        // Progress of each type's .cctor. Types that aren't in here haven't been touched yet
+        std::unordered_map<u32, TypeInitialization> typeInitializations;
+        std::unordered_map<std::string, TypeInitialization> genericTypeInitializations;
+
+        // Exceptions of .cctors that failed, keyed by instantiation key. Non-generic types use an empty context
+        std::unordered_map<std::string, u64> typeInitializationErrors;
+
+        // Empty contexts are represented by nullptr
+        const GenericContext* getGenericContext(const GenericContext &context) {
+            if (context.empty())
+                return nullptr;
+
+            auto &interned = genericContexts[context.getKey()];
+            if (interned == nullptr)
+                interned = std::make_unique<GenericContext>(context);
+
+            return interned.get();
+        }
+
+        static std::string getInstantiationKey(u32 token, const GenericContext &context) {
+            return std::string(reinterpret_cast<const char*>(&token), sizeof(token)) + context.getKey();
+        }
+
+        static std::string getInstantiationKey(u32 token, const GenericContext *context) {
+            return context != nullptr ? getInstantiationKey(token, *context) : getInstantiationKey(token, GenericContext { });
+        }
+
+        u32 getInterfaceMethodId(u32 methodToken) {
+            auto &id = interfaceMethodIds[methodToken];
+
+            if (id == 0)
+                id = interfaceMethodIds.size();
+
+            return id;
+        }
+
+        u8* getStaticArea(u32 typeDefIndex, u32 size, const GenericContext *instantiation = nullptr) {
+            auto &area = instantiation != nullptr ? genericStaticAreas[getInstantiationKey(typeDefIndex, *instantiation)] : staticAreas[typeDefIndex];
+
+            if (area == nullptr) {
+                area = std::make_unique<u8[]>(std::max<u32>(1, size));
+                allocatedStaticAreas.push_back({ typeDefIndex, instantiation, area.get() });
+            }
+
+            return area.get();
+        }
+
+        u8* allocate(size_t size) {
+            Logger::debug("Allocating %d bytes on the heap", size);
+
+            return heap.allocate(allocationBuffer, size);
+        }
+
+        u8* allocateObject(MethodTable *methodTable) {
+            u8 *object = allocate(methodTable->instanceSize);
+            reinterpret_cast<ObjectHeader*>(object)->methodTable = methodTable;
+
+            return object;
+        }
+
+        // Large arrays skip the nursery. They start out zeroed, so there are no references to dirty cards for yet
+        u8* allocateArray(MethodTable *arrayType, u64 length) {
+            size_t size = arrayType->dataOffset + length * arrayType->elementSize;
+            u8 *array = size >= Heap::LargeObjectSize ? heap.allocateOld(size) : allocate(size);
+            reinterpret_cast<ObjectHeader*>(array)->methodTable = arrayType;
+            reinterpret_cast<ArrayHeader*>(array + ObjectHeaderSize)->length = length;
+
+            return array;
+        }
+
+        u64 getRuntimeType(MethodTable *type) {
+            if (type->runtimeType != 0)
+                return type->runtimeType;
+
+            if (runtimeTypeTable == nullptr)
+                runtimeTypeTable = std::make_unique<MethodTable>(*this, "System.RuntimeType", sizeof(RuntimeTypeData));
+
+            u8 *object = allocateObject(runtimeTypeTable.get());
+            reinterpret_cast<RuntimeTypeData*>(object + ObjectHeaderSize)->type = type;
+            type->runtimeType = reinterpret_cast<u64>(object);
+
+            return type->runtimeType;
+        }
+
+        // Things like user strings get pushed as references too but don't live on the heap
+        bool isHeapObject(u64 reference) {
+            return heap.contains(reference);
+        }
+
+        // User strings don't live on the heap and have no header
+        MethodTable* getMethodTableOf(u64 reference) {
+            if (!isHeapObject(reference))
+                return getMethodTable(TypeSignature { SignatureElementType::String });
+
+            return reinterpret_cast<ObjectHeader*>(reference)->methodTable;
+        }
+
+        void initBoxCache() {
+            auto int32Table = getMethodTable(TypeSignature { SignatureElementType::I4 });
+            for (s32 value = BoxCacheMin; value <= BoxCacheMax; value++) {
+                u8 *box = allocateObject(int32Table);
+                std::memcpy(box + ObjectHeaderSize, &value, sizeof(s32));
+                boxedInt32Cache[value - BoxCacheMin] = reinterpret_cast<u64>(box);
+            }
+
+            auto booleanTable = getMethodTable(TypeSignature { SignatureElementType::Boolean });
+            for (u8 value = 0; value < 2; value++) {
+                u8 *box = allocateObject(booleanTable);
+                box[ObjectHeaderSize] = value;
+                boxedBooleanCache[value] = reinterpret_cast<u64>(box);
+            }
+        }
+
+        // Types defined in the assembly are keyed by their token, primitives by their element type.
+        // Instantiations and arrays are keyed by their full signature
+        MethodTable* getMethodTable(const TypeSignature &type) {
+            if (type.elementType == SignatureElementType::GenericInst) {
+                auto &methodTable = genericMethodTables[getTypeKey(type)];
+
+                if (methodTable == nullptr)
+                    methodTable = std::make_unique<MethodTable>(*this, type);
+
+                return methodTable.get();
+            }
+
+            if (type.elementType == SignatureElementType::SzArray || type.elementType == SignatureElementType::Array) {
+                auto &methodTable = arrayMethodTables[getTypeKey(type)];
+
+                if (methodTable == nullptr)
+                    methodTable = std::make_unique<MethodTable>(*this, type);
+
+                return methodTable.get();
+            }
+
+            bool isNamedType = type.elementType == SignatureElementType::Class || type.elementType == SignatureElementType::ValueType;
+            auto &methodTable = methodTables[isNamedType ? type.typeToken : static_cast<u32>(type.elementType)];
+
+            if (methodTable == nullptr)
+                methodTable = std::make_unique<MethodTable>(*this, type);
+
+            return methodTable.get();
+        }
+
+        MethodTable* getMethodTable(u32 typeDefIndex) {
+            return getMethodTable(TypeSignature { SignatureElementType::Class, (TABLE_ID_TYPEDEF << 24) | typeDefIndex });
+        }
 
 
         Type getTypeOnStack(u16 pos = 0) {
             return *(typeStackPointer - 1 - pos);
         }
 
+        void setTypeOnStack(u16 pos, Type type) {
+            *(typeStackPointer - 1 - pos) = type;
+        }
+
+        static u32 getSlotCount(size_t size) {
+            return std::max<size_t>(1, (size + StackSlotSize - 1) / StackSlotSize);
+        }
+
+        // Number of slots taken up by the value on top of the stack
+        u32 getSlotCountOnStack() {
+            if (getTypeOnStack() != Type::ValueType)
+                return 1;
+
+            u32 count = 1;
+            while (typeStackPointer - 1 - count >= typeStack && *(typeStackPointer - 1 - count) == Type::ValueTypePart)
+                count++;
+
+            return count;
+        }
+
+        void pushValue(const void *value, size_t size) {
+            u32 slots = getSlotCount(size);
+
+            std::memset(stackPointer, 0x00, slots * StackSlotSize);
+            Memory::copyValue(stackPointer, value, size);
+
+            for (u32 i = 0; i < slots - 1; i++)
+                typeStackPointer[i] = Type::ValueTypePart;
+            typeStackPointer[slots - 1] = Type::ValueType;
+
+            stackPointer += slots * StackSlotSize;
+            typeStackPointer += slots;
+
+            Logger::debug("Pushed %d byte value type onto stack", size);
+        }
+
+        void popValue(void *value, size_t size) {
+            u32 slots = getSlotCount(size);
+
+            if (getTypeOnStack() != Type::ValueType || getSlotCountOnStack() != slots) {
+                Logger::error("Popped %d byte value type but the stack doesn't hold one!", size);
+                exit(1);
+            }
+
+            stackPointer -= slots * StackSlotSize;
+            typeStackPointer -= slots;
+
+            Memory::copyValue(value, stackPointer, size);
+
+            Logger::debug("Popped %d byte value type from stack", size);
+        }
+
+        // Address of the value type on top of the stack
+        u8* peekValue() {
+            return stackPointer - getSlotCountOnStack() * StackSlotSize;
+        }
+
+        // Removes the topmost value, no matter how many slots it takes up
+        void drop() {
+            u32 slots = getSlotCountOnStack();
+
+            stackPointer -= slots * StackSlotSize;
+            typeStackPointer -= slots;
+        }
+
+        // Removes the given number of slots right below the topmost value, which moves down to take their place
+        void removeBelowTop(u32 slots) {
+            u32 topSlots = getSlotCountOnStack();
+            u8 *top = stackPointer - topSlots * StackSlotSize;
+            Type *topTypes = typeStackPointer - topSlots;
+
+            std::memmove(top - slots * StackSlotSize, top, topSlots * StackSlotSize);
+            std::memmove(topTypes - slots, topTypes, topSlots * sizeof(Type));
+
+            stackPointer -= slots * StackSlotSize;
+            typeStackPointer -= slots;
+        }
+
+        // Pushes a copy of the topmost value, no matter how many slots it takes up
+        void duplicate() {
+            u32 slots = getSlotCountOnStack();
+
+            std::memcpy(stackPointer, stackPointer - slots * StackSlotSize, slots * StackSlotSize);
+            std::memcpy(typeStackPointer, typeStackPointer - slots, slots * sizeof(Type));
+
+            stackPointer += slots * StackSlotSize;
+            typeStackPointer += slots;
+        }
+
         template<typename T>
         T pop() {
             T ret;
@@ -69,7 +531,7 @@ namespace ili {
             }
 
             typeStackPointer--;
-            stackPointer -= sizeof(T);
+            stackPointer -= StackSlotSize;
 
             if (stackPointer < stack) {
                 Logger::error("Popped %d which was more than the stack held!", sizeof(T));
@@ -87,18 +549,183 @@ namespace ili {
         template<typename T>
         void push(Type type, T val) {
 
-            std::memcpy(stackPointer, &val, getTypeSize(type));
+            std::memset(stackPointer, 0x00, StackSlotSize);
+            std::memcpy(stackPointer, &val, std::min<size_t>(getTypeSize(type), sizeof(T)));
             *typeStackPointer = type;
 
             typeStackPointer++;
-            stackPointer += sizeof(T);
+            stackPointer += StackSlotSize;
 
             Logger::debug("Pushed %d bytes onto stack: %016llx", sizeof(T), val);
         }
 
+        // Pushes a value of the given signature type stored at address, widened to its stack type
+        void loadValue(SignatureElementType type, u8 *address, u32 size = 0) {
+            switch (type) {
+                case SignatureElementType::ValueType:
+                    pushValue(address, size);
+                    break;
+                case SignatureElementType::Boolean:
+                case SignatureElementType::U1:
+                    push<s32>(Type::Int32, *reinterpret_cast<u8*>(address));
+                    break;
+                case SignatureElementType::I1:
+                    push<s32>(Type::Int32, *reinterpret_cast<s8*>(address));
+                    break;
+                case SignatureElementType::Char:
+                case SignatureElementType::U2:
+                    push<s32>(Type::Int32, *reinterpret_cast<u16*>(address));
+                    break;
+                case SignatureElementType::I2:
+                    push<s32>(Type::Int32, *reinterpret_cast<s16*>(address));
+                    break;
+                case SignatureElementType::I4:
+                case SignatureElementType::U4:
+                    push<s32>(Type::Int32, *reinterpret_cast<s32*>(address));
+                    break;
+                case SignatureElementType::I8:
+                case SignatureElementType::U8:
+                    push<s64>(Type::Int64, *reinterpret_cast<s64*>(address));
+                    break;
+                case SignatureElementType::R4:
+                    push<double>(Type::F, *reinterpret_cast<float*>(address));
+                    break;
+                case SignatureElementType::R8:
+                    push<double>(Type::F, *reinterpret_cast<double*>(address));
+                    break;
+                default: {
+                    Type stackType = getStackType(type);
+
+                    if (stackType == Type::Invalid) {
+                        Logger::error("Cannot load value of signature type %02x!", type);
+                        exit(1);
+                    }
+
+                    push<u64>(stackType, *reinterpret_cast<u64*>(address));
+                    break;
+                }
+            }
+        }
+
+        // Pops the topmost value and stores it at address with the width of the given signature type
+        void storeValue(SignatureElementType type, u8 *address, u32 size = 0) {
+            switch (type) {
+                case SignatureElementType::ValueType:
+                    popValue(address, size);
+                    break;
+                case SignatureElementType::Boolean:
+                case SignatureElementType::I1:
+                case SignatureElementType::U1:
+                    *reinterpret_cast<u8*>(address) = pop<u64>();
+                    break;
+                case SignatureElementType::Char:
+                case SignatureElementType::I2:
+                case SignatureElementType::U2:
+                    *reinterpret_cast<u16*>(address) = pop<u64>();
+                    break;
+                case SignatureElementType::I4:
+                case SignatureElementType::U4:
+                    *reinterpret_cast<u32*>(address) = pop<u64>();
+                    break;
+                case SignatureElementType::R4:
+                    *reinterpret_cast<float*>(address) = pop<double>();
+                    break;
+                case SignatureElementType::R8:
+                    *reinterpret_cast<double*>(address) = pop<double>();
+                    break;
+                default:
+                    *reinterpret_cast<u64*>(address) = pop<u64>();
+                    break;
+            }
+        }
+
+        // storeValue for memory that may be part of an object, like fields and array elements. Stores that might
+        // leave a reference to a nursery object in the old generation dirty its card
+        void storeObjectValue(SignatureElementType type, u8 *address, u32 size = 0) {
+            switch (type) {
+                case SignatureElementType::ValueType:
+                    heap.preWriteBarrierRange(address, size);
+                    break;
+                case SignatureElementType::Class: case SignatureElementType::Object: case SignatureElementType::String:
+                case SignatureElementType::SzArray: case SignatureElementType::Array: case SignatureElementType::GenericInst:
+                    heap.preWriteBarrier(address);
+                    break;
+                case SignatureElementType::Var: case SignatureElementType::MVar:
+                    heap.preWriteBarrierRange(address, sizeof(u64));
+                    break;
+                default:
+                    break;
+            }
+
+            storeValue(type, address, size);
+
+            switch (type) {
+                case SignatureElementType::ValueType:
+                    heap.writeBarrierRange(address, size);
+                    break;
+                case SignatureElementType::Class: case SignatureElementType::Object: case SignatureElementType::String:
+                case SignatureElementType::SzArray: case SignatureElementType::Array: case SignatureElementType::GenericInst:
+                case SignatureElementType::Var: case SignatureElementType::MVar:
+                    heap.writeBarrier(address, *reinterpret_cast<u64*>(address));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Makes room for new slots below the topmost ones, e.g. for a new object underneath its constructor's arguments.
+        // The reserved slots are zeroed and need to be tagged by the caller
+        u8* reserve(u32 depth, u32 slots) {
+            u8 *slot = stackPointer - depth * StackSlotSize;
+            Type *typeSlot = typeStackPointer - depth;
+
+            std::memmove(slot + slots * StackSlotSize, slot, depth * StackSlotSize);
+            std::memmove(typeSlot + slots, typeSlot, depth * sizeof(Type));
+
+            std::memset(slot, 0x00, slots * StackSlotSize);
+
+            stackPointer += slots * StackSlotSize;
+            typeStackPointer += slots;
+
+            return slot;
+        }
+
+        MethodBody& getMethodBody(u32 methodToken, const GenericContext *genericContext = nullptr) {
+            if (genericContext != nullptr) {
+                auto canonicalContext = genericContext->getCanonicalForm();
+                auto key = getInstantiationKey(methodToken, canonicalContext);
+                auto body = genericMethodBodies.find(key);
+
+                if (body == genericMethodBodies.end())
+                    body = genericMethodBodies.emplace(key, MethodBody(dll, methodToken, &canonicalContext)).first;
+
+                return body->second;
+            }
+
+            auto body = methodBodies.find(methodToken);
+
+            if (body == methodBodies.end())
+                body = methodBodies.emplace(methodToken, MethodBody(dll, methodToken)).first;
+
+            return body->second;
+        }
+
+        void logInlineCacheStatistics() {
+            for (auto &site : virtualCalls) {
+                if (!site.isDispatched())
+                    continue;
+
+                const char *state = site.megamorphic ? "megamorphic" : site.cacheSize > 1 ? "polymorphic" : "monomorphic";
+                Logger::debug("callvirt %08x: %s, %u types cached, %llu hits, %llu misses", site.methodToken, state, site.cacheSize, site.hits, site.misses);
+            }
+        }
+
         u32 getUsedStackSize() {
             return this->stackPointer - this->stack;
         }
+
+        // Last so it's destroyed first, a background collector thread may still be using everything else
+        GarbageCollector gc { *this };
     };
 
 }
\ No newline at end of file
@@ -3,11 +3,14 @@
 #include "types.hpp"
 #include "file_headers.hpp"
 #include "tables.hpp"
+#include "signature.hpp"
+#include "type_layout.hpp"
 
 #include <string>
 #include <stdio.h>
 #include <cstring>
 #include <vector>
+#include <unordered_map>
 
 namespace ili {
 
@@ -29,6 +32,11 @@ namespace ili {
         table_type_ref_t* getTypeRefByIndex(u32 index);
         table_assembly_ref_t* getAssemblyRefByIndex(u32 index);
         table_field_t* getFieldByIndex(u32 index);
+        table_stand_alone_sig_t* getStandAloneSigByIndex(u32 index);
+        table_type_spec_t* getTypeSpecByIndex(u32 index);
+        table_method_impl_t* getMethodImplByIndex(u32 index);
+        table_interface_impl_t* getInterfaceImplByIndex(u32 index);
+        table_method_spec_t* getMethodSpecByIndex(u32 index);
 
         u32 getEntryMethodToken();
 
@@ -46,7 +54,30 @@ namespace ili {
         std::string decodeUserString(u32 token);
 
         u16 findTypeDefWithMethod(u32 methodToken);
-        table_class_layout_t* getClassLayoutOfType(table_type_def_t *typeDef);
+        u16 findTypeDefWithField(u32 fieldIndex);
+        u32 getFieldListEnd(u32 typeDefIndex);
+        u32 getMethodListEnd(u32 typeDefIndex);
+        u32 findMethodByName(u32 typeDefIndex, const char *name);
+        u32 findMethodBySignature(u32 typeDefIndex, u32 methodToken);
+        u32 resolveMethodDefinition(u32 methodToken);
+        u32 findFieldByName(u32 typeDefIndex, const char *name);
+        u32 decodeTypeDefOrRef(u32 codedIndex);
+        u32 decodeMethodDefOrRef(u32 codedIndex);
+        u32 decodeMemberRefParent(u32 codedIndex);
+        bool hasSameNameAndSignature(u32 methodTokenA, u32 methodTokenB, const GenericContext *contextA = nullptr, const GenericContext *contextB = nullptr);
+        bool isValueType(u32 typeDefIndex);
+        bool isInterface(u32 typeDefIndex);
+        TypeSignature resolveTypeToken(u32 typeToken);
+        TypeSignature getElementType(const TypeSignature &type);
+
+        const TypeLayout& getTypeLayout(u32 typeDefIndex, const std::vector<TypeSignature> &typeArguments = { });
+        u32 getFieldOffset(u32 fieldIndex);
+        void loadFieldProfile(const std::string &filePath);
+        void saveFieldProfile(const std::string &filePath, const std::vector<u64> &accessCounts);
+        u32 getTypeSize(const TypeSignature &type);
+        u32 getTypeAlignment(const TypeSignature &type);
+        table_class_layout_t* getClassLayoutOfType(u32 typeDefIndex);
+        table_field_layout_t* getFieldLayoutOfField(u32 fieldIndex);
 
         u32 getBlobSize(u32 index);
         u8 getBlobHeaderSize(u32 index);
@@ -54,6 +85,11 @@ namespace ili {
         u32 getNumTableRows(u8 index);
 
     private:
+        static u8 getCompressedHeaderSize(u8 firstByte);
+        void orderAutoLayoutFields(std::vector<std::pair<FieldLayout, u32>> &fields, u32 startOffset);
+
+        static constexpr u32 CacheLineSize = 64;
+
         u8 *m_dllData;
         size_t m_fileSize;
 
@@ -71,6 +107,18 @@ namespace ili {
         u8 *m_stringsHeap;
         u8 *m_userStringsHeap;
         u8 *m_blobHeap;
+
+        std::unordered_map<u32, TypeLayout> m_typeLayouts;
+
+        // Layouts of generic instantiations, keyed by the instantiated type
+        std::unordered_map<std::string, TypeLayout> m_genericTypeLayouts;
+
+        // Offsets of every instance field whose type has been laid out already, indexed by field index
+        static constexpr u32 UnknownFieldOffset = 0xFFFF'FFFF;
+        std::vector<u32> m_fieldOffsets;
+
+        // Loaded from a field profile, empty without one
+        std::vector<u64> m_fieldAccessCounts;
     };
 
 }
\ No newline at end of file
@@ -153,11 +153,12 @@ namespace ili {
         // TODO: Some of these values depend on if a table/heap has more than 2^16 entries
         // TODO: For now, assume we don't reach that limit
         constexpr u8 table[64] = {
-                10, 6, 14, 0, 6, 0, 14, 0,
-                6, 0, 6, 0, 6, 0, 0, 0,
-                0, 2, 0, 0, 0, 0, 0, 0,
-                0, 0, 0, 0, 0, 0, 0, 0,
-                22, 0, 0, 20
+                10, 6, 14, 2, 6, 2, 14, 2,
+                6, 4, 6, 6, 6, 4, 6, 8,
+                6, 2, 4, 2, 6, 4, 2, 6,
+                6, 6, 2, 2, 8, 6, 8, 4,
+                22, 4, 12, 20, 6, 14, 8, 14,
+                12, 4, 8, 4, 4
         };
 
         if (index >= sizeof(table))
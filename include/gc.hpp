@@ -0,0 +1,200 @@
+#pragma once
+
+#include "types.hpp"
+#include "heap.hpp"
+#include "signature.hpp"
+#include "work_stealing_deque.hpp"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ili {
+
+    struct Context;
+    struct Frame;
+
+    // Precise generational collector. It runs once the heap requested a collection and the interpreter reached a
+    // safepoint, so every reference is either in a frame, on the evaluation stack, in a static field, held by the
+    // runtime itself or in an object.
+    // Minor collections copy the live part of the nursery into the old generation and update every reference to it.
+    // Their roots are the ones above plus the dirty cards of the old generation. Objects only ambiguous roots point
+    // to can't be updated and stay in the nursery. Full collections mark and sweep the old generation, objects never
+    // move there and runs of dead ones turn into free chunks the heap allocates from. Their mark phase runs on one
+    // thread per core, see markInParallel. The threads are started by the first full collection and kept for the
+    // following ones.
+    // With Heap::concurrentMarking full collections only pause the program to mark the roots and, once a background
+    // thread marked everything reachable from them and what the program overwrote in the meantime, for a final remark
+    // of what it overwrote since. Another background thread sweeps after that. The nursery isn't collected until both
+    // are done, it keeps growing instead
+    class GarbageCollector {
+    public:
+        static constexpr u32 MaxMarkingThreads = 32;
+
+        // Times the marker is sent back to work on what the program overwrote since it last looked before the remark
+        // marks the rest, see continueConcurrentMarking
+        static constexpr u32 MaxConcurrentMarkingRounds = 8;
+
+        explicit GarbageCollector(Context &ctx);
+        ~GarbageCollector();
+
+        GarbageCollector(const GarbageCollector&) = delete;
+        GarbageCollector& operator=(const GarbageCollector&) = delete;
+
+        // Collects the nursery, and the old generation too if it grew enough since it was last collected. Moves on
+        // to the next phase of a concurrent full collection if the background thread is done with the current one
+        void collect();
+
+        void logPauseHistograms() const;
+
+        // Number of threads full collections mark on, including the collecting one. Defaults to one per core and only
+        // takes effect if set before the first full collection
+        void setMarkingThreadCount(u32 count);
+
+    private:
+        // Reference roots hold a reference or null, interior roots a managed pointer anywhere into an object.
+        // Ambiguous roots are evaluation stack slots of value types and pinned locals, which might hold either
+        enum class RootKind : u8 {
+            Reference,
+            Interior,
+            Ambiguous
+        };
+
+        struct Root {
+            u64 *slot;
+            RootKind kind;
+        };
+
+        // Root pointing into the nursery along with the object it points into
+        struct NurseryPointer {
+            u64 address;
+            const Root *root;
+            u8 *object;
+        };
+
+        // Grey objects of one marking thread. Threads that run out of them steal from the others
+        struct MarkingThread {
+            WorkStealingDeque<u8*> greyObjects;
+        };
+
+        enum class BackgroundPhase : u8 {
+            None,
+            Marking,
+            Sweeping
+        };
+
+        // Every pause is counted as the most expensive kind of work it did
+        enum class PauseKind : u8 {
+            Minor,
+            Full,
+            InitialMark,
+            Remark,
+            Count
+        };
+
+        // Pause times in power of two buckets of microseconds
+        struct PauseHistogram {
+            static constexpr u32 BucketCount = 24;
+
+            std::array<u64, BucketCount> buckets = { };
+            u64 count = 0;
+            double totalTime = 0;
+            double maxTime = 0;
+
+            void record(double milliseconds);
+        };
+
+        void gatherRoots();
+        void addFrame(Frame &frame, u8 *stackEnd, Type *typeStackEnd);
+        void addEvaluationStack(u8 *stackBase, Type *typeStackBase, u8 *stackEnd, Type *typeStackEnd);
+        void addValue(const TypeSignature &type, u8 *address);
+        void addRoot(u64 *slot, RootKind kind);
+
+        void collectNursery();
+        void findNurseryObjects();
+        u64 forward(u64 reference);
+        void updateReference(u64 *slot);
+        void scanCard(u8 *card);
+        u8* finishNursery();
+
+        void collectOldGeneration();
+        void markRoots();
+        void markReference(u64 reference);
+        void markInteriorPointers();
+        void prepareReferenceMaps();
+        void startMarkingWorkers();
+        void runMarkingWorker(u32 index);
+        u32 markInParallel();
+        void drainGreyObjects(u32 index);
+        bool stealGreyObject(u32 index, u8 *&object);
+        void traceObject(MarkingThread &thread, u8 *object);
+        size_t sweep(const std::vector<Heap::Segment> &segments, std::vector<Heap::FreeChunk> &chunks);
+
+        void startConcurrentMarking();
+        bool continueConcurrentMarking();
+        void markConcurrently();
+        void remark();
+        void sweepConcurrently();
+        void finishConcurrentSweep();
+        u8* findOldObject(u64 address);
+
+        static size_t getObjectSize(const u8 *object);
+        static size_t getBlockSize(const u8 *block);
+
+        Context &m_ctx;
+
+        std::vector<Root> m_roots;
+
+        // Objects the roots of a full collection reached before marking is split up across threads, or promoted and
+        // pinned objects still to be scanned by a minor one
+        std::vector<u8*> m_markStack;
+
+        // Managed pointers and ambiguous roots. They may point anywhere into an object, which is only found by
+        // walking the segment they point into
+        std::vector<u64> m_interiorPointers;
+
+        // One per marking thread, the first belongs to the collecting thread. Workers run the others and sleep
+        // between collections until markInParallel starts the next cycle. Cycles with fewer grey objects than
+        // threads leave the remaining workers asleep, see m_activeMarkingThreads
+        std::vector<std::unique_ptr<MarkingThread>> m_markingThreads;
+        std::vector<std::thread> m_markingWorkers;
+        u32 m_markingThreadCount = 0;
+        u32 m_activeMarkingThreads = 0;
+        std::atomic<u32> m_idleMarkingThreads = 0;
+
+        std::mutex m_markingMutex;
+        std::condition_variable m_markingStarted;
+        std::condition_variable m_markingFinished;
+        u64 m_markingCycle = 0;
+        u32 m_busyMarkingWorkers = 0;
+        bool m_stopMarkingWorkers = false;
+
+        std::vector<NurseryPointer> m_nurseryPointers;
+        std::vector<u8*> m_pinnedObjects;
+        std::vector<u8*> m_dirtyCards;
+        size_t m_promotedSize = 0;
+
+        // The background thread owns the mark stack while it marks, and the segments and free chunks while it sweeps.
+        // Done is set once it's finished, the next safepoint moves on to the next phase
+        BackgroundPhase m_backgroundPhase = BackgroundPhase::None;
+        std::thread m_backgroundThread;
+        std::atomic<bool> m_backgroundDone = false;
+
+        // Old generation objects past the end of the snapshot were allocated while marking and are marked already
+        const u8 *m_snapshotEnd = nullptr;
+        u32 m_concurrentMarkingRounds = 0;
+
+        Heap::OverwrittenLog m_overwrittenLog;
+        std::vector<Heap::Segment> m_sweptSegments;
+        std::vector<Heap::FreeChunk> m_freeChunks;
+        size_t m_liveSize = 0;
+
+        PauseKind m_pauseKind = PauseKind::Minor;
+        std::array<PauseHistogram, static_cast<size_t>(PauseKind::Count)> m_pauseHistograms;
+    };
+
+}
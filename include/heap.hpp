@@ -0,0 +1,332 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace ili {
+
+    // The managed heap. One large address range is reserved up front and committed as the heap grows, so the heap
+    // stays contiguous and telling heap objects apart from other references is a single range check.
+    // The start of the range is the nursery, where every thread bump allocates new objects from its own allocation
+    // buffer. Minor collections copy what survives into the old generation behind it, which grows a segment at a time
+    // and is bump allocated from the current region, either the rest of a fresh segment or a free chunk the last full
+    // collection left behind.
+    // There is no bookkeeping per object
+    class Heap {
+    public:
+        static constexpr size_t SegmentSize = 0x0040'0000;
+        static constexpr size_t ReservedSize = 0x4'0000'0000;
+        static constexpr size_t ObjectAlignment = 8;
+
+        // Minor collections are requested once this much has been allocated in the nursery. Objects the stack
+        // only points to ambiguously stay where they are, so the nursery gets its own address range to grow into
+        static constexpr size_t NurserySize = 0x0040'0000;
+        static constexpr size_t NurseryReservedSize = 0x0400'0000;
+
+        // Threads claim the nursery this much at a time and clear what they claimed, minor collections don't
+        static constexpr size_t AllocationBufferSize = 0x0001'0000;
+
+        // Arrays at least this large are allocated in the old generation right away instead of being copied out of
+        // the nursery later
+        static constexpr size_t LargeObjectSize = 0x0001'0000;
+
+        // Full collections are requested once this much was added to the old generation since the last one, or more
+        // if a lot survived it
+        static constexpr size_t MinCollectionThreshold = 0x0100'0000;
+
+        // Free chunks smaller than this stay behind as filler instead of being allocated from
+        static constexpr size_t MinFreeChunkSize = 0x100;
+
+        // The old generation is split into cards. Stores of nursery references into the old generation dirty the
+        // card they store to, minor collections only look at the objects on dirty cards
+        static constexpr size_t CardShift = 9;
+        static constexpr size_t CardSize = size_t(1) << CardShift;
+
+        // What the barrier logs while the old generation is marked concurrently is handed to the marker in buffers of
+        // this many entries
+        static constexpr size_t OverwrittenLogSize = 0x400;
+
+        // Objects never span segments, except for objects larger than a segment. Those get as many fresh segments
+        // in a row as they need. Once the current region is retired every segment is a gapless run of objects and
+        // free blocks from start to end
+        struct Segment {
+            u8 *start;
+            u8 *end;
+        };
+
+        struct FreeChunk {
+            u8 *start;
+            size_t size;
+        };
+
+        // References the barrier logged exactly, and words of value types that might be references
+        struct OverwrittenLog {
+            std::vector<u64> references;
+            std::vector<u64> values;
+        };
+
+        // Part of the nursery only one thread allocates from, without any synchronization. Only claiming the next
+        // one when it's used up takes an atomic add. Whatever is left of it is turned into a free block once a
+        // thread moves on to the next buffer or a collection starts, keeping the nursery walkable
+        struct AllocationBuffer {
+            u8 *top = nullptr;
+            u8 *limit = nullptr;
+        };
+
+        Heap();
+        ~Heap();
+
+        Heap(const Heap&) = delete;
+        Heap& operator=(const Heap&) = delete;
+
+        // Memory handed out is zeroed. Allocation buffers are cleared by the slow path when they're claimed and regions
+        // of the old generation when they become the current one, so the fast paths don't clear anything
+        u8* allocate(AllocationBuffer &buffer, size_t size) {
+            size = (size + ObjectAlignment - 1) & ~(ObjectAlignment - 1);
+
+            u8 *memory = buffer.top;
+            if (size > static_cast<size_t>(buffer.limit - memory)) [[unlikely]]
+                return allocateSlow(buffer, size);
+
+            buffer.top = memory + size;
+            return memory;
+        }
+
+        void retireAllocationBuffer(AllocationBuffer &buffer);
+
+        // Allocates in the old generation, used for large arrays and for objects promoted out of the nursery.
+        // Objects allocated while the old generation is being marked are marked right away
+        u8* allocateOld(size_t size) {
+            size = (size + ObjectAlignment - 1) & ~(ObjectAlignment - 1);
+
+            u8 *memory = this->m_oldTop;
+            if (size > static_cast<size_t>(this->m_oldLimit - memory)) [[unlikely]]
+                memory = allocateOldSlow(size);
+            else
+                this->m_oldTop = memory + size;
+
+            recordBlock(memory);
+
+            if (this->m_marking) [[unlikely]]
+                mark(memory);
+
+            return memory;
+        }
+
+        bool contains(u64 address) const {
+            return address - reinterpret_cast<u64>(this->m_base) < NurseryReservedSize + this->m_committedSize;
+        }
+
+        bool isYoung(u64 address) const {
+            return address - reinterpret_cast<u64>(this->m_base) < NurseryReservedSize;
+        }
+
+        bool isOld(const void *address) const {
+            return static_cast<u64>(static_cast<const u8*>(address) - this->m_oldBase) < this->m_committedSize;
+        }
+
+        // Like isOld but for the whole range the old generation may grow into, so it doesn't change while it grows
+        bool isOldReference(u64 address) const {
+            return address - reinterpret_cast<u64>(this->m_oldBase) < ReservedSize - NurseryReservedSize;
+        }
+
+        // Has to follow every store of a reference into memory that may be part of an object. Stores outside the
+        // old generation, like the ones to static fields or the stack, never need a card since both are scanned
+        // completely by every collection
+        void writeBarrier(const void *slot, u64 value) {
+            if (isYoung(value) && isOld(slot)) [[unlikely]]
+                this->m_cards[static_cast<u64>(static_cast<const u8*>(slot) - this->m_oldBase) >> CardShift] = 1;
+        }
+
+        // For stores of whole value types, which don't say where their references are
+        void writeBarrierRange(const void *start, size_t size) {
+            if (size != 0 && isOld(start)) [[unlikely]]
+                markCards(static_cast<const u8*>(start), size);
+        }
+
+        // Snapshot at the beginning barrier. While the old generation is marked concurrently it has to come before
+        // every store that may overwrite a reference in the old generation. The reference about to be overwritten was
+        // reachable when marking started, the marker gets it from the log even if it never saw it in the slot.
+        // Nursery objects are newer than that and never need it
+        void preWriteBarrier(const void *slot) {
+            if (this->m_marking && isOld(slot)) [[unlikely]]
+                logOverwrittenReference(*static_cast<const u64*>(slot));
+        }
+
+        // For stores of whole value types. Every word they overwrite might be a reference
+        void preWriteBarrierRange(const void *start, size_t size) {
+            if (this->m_marking && size != 0 && isOld(start)) [[unlikely]]
+                logOverwrittenValues(static_cast<const u8*>(start), size);
+        }
+
+        // Free blocks fill the gaps between objects. Their first word holds their size with the lowest bit set,
+        // which a MethodTable pointer never has
+        static void formatFree(u8 *start, size_t size) {
+            *reinterpret_cast<u64*>(start) = size | 1;
+        }
+
+        static bool isFree(const u8 *block) {
+            return (*reinterpret_cast<const u64*>(block) & 1) != 0;
+        }
+
+        static size_t getFreeSize(const u8 *block) {
+            return *reinterpret_cast<const u64*>(block) & ~u64(1);
+        }
+
+        // Mark bits live in a bitmap on the side, one bit per ObjectAlignment bytes of the nursery and old generation.
+        // Minor collections use the nursery's bits to pin objects
+        bool isMarked(const u8 *object) const {
+            u64 bit = getMarkBit(object);
+            return (std::atomic_ref<u64>(this->m_markBits[bit / 64]).load(std::memory_order_relaxed) & (u64(1) << (bit % 64))) != 0;
+        }
+
+        // Returns false if the object was marked already. Marking threads may race for the same word, so bits are
+        // set atomically. Objects are mostly marked already by the time they're reached again, which a plain load
+        // finds without taking the cache line exclusively
+        bool mark(const u8 *object) {
+            u64 bit = getMarkBit(object);
+            std::atomic_ref<u64> word(this->m_markBits[bit / 64]);
+            u64 mask = u64(1) << (bit % 64);
+
+            if ((word.load(std::memory_order_relaxed) & mask) != 0)
+                return false;
+
+            return (word.fetch_or(mask, std::memory_order_relaxed) & mask) == 0;
+        }
+
+        void clearMarks();
+        void clearNurseryMarks();
+
+        // Nursery objects are laid out gaplessly from its start up to the last allocation buffer claimed, once every
+        // buffer was retired
+        u8* getNurseryStart() const { return this->m_base; }
+        u8* getNurseryTop() const { return this->m_nurseryTop.load(std::memory_order_relaxed); }
+
+        // Called by minor collections once everything live was copied out. Allocation continues at top, which is
+        // past the last object that had to stay
+        void resetNursery(u8 *top);
+
+        bool isNurseryFull() const { return getNurseryTop() > this->m_nurseryEnd; }
+
+        // Lets the nursery grow past its size while the collector is busy in the background instead of collecting it.
+        // Returns false once it grew as far as it may
+        bool deferNurseryCollection();
+
+        // Called by the collector around concurrent marking, see preWriteBarrier. Free chunks are dropped when it
+        // starts, until the sweep that follows is done the old generation only grows by fresh segments. Finishing
+        // hands out whatever the barrier logged that the marker didn't take yet
+        void startMarking();
+        void finishMarking(OverwrittenLog &log);
+
+        // The barrier hands its log over once it's full. The marker takes what was handed over from its own thread,
+        // returns false if there was nothing. Publishing hands over what was logged so far from the program's
+        // thread, returns false if that was nothing
+        bool takeOverwrittenLogs(std::vector<OverwrittenLog> &logs);
+        bool publishOverwrittenLog();
+
+        // End of the old generation as it is right now. Marking starts from a snapshot of everything before it
+        const u8* getOldEnd() const { return this->m_oldBase + this->m_committedSize; }
+
+        // Turns what's left of the current old generation region into a free block so the segments can be walked
+        void retireRegion();
+
+        // The current region is zeroed from its top to its limit, walks over the old generation skip that part
+        u8* getRegionTop() const { return this->m_oldTop; }
+        u8* getRegionLimit() const { return this->m_oldLimit; }
+
+        const std::vector<Segment>& getSegments() const { return this->m_segments; }
+        const Segment* findSegment(u64 address) const;
+
+        // Returns a block of the old generation starting at or before address, blocks can be walked from there
+        u8* findBlockBefore(const u8 *address) const;
+
+        // Remembers where a block of the old generation starts. Sweeping rebuilds this for every segment
+        void recordBlock(const u8 *block) {
+            u64 offset = static_cast<u64>(block - this->m_oldBase);
+            u16 &first = this->m_firstBlocks[offset >> CardShift];
+
+            first = std::min<u16>(first, offset & (CardSize - 1));
+        }
+
+        void clearBlocks(const Segment &segment);
+
+        // Appends the start of every dirty card to cards and cleans them
+        void takeDirtyCards(std::vector<u8*> &cards);
+
+        // Called by the collector once it swept the old generation. Allocation continues in the largest chunks first
+        void setFreeChunks(std::vector<FreeChunk> chunks, size_t liveSize);
+
+        size_t getCommittedSize() const { return this->m_committedSize; }
+
+        // Set once the nursery is full, the interpreter collects at its next safepoint. A full collection is
+        // requested on top of that once the old generation grew enough. Background collector threads set it too
+        // once they're done
+        std::atomic<bool> collectionRequested = false;
+        bool fullCollectionRequested = false;
+
+        // Marks the old generation on a background thread while the program keeps running instead of stopping it
+        // for the whole full collection, see GarbageCollector. Enabled with --concurrent-marking
+        bool concurrentMarking = false;
+
+    private:
+        static constexpr u16 NoBlock = 0xFFFF;
+
+        static constexpr size_t OldReservedSize = ReservedSize - NurseryReservedSize;
+
+        u8* allocateSlow(AllocationBuffer &buffer, size_t size);
+        u8* claimNursery(size_t size);
+        u8* allocateOldSlow(size_t size);
+        void startRegion(u8 *start, u8 *end);
+        void addSegments(size_t count);
+        void markCards(const u8 *start, size_t size);
+        void logOverwrittenReference(u64 reference);
+        void logOverwrittenValues(const u8 *start, size_t size);
+        void handOverOverwrittenLog();
+
+        u64 getMarkBit(const u8 *object) const {
+            return static_cast<u64>(object - this->m_base) / ObjectAlignment;
+        }
+
+        u8 *m_base = nullptr;
+        u8 *m_oldBase = nullptr;
+
+        // End of the last allocation buffer claimed. A minor collection is requested once it passes the nursery's end.
+        // All of the nursery's address range is committed up front, pages only take up memory once they're cleared
+        std::atomic<u8*> m_nurseryTop = nullptr;
+        u8 *m_nurseryEnd = nullptr;
+
+        // Bump pointer and end of the current old generation region
+        u8 *m_oldTop = nullptr;
+        u8 *m_oldLimit = nullptr;
+        size_t m_committedSize = 0;
+
+        std::vector<Segment> m_segments;
+        std::vector<FreeChunk> m_freeChunks;
+
+        // The side tables are reserved for the whole heap up front like the heap itself, so they never move while a
+        // background collector thread uses them
+        u64 *m_markBits = nullptr;
+
+        // One byte per card of the old generation, set if the card may hold a reference into the nursery
+        u8 *m_cards = nullptr;
+
+        // Offset of the first block starting in each card of the old generation, NoBlock if one spans all of it
+        u16 *m_firstBlocks = nullptr;
+
+        // Set while the old generation is marked concurrently, along with what the barrier logged since it last
+        // handed its log over. The handed over logs are shared with the marker
+        bool m_marking = false;
+        OverwrittenLog m_overwrittenLog;
+        std::mutex m_overwrittenLogsMutex;
+        std::vector<OverwrittenLog> m_overwrittenLogs;
+
+        size_t m_allocatedSinceCollection = 0;
+        size_t m_collectionThreshold = MinCollectionThreshold;
+    };
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+namespace ili {
+
+    // Bulk memory kernels used by cpblk and initblk.
+    // The fastest implementation supported by the host CPU is picked once on first use.
+    class Memory {
+    public:
+        static void copy(void *destination, const void *source, size_t size);
+        static void fill(void *destination, u8 value, size_t size);
+
+        // Copies of value types. The common small sizes become fixed size moves the compiler can inline,
+        // everything else goes through the bulk copy kernel
+        static inline void copyValue(void *destination, const void *source, size_t size) {
+            switch (size) {
+                case 1:  std::memcpy(destination, source, 1);  break;
+                case 2:  std::memcpy(destination, source, 2);  break;
+                case 4:  std::memcpy(destination, source, 4);  break;
+                case 8:  std::memcpy(destination, source, 8);  break;
+                case 12: std::memcpy(destination, source, 12); break;
+                case 16: std::memcpy(destination, source, 16); break;
+                case 24: std::memcpy(destination, source, 24); break;
+                case 32: std::memcpy(destination, source, 32); break;
+                default: copy(destination, source, size);      break;
+            }
+        }
+    };
+
+}
@@ -3,24 +3,62 @@
 #include "types.hpp"
 #include "context.hpp"
 #include "tables.hpp"
+#include "method_body.hpp"
+#include "opcode.hpp"
+
+#include <vector>
 
 namespace ili  {
 
 
     class Method {
     public:
-        Method(Context &ctx, u32 methodToken);
-        ~Method();
+        Method(Context &ctx, u32 methodToken, const GenericContext *genericContext = nullptr);
+        Method(Context &ctx, u32 methodToken, const GenericContext *genericContext, MethodBody &body);
         void run();
 
     private:
         Context &m_ctx;
         table_method_def_t *m_methodDef;
+        MethodBody *m_body;
+
+        // Type arguments this method runs with, nullptr outside of generic code
+        const GenericContext *m_genericContext;
+
+        // Type token of a pending constrained. prefix
+        u32 m_constrainedType = 0;
 
         u8 *m_programCounter;
 
-        VariableBase *m_localVariable[0xFF] = { nullptr };
+        // Frame layout on the context stack: arguments, locals, localloc regions, evaluation stack
+        Frame m_frame;
+
+        // What to do once all finally handlers queued by a leave or a throw have run
+        enum class Continuation : u8 {
+            None,
+            Leave,
+            Catch,
+            Propagate
+        };
 
+        u32 m_throwOffset = 0;
+        u32 m_filterClause = 0;
+        std::vector<u32> m_pendingFinallies;
+        u32 m_nextFinally = 0;
+        Continuation m_continuation = Continuation::None;
+        u32 m_continuationTarget = 0;
+
+        // A leave or a throw inside a running finally handler starts an unwind of its own. The one it interrupted
+        // is put aside and picked up again once control is back in that handler. Its exception is kept in the frame
+        struct SuspendedUnwind {
+            std::vector<u32> pendingFinallies;
+            u32 nextFinally;
+            Continuation continuation;
+            u32 continuationTarget;
+            u32 throwOffset;
+        };
+
+        std::vector<SuspendedUnwind> m_suspendedUnwinds;
 
         // General Operations
 
@@ -28,15 +66,156 @@ namespace ili  {
         T getNext();
 
         DLL* getDLL();
+        u32 getCurrentOffset();
+        void execute();
+        void resetEvaluationStack();
+        void releaseFrame();
+
+
+        // Generics
+
+        TypeSignature resolveType(u32 typeToken);
+        bool dependsOnGenericContext(u32 token);
+        u32 resolveMethod(u32 methodToken, const GenericContext *&genericContext);
+
+        // Exception Handling
+
+        bool throwException(u64 exception);
+        bool catchPendingException();
+        bool dispatchException(u32 firstClause);
+        bool continueUnwinding();
+        void suspendUnwinding();
+        void resumeUnwinding(u32 offset);
+        bool isExceptionCaughtBy(u64 exception, u32 classToken);
 
         // Instruction Implementations
 
-        void stloc(u8 id);
-        void ldloc(u8 id);
+        void stloc(u16 id);
+        void ldloc(u16 id);
+        void ldloca(u16 id);
+        void starg(u16 id);
+        void ldarg(u16 id);
+        void ldarga(u16 id);
+
+        template<typename Storage, typename Value>
+        void ldind(Type type);
+        template<typename Storage, typename Value>
+        void stind();
+        void stindRef();
+
+        TypeSignature getArrayType(u32 elementTypeToken);
+        u32 resolveArrayType(u32 elementTypeToken);
+        u64 popIndex();
+        u8* getElementAddress(u64 array, u64 index, u32 elementSize);
+        void checkArrayStore(MethodTable *arrayType, u64 value);
+
+        void newarr(u32 elementTypeToken);
+        void newarr(MethodTable *arrayType);
+        void ldlen();
+        void ldelema(u32 elementTypeToken);
+        void ldelema(MethodTable *arrayType);
+        void ldelem(u32 elementTypeToken);
+        void ldelem(MethodTable *arrayType);
+        void stelem(u32 elementTypeToken);
+        void stelem(MethodTable *arrayType);
+        template<typename Storage, typename Value>
+        void ldelem(Type type);
+        template<typename Storage, typename Value>
+        void stelem();
+        void stelemRef();
+
+        bool isArrayAccessor(u32 methodToken);
+        u32 resolveArrayAccessor(u32 methodToken);
+        bool callArrayAccessor(u32 methodToken);
+        void callArrayAccessor(ArrayAccessor &accessor);
+        template<u32 Rank>
+        u8* getMultiDimElementAddress(MethodTable *arrayType, u8 *arraySlot);
+        template<u32 Rank>
+        void accessMultiDimArray(ArrayAccessor &accessor);
+        void newMultiDimArray(ArrayAccessor &accessor);
+
+        TypeInitialization& getTypeInitialization(u32 typeDefIndex, const GenericContext *instantiation);
+        bool initializeType(u32 typeDefIndex, const GenericContext *instantiation = nullptr);
+
+        ResolvedField resolveFieldOperand(u32 fieldToken);
+        u32 resolveField(u32 fieldToken);
+        void quicken(OpcodePrefix opcode, u32 operand);
+        void quickenExtended(OpcodePrefix opcode, u32 operand);
+        u8* popInstance();
+        void countFieldAccess(const ResolvedField &field);
+        void ldfldFromValue(SignatureElementType type, u32 offset, u32 size);
+
+        void ldfld(u32 fieldToken);
+        void stfld(u32 fieldToken);
+        void ldflda(u32 fieldToken);
+        void ldfld(const ResolvedField &field);
+        void stfld(const ResolvedField &field);
+        bool canQuickenStaticField(u32 fieldToken, const ResolvedField &field);
+        void ldsfld(u32 fieldToken);
+        void stsfld(u32 fieldToken);
+        void ldsflda(u32 fieldToken);
+
+        void initobj(u32 typeToken);
+        void ldobj(u32 typeToken);
+        void stobj(u32 typeToken);
+        void cpobj(u32 typeToken);
+        void sizeOf(u32 typeToken);
+
+        u32 resolveTypeCheck(u32 typeToken);
+        bool isInstanceOf(TypeCheck &check, u64 object);
+        void castclass(u32 typeToken);
+        void isinst(u32 typeToken);
+        void castclass(TypeCheck &check);
+        void isinst(TypeCheck &check);
+
+        void box(u32 typeToken);
+        void unbox(u32 typeToken);
+        void unboxAny(u32 typeToken);
         template<typename T>
         void ldc(Type type, T num);
 
-        void call(u32 methodToken);
+        void call(u32 methodToken, const GenericContext *genericContext = nullptr);
+        u32 resolveDirectCall(u32 methodToken);
+        u32 resolveGenericDirectCall(u32 methodToken);
+        void callDirect(u32 methodToken);
+        void call(DirectCall &site);
+        void callTrivial(MethodBody &body);
+        u32 getArgumentSlots(const MethodSignature &signature);
+        MethodTable* getDeclaringType(u32 methodToken, const GenericContext *genericContext);
+        u32 resolveVirtualCall(u32 methodToken);
+        u32 resolveGenericVirtualCall(u32 methodToken);
+        void callvirt(u32 methodToken);
+        void callvirt(VirtualCall &site);
+        bool constrainedCallvirt(VirtualCall &site, u8 *thisSlot);
+        u32 findOverride(MethodTable *methodTable, u32 methodToken);
+        const GenericContext* getTargetContext(const VirtualCall &site, MethodTable *methodTable, u32 target);
+        InlineCacheEntry findVirtualCallTarget(const VirtualCall &site, MethodTable *methodTable);
+        InlineCacheEntry lookupInlineCache(VirtualCall &site, MethodTable *methodTable);
+        void ret();
+
+        u32 resolveMethodEntry(u32 methodToken, const GenericContext *genericContext);
+        void ldftn(u32 methodToken);
+        void ldvirtftn(u32 methodToken);
+        void ldvirtftn(VirtualCall &site);
+        void newDelegate(MethodTable *delegateType);
+        void invokeDelegate(u32 thisDepth, u8 *thisSlot);
+        void invokeDelegateTarget(u64 delegate, u32 thisDepth, u8 *thisSlot);
+        void newobj(u32 constructorToken);
+
+        u32 resolveTokenType(u32 typeToken);
+        void ldtoken(u32 token);
+        void ldtype(u32 typeToken);
+        void mkrefany(u32 typeToken);
+        void refanyval(u32 typeToken);
+        void refanytype();
+
+        void localloc(u64 size);
+        void cpblk();
+        void initblk();
+
+        void leave(u32 target);
+        bool endfinally();
+        bool endfilter();
     };
 }
 
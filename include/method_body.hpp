@@ -0,0 +1,152 @@
+#pragma once
+
+#include "types.hpp"
+#include "signature.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace ili {
+
+    class DLL;
+
+#define METHOD_HEADER_TINY          0x02
+#define METHOD_HEADER_FAT           0x03
+#define METHOD_HEADER_MORE_SECTS    0x08
+#define METHOD_HEADER_INIT_LOCALS   0x10
+
+#define SECTION_EH_TABLE            0x01
+#define SECTION_FAT_FORMAT          0x40
+#define SECTION_MORE_SECTS          0x80
+
+    typedef struct PACKED {
+        u16 flagsAndSize;
+        u16 maxStack;
+        u32 codeSize;
+        u32 localVarSigToken;
+    } fat_method_header_t;
+    static_assert(sizeof(fat_method_header_t) == 0x0C, "fat_method_header_t size invalid!");
+
+    typedef struct PACKED {
+        u16 flags;
+        u16 tryOffset;
+        u8  tryLength;
+        u16 handlerOffset;
+        u8  handlerLength;
+        u32 classTokenOrFilterOffset;
+    } small_exception_clause_t;
+    static_assert(sizeof(small_exception_clause_t) == 0x0C, "small_exception_clause_t size invalid!");
+
+    typedef struct PACKED {
+        u32 flags;
+        u32 tryOffset;
+        u32 tryLength;
+        u32 handlerOffset;
+        u32 handlerLength;
+        u32 classTokenOrFilterOffset;
+    } fat_exception_clause_t;
+    static_assert(sizeof(fat_exception_clause_t) == 0x18, "fat_exception_clause_t size invalid!");
+
+    enum class ExceptionClauseType : u32 {
+        Catch   = 0x0000,
+        Filter  = 0x0001,
+        Finally = 0x0002,
+        Fault   = 0x0004
+    };
+
+    // All offsets are relative to the first byte of the method's IL code
+    struct ExceptionClause {
+        ExceptionClauseType type;
+        u32 tryStart;
+        u32 tryEnd;
+        u32 handlerStart;
+        u32 handlerEnd;
+        u32 classToken;
+        u32 filterStart;
+
+        bool tryContains(u32 offset) const {
+            return offset >= this->tryStart && offset < this->tryEnd;
+        }
+
+        bool handlerContains(u32 offset) const {
+            return offset >= this->handlerStart && offset < this->handlerEnd;
+        }
+    };
+
+    // Arguments and locals live in 8 byte slots on the context stack, right below the evaluation stack of their frame.
+    // Value types are stored inline and take up as many slots as they need
+    struct FrameSlot {
+        TypeSignature type;
+        u32 offset;
+        u32 size;
+    };
+
+    // Bodies simple enough to run right at the call site without a frame of their own, see MethodBody::classifyTrivialBody
+    enum class TrivialBodyKind : u8 {
+        None,
+        Getter,     // ldarg.0; ldfld; ret
+        Setter,     // ldarg.0; ldarg.1; stfld; ret
+        Constant,   // ldc or ldnull; ret
+        Forward     // ldarg of every argument in order; call; ret
+    };
+
+    struct TrivialBody {
+        TrivialBodyKind kind = TrivialBodyKind::None;
+
+        // Field getters and setters access, the offset already includes the object header
+        u32 fieldIndex = 0;
+        SignatureElementType fieldType = SignatureElementType::End;
+        u32 fieldOffset = 0;
+        u32 fieldSize = 0;
+
+        // Value constant bodies return, stored the way it sits in a stack slot
+        Type constantType = Type::Invalid;
+        u64 constant = 0;
+
+        // MethodDef forwarding bodies call with their own arguments
+        u32 forwardTarget = 0;
+    };
+
+    // Everything about a method body that can be decoded once and reused for every call.
+    // Generic methods get one body per canonical instantiation, see GenericContext::getCanonicalForm
+    struct MethodBody {
+        MethodBody(DLL *dll, u32 methodToken, const GenericContext *canonicalContext = nullptr);
+
+        u8 *code = nullptr;
+        u32 codeSize = 0;
+        u16 maxStack = 0;
+        u32 localVarSigToken = 0;
+        bool initLocals = false;
+
+        MethodSignature signature;
+
+        // TypeDef index of the type declaring this method
+        u32 ownerTypeIndex = 0;
+
+        // Set on static methods and constructors of types whose .cctor has to run before any of them is called.
+        // Cleared once that happened so later calls only test this flag
+        bool triggersTypeInitialization = false;
+
+        // 'this' is the first argument of instance methods
+        std::vector<FrameSlot> arguments;
+        std::vector<FrameSlot> locals;
+        u32 argumentsSize = 0;
+        u32 localsSize = 0;
+
+        // Ordered innermost first, as required by ECMA-335 II.19
+        std::vector<ExceptionClause> exceptionClauses;
+
+        TrivialBody trivial;
+
+    private:
+        // Instantiations over value types quicken their instructions differently than the shared code
+        // does, so they get a private copy of the IL to rewrite
+        std::unique_ptr<u8[]> m_specializedCode;
+
+        std::vector<bool> findBranchTargets() const;
+        void eliminateBoxing(DLL *dll, const GenericContext *canonicalContext);
+        void fuseTypeOf(DLL *dll);
+        void classifyTrivialBody(DLL *dll, u32 methodToken, const GenericContext *canonicalContext);
+    };
+
+}
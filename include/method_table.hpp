@@ -0,0 +1,216 @@
+#pragma once
+
+#include "types.hpp"
+#include "signature.hpp"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace ili {
+
+    struct Context;
+    struct MethodTable;
+
+    // Every object on the heap starts with this header, its fields follow right after it
+    struct ObjectHeader {
+        MethodTable *methodTable;
+    };
+    static_assert(sizeof(ObjectHeader) == 0x08, "ObjectHeader size invalid!");
+
+    constexpr u32 ObjectHeaderSize = sizeof(ObjectHeader);
+
+    // Arrays store their length right after the object header, their elements follow
+    struct ArrayHeader {
+        u64 length;
+    };
+    static_assert(sizeof(ArrayHeader) == 0x08, "ArrayHeader size invalid!");
+
+    constexpr u32 ArrayDataOffset = ObjectHeaderSize + sizeof(ArrayHeader);
+
+    // Multidimensional arrays follow their ArrayHeader with the bounds of every dimension. Their length is the
+    // total number of elements, which are stored row-major after the bounds
+    struct ArrayBounds {
+        s32 length;
+        s32 lowerBound;
+    };
+    static_assert(sizeof(ArrayBounds) == 0x08, "ArrayBounds size invalid!");
+
+    // What ldftn and ldvirtftn push and delegates call. Exists once per method and instantiation
+    struct MethodEntry {
+        u32 methodToken;
+        const GenericContext *genericContext;
+
+        // Static methods don't get the delegate's target as their 'this'
+        bool isStatic;
+
+        // Methods of value types get a pointer into the boxed target as their 'this'
+        bool isValueTypeMethod;
+    };
+
+    // Instance data of delegates, right after their object header. Multicast delegates keep the single cast
+    // delegates they were combined from in a flat object[] and invoke them in order
+    struct DelegateData {
+        u64 target;
+        const MethodEntry *entry;
+        u64 invocationList;
+        u64 invocationCount;
+
+        u64* getInvocationList() const {
+            return reinterpret_cast<u64*>(this->invocationList + ArrayDataOffset);
+        }
+    };
+    static_assert(sizeof(DelegateData) == 0x20, "DelegateData size invalid!");
+
+    // What mkrefany pushes, a managed pointer along with the type of what it points to
+    struct TypedReference {
+        u8 *address;
+        MethodTable *type;
+    };
+    static_assert(sizeof(TypedReference) == 0x10, "TypedReference size invalid!");
+
+    struct MethodInvoker;
+
+    // Instance data of the System.Type objects typeof and GetType hand out. Every type has exactly one of them
+    struct RuntimeTypeData {
+        MethodTable *type;
+    };
+
+    // Instance data of the MethodInfo objects Type.GetMethod hands out, one per method
+    struct RuntimeMethodData {
+        const MethodInvoker *invoker;
+    };
+
+    struct InterfaceMethod {
+        u32 interfaceMethodId = 0;
+        u32 target = 0;
+    };
+
+    // One entry of an interface method table. Interface methods whose IDs hash to the same entry after the first one
+    // go into its conflict list
+    struct ImtEntry {
+        InterfaceMethod method;
+        std::vector<InterfaceMethod> conflicts;
+    };
+
+    // Runtime representation of a type, shared by all of its instances through their object header
+    struct MethodTable {
+        MethodTable(Context &ctx, const TypeSignature &type);
+
+        // Types the runtime provides instances of itself, like System.Type. They have no metadata to build them from
+        MethodTable(Context &ctx, const std::string &name, u32 instanceSize);
+
+        // Types defined in the assembly are identified by their TypeDef token, other types by their TypeRef
+        // token or, for primitives, by their signature element type
+        TypeSignature type;
+        std::string name;
+
+        MethodTable *parent = nullptr;
+
+        // Type arguments of generic instances, nullptr for all other types
+        const GenericContext *instantiation = nullptr;
+
+        // Ancestors indexed by their depth in the hierarchy, the type itself included. Testing whether a type derives
+        // from a class of depth d is a single compare of typeDisplay[d] as long as d < TypeDisplaySize
+        static constexpr u32 TypeDisplaySize = 8;
+        u32 depth = 0;
+        const MethodTable *typeDisplay[TypeDisplaySize] = { };
+
+        // Size of an instance including its header. For value types this is the size of the boxed value
+        u32 instanceSize = ObjectHeaderSize;
+        bool isValueType = false;
+
+        // Delegate types have no fields of their own, their instances hold DelegateData instead
+        bool isDelegate = false;
+
+        // No other type can derive from sealed types
+        bool isSealed = false;
+
+        // Set on array types only. Element sizes are the sizes of the values, references take up 8 bytes.
+        // SZ arrays have a rank of 1 and no ArrayBounds
+        MethodTable *elementType = nullptr;
+        SignatureElementType elementStorageType = SignatureElementType::End;
+        u32 elementSize = 0;
+        u32 rank = 0;
+        u32 dataOffset = 0;
+
+        // Arrays of reference types are covariant, stelem.ref remembers the last type of value that passed its check
+        const MethodTable *lastStoredType = nullptr;
+
+        // System.Type object of this type, created the first time it's asked for. See Context::getRuntimeType
+        u64 runtimeType = 0;
+
+        // Parameterless constructor Activator.CreateInstance calls, found the first time it's needed
+        const MethodInvoker *defaultConstructor = nullptr;
+
+        // Offsets of all references in an instance, relative to the start of the object. Built by getReferenceOffsets
+        // the first time the garbage collector needs them. For arrays these are the references in the array itself,
+        // references in the elements are described by the element type
+        bool hasReferenceMap = false;
+        std::vector<u32> referenceOffsets;
+
+        // MethodDef tokens of the implementations of all virtual methods, slots inherited from the parent come first
+        std::vector<u32> vtable;
+
+        // All interfaces implemented by the type, including the ones of its parent and the bases of those interfaces.
+        // For interfaces themselves these are the interfaces they extend
+        bool isInterface = false;
+        std::vector<MethodTable*> interfaces;
+
+        // Implementations of interface methods, hashed by interface method ID
+        static constexpr u32 ImtSize = 32;
+        std::array<ImtEntry, ImtSize> imt;
+
+        // MethodDef token implementing the given interface method, 0 if the type doesn't implement it. Methods of other
+        // assemblies get the override found for them added once it was looked up, see Method::findVirtualCallTarget
+        u32 getInterfaceMethod(u32 interfaceMethodId) const {
+            auto &entry = this->imt[interfaceMethodId % ImtSize];
+
+            if (entry.method.interfaceMethodId == interfaceMethodId)
+                return entry.method.target;
+
+            for (auto &conflict : entry.conflicts) {
+                if (conflict.interfaceMethodId == interfaceMethodId)
+                    return conflict.target;
+            }
+
+            return 0;
+        }
+
+        void setInterfaceMethod(u32 interfaceMethodId, u32 target);
+
+        bool isSubclassOf(const MethodTable *other) const {
+            if (other->depth < TypeDisplaySize)
+                return this->typeDisplay[other->depth] == other;
+
+            return isDeepSubclassOf(other);
+        }
+
+        bool implements(const MethodTable *interface) const;
+
+        // Type arguments the given generic type definition has in this type's hierarchy, e.g. for running
+        // methods inherited from it
+        const GenericContext* getInstantiationOf(u32 typeDefIndex) const;
+
+        const std::vector<u32>& getReferenceOffsets(Context &ctx);
+
+        bool isAssignableTo(const MethodTable *other) const {
+            if (other->elementType != nullptr && this->elementType != nullptr)
+                return isArrayAssignableTo(other);
+
+            return other->isInterface ? implements(other) : isSubclassOf(other);
+        }
+
+    private:
+        bool isDeepSubclassOf(const MethodTable *other) const;
+        bool isArrayAssignableTo(const MethodTable *other) const;
+        void buildTypeDisplay();
+        void addReferenceOffsets(Context &ctx, const TypeSignature &type, u32 offset);
+        void buildVTable(Context &ctx, u32 typeDefIndex);
+        void buildInterfaceTable(Context &ctx, u32 typeDefIndex);
+        void addInterface(MethodTable *interface);
+        u32 findInterfaceImplementation(Context &ctx, u32 methodToken, const MethodTable *interface);
+        u32 getMostDerivedImplementation(Context &ctx, u32 methodToken);
+    };
+
+}
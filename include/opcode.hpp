@@ -197,6 +197,35 @@ namespace ili {
         Stind_i,
         Conv_u,
 
+        // Quickened instructions. The interpreter rewrites an instruction into one of these once its token
+        // operand got resolved, they reuse opcodes ECMA-335 leaves unassigned and never appear in a file
+        Ldfld_i4_q      = 0xA6,     // Operand is the field offset
+        Ldfld_i8_q      = 0xA7,     // Operand is the field offset
+        Ldfld_ref_q     = 0xA8,     // Operand is the field offset
+        Ldfld_q         = 0xA9,     // Operand indexes Context::resolvedFields
+        Stfld_i4_q      = 0xAA,     // Operand is the field offset
+        Stfld_i8_q      = 0xAB,     // Operand is the field offset
+        Stfld_ref_q     = 0xAC,     // Operand is the field offset
+        Stfld_q         = 0xAD,     // Operand indexes Context::resolvedFields
+        Ldflda_q        = 0xAE,     // Operand is the field offset
+        Ldsfld_q        = 0xAF,     // Operand indexes Context::resolvedFields
+        Stsfld_q        = 0xB0,     // Operand indexes Context::resolvedFields
+        Ldsflda_q       = 0xB1,     // Operand indexes Context::resolvedFields
+        Callvirt_q      = 0xB2,     // Operand indexes Context::virtualCalls
+        Castclass_q     = 0xBB,     // Operand indexes Context::typeChecks
+        Isinst_q        = 0xBC,     // Operand indexes Context::typeChecks
+        Ldftn_q         = 0xBD,     // Operand indexes Context::methodEntries
+        Ldvirtftn_q     = 0xBE,     // Operand indexes Context::virtualCalls
+        Newarr_q        = 0xBF,     // Operand indexes Context::arrayTypes
+        Ldelema_q       = 0xC0,     // Operand indexes Context::arrayTypes
+        Ldelem_q        = 0xC1,     // Operand indexes Context::arrayTypes
+        Stelem_q        = 0xC4,     // Operand indexes Context::arrayTypes
+        Call_array_q    = 0xC5,     // Operand indexes Context::arrayAccessors, also replaces newobj
+        Ldtoken_q       = 0xC7,     // Operand indexes Context::tokenTypes
+        Ldtype          = 0xC8,     // ldtoken of a type followed by a call to Type.GetTypeFromHandle, see MethodBody::fuseTypeOf
+        Ldtype_q        = 0xC9,     // Operand indexes Context::tokenTypes, skips the nops Ldtype is followed by
+        Call_q          = 0xCA,     // Operand indexes Context::directCalls
+
         Arglist = 0xFE00,
         Ceq,
         Cgt,
@@ -205,7 +234,7 @@ namespace ili {
         Clt_un,
         Ldftn,
         Ldvirtftn = 0xFE07,
-        Ldarg = 0xFE0A,
+        Ldarg = 0xFE09,
         Ldarga,
         Starg,
         Ldloc,
@@ -226,4 +255,66 @@ namespace ili {
         Refanytype,
         Readonly
     };
-}
\ No newline at end of file
+
+    // Size of an instruction's inline operand. Switch tables are variable length and handled by getInstructionSize
+    inline u32 getOperandSize(OpcodePrefix opcode) {
+        switch (opcode) {
+            case OpcodePrefix::Ldarg_s: case OpcodePrefix::Ldarga_s: case OpcodePrefix::Starg_s:
+            case OpcodePrefix::Ldloc_s: case OpcodePrefix::Ldloca_s: case OpcodePrefix::Stloc_s:
+            case OpcodePrefix::Ldc_i4_s: case OpcodePrefix::Leave_s: case OpcodePrefix::Unaligned:
+            case OpcodePrefix::No:
+                return 1;
+            case OpcodePrefix::Ldarg: case OpcodePrefix::Ldarga: case OpcodePrefix::Starg:
+            case OpcodePrefix::Ldloc: case OpcodePrefix::Ldloca: case OpcodePrefix::Stloc:
+                return 2;
+            case OpcodePrefix::Ldc_i8: case OpcodePrefix::Ldc_r8:
+                return 8;
+            case OpcodePrefix::Ldc_i4: case OpcodePrefix::Ldc_r4: case OpcodePrefix::Jmp:
+            case OpcodePrefix::Call: case OpcodePrefix::Calli: case OpcodePrefix::Callvirt:
+            case OpcodePrefix::Cpobj: case OpcodePrefix::Ldobj: case OpcodePrefix::Ldstr:
+            case OpcodePrefix::Newobj: case OpcodePrefix::Castclass: case OpcodePrefix::Isinst:
+            case OpcodePrefix::Unbox: case OpcodePrefix::Ldfld: case OpcodePrefix::Ldflda:
+            case OpcodePrefix::Stfld: case OpcodePrefix::Ldsfld: case OpcodePrefix::Ldsflda:
+            case OpcodePrefix::Stsfld: case OpcodePrefix::Stobj: case OpcodePrefix::Box:
+            case OpcodePrefix::Newarr: case OpcodePrefix::Ldelema: case OpcodePrefix::Ldelem:
+            case OpcodePrefix::Stelem: case OpcodePrefix::Unbox_any: case OpcodePrefix::Refanyval:
+            case OpcodePrefix::Mkrefany: case OpcodePrefix::Ldtoken: case OpcodePrefix::Leave:
+            case OpcodePrefix::Ldftn: case OpcodePrefix::Ldvirtftn: case OpcodePrefix::Initobj:
+            case OpcodePrefix::Constrained: case OpcodePrefix::Size_of:
+                return 4;
+            case OpcodePrefix::Ldfld_i4_q: case OpcodePrefix::Ldfld_i8_q: case OpcodePrefix::Ldfld_ref_q:
+            case OpcodePrefix::Ldfld_q: case OpcodePrefix::Stfld_i4_q: case OpcodePrefix::Stfld_i8_q:
+            case OpcodePrefix::Stfld_ref_q: case OpcodePrefix::Stfld_q: case OpcodePrefix::Ldflda_q:
+            case OpcodePrefix::Ldsfld_q: case OpcodePrefix::Stsfld_q: case OpcodePrefix::Ldsflda_q:
+            case OpcodePrefix::Callvirt_q: case OpcodePrefix::Castclass_q: case OpcodePrefix::Isinst_q:
+            case OpcodePrefix::Ldftn_q: case OpcodePrefix::Ldvirtftn_q: case OpcodePrefix::Newarr_q:
+            case OpcodePrefix::Ldelema_q: case OpcodePrefix::Ldelem_q: case OpcodePrefix::Stelem_q:
+            case OpcodePrefix::Call_array_q: case OpcodePrefix::Ldtoken_q: case OpcodePrefix::Ldtype:
+            case OpcodePrefix::Ldtype_q: case OpcodePrefix::Call_q:
+                return 4;
+            default:
+                if (opcode >= OpcodePrefix::Br_s && opcode <= OpcodePrefix::Blt_un_s)
+                    return 1;
+                if (opcode >= OpcodePrefix::Br && opcode <= OpcodePrefix::Blt_un)
+                    return 4;
+                return 0;
+        }
+    }
+
+    inline OpcodePrefix readOpcode(const u8 *instruction) {
+        if (instruction[0] == 0xFE)
+            return static_cast<OpcodePrefix>(0xFE00 | instruction[1]);
+        else
+            return static_cast<OpcodePrefix>(instruction[0]);
+    }
+
+    // Total size of the instruction in bytes, including its opcode and operands
+    inline u32 getInstructionSize(const u8 *instruction) {
+        OpcodePrefix opcode = readOpcode(instruction);
+
+        if (opcode == OpcodePrefix::Swtch)
+            return 1 + 4 + *reinterpret_cast<const u32*>(instruction + 1) * 4;
+
+        return (instruction[0] == 0xFE ? 2 : 1) + getOperandSize(opcode);
+    }
+}
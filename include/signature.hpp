@@ -0,0 +1,132 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+
+namespace ili {
+
+    class DLL;
+
+#define SIGNATURE_HAS_THIS          0x20
+#define SIGNATURE_EXPLICIT_THIS     0x40
+#define SIGNATURE_GENERIC           0x10
+#define SIGNATURE_LOCAL             0x07
+#define SIGNATURE_FIELD             0x06
+#define SIGNATURE_GENERIC_INST      0x0A
+
+    struct TypeSignature {
+        SignatureElementType elementType = SignatureElementType::End;
+
+        // TypeDef, TypeRef or TypeSpec token of class and value types
+        u32 typeToken = 0;
+
+        // Signature type of whatever a pointer, byref or array refers to
+        SignatureElementType innerType = SignatureElementType::End;
+
+        // Type arguments of generic instances, including generic instances a pointer, byref or array refers to
+        std::vector<TypeSignature> typeArguments;
+
+        // Full signature of what a pointer, byref or array refers to if that is a pointer, byref or array itself, which
+        // the fields above only describe one level of. Empty otherwise
+        std::vector<TypeSignature> nestedType;
+
+        // Number of dimensions of Array types. Their sizes and lower bounds are only known once an instance exists
+        u32 rank = 0;
+
+        // Set on locals the code pins. The collector never moves what they point to, it's not part of the type itself
+        bool isPinned = false;
+
+        bool isValueType() const {
+            switch (this->elementType) {
+                case SignatureElementType::Boolean: case SignatureElementType::Char:
+                case SignatureElementType::I1: case SignatureElementType::U1:
+                case SignatureElementType::I2: case SignatureElementType::U2:
+                case SignatureElementType::I4: case SignatureElementType::U4:
+                case SignatureElementType::I8: case SignatureElementType::U8:
+                case SignatureElementType::R4: case SignatureElementType::R8:
+                case SignatureElementType::I: case SignatureElementType::U:
+                case SignatureElementType::ValueType: case SignatureElementType::TypedByRef:
+                    return true;
+                case SignatureElementType::GenericInst:
+                    return this->innerType == SignatureElementType::ValueType;
+                default:
+                    return false;
+            }
+        }
+
+        // Generic instances of value types and typed references are stored like any other value type
+        SignatureElementType getStorageType() const {
+            if (this->elementType == SignatureElementType::GenericInst && this->innerType == SignatureElementType::ValueType)
+                return SignatureElementType::ValueType;
+            if (this->elementType == SignatureElementType::TypedByRef)
+                return SignatureElementType::ValueType;
+
+            return this->elementType;
+        }
+
+        // Makes a pointer, byref or array type refer to inner
+        void setInnerType(const TypeSignature &inner);
+
+        // Whether the type refers to a Var or MVar and means something else in every instantiation
+        bool dependsOnGenericParameters() const;
+
+        bool operator==(const TypeSignature &other) const {
+            return this->elementType == other.elementType && this->typeToken == other.typeToken
+                && this->innerType == other.innerType && this->typeArguments == other.typeArguments
+                && this->nestedType == other.nestedType && this->rank == other.rank;
+        }
+    };
+
+    // Unique string for a type, used to key caches of generic instantiations
+    std::string getTypeKey(const TypeSignature &type);
+
+    struct MethodSignature {
+        bool hasThis = false;
+        u32 genericParameterCount = 0;
+        TypeSignature returnType;
+        std::vector<TypeSignature> parameters;
+    };
+
+    // Type arguments of the generic type and generic method some code runs for. Var and MVar types in
+    // the code's signatures and IL refer to these
+    struct GenericContext {
+        std::vector<TypeSignature> typeArguments;
+        std::vector<TypeSignature> methodArguments;
+
+        bool empty() const {
+            return this->typeArguments.empty() && this->methodArguments.empty();
+        }
+
+        TypeSignature substitute(const TypeSignature &type) const;
+        MethodSignature substitute(const MethodSignature &signature) const;
+
+        // All reference type arguments replaced by Object. Instantiations with the same canonical form have
+        // the same layouts and share their code
+        GenericContext getCanonicalForm() const;
+        bool hasValueTypeArguments() const;
+
+        std::string getKey() const;
+    };
+
+    class SignatureReader {
+    public:
+        SignatureReader(DLL *dll, u8 *signature);
+
+        u8 readByte();
+        u32 readCompressed();
+        u32 readTypeDefOrRef();
+        TypeSignature readType();
+
+        MethodSignature readMethodSignature();
+        std::vector<TypeSignature> readLocalsSignature();
+        TypeSignature readFieldSignature();
+        std::vector<TypeSignature> readMethodSpecSignature();
+
+    private:
+        DLL *m_dll;
+        u8 *m_pointer;
+    };
+
+}
@@ -11,8 +11,14 @@ namespace ili {
 #define TABLE_ID_TYPEDEF        0x02
 #define TABLE_ID_MEMBERREF      0x0A
 #define TABLE_ID_CLASS_LAYOUT   0x0F
+#define TABLE_ID_FIELD_LAYOUT   0x10
 #define TABLE_ID_MODULE         0x00
 #define TABLE_ID_FIELD          0x04
+#define TABLE_ID_INTERFACE_IMPL 0x09
+#define TABLE_ID_STAND_ALONE_SIG 0x11
+#define TABLE_ID_METHOD_IMPL    0x19
+#define TABLE_ID_TYPESPEC       0x1B
+#define TABLE_ID_METHODSPEC     0x2B
 
     typedef struct PACKED { // 0x06
         u32 rva;
@@ -64,18 +70,63 @@ namespace ili {
         u16 encBaseId;
     } table_module_t;
 
+    typedef struct PACKED { // 0x09
+        u16 classIndex;
+        u16 interfaceIndex;
+    } table_interface_impl_t;
+
     typedef struct PACKED { // 0x0F
         u16 packingSize;
         u32 classSize;
         u16 parentIndex;
     } table_class_layout_t;
 
+    typedef struct PACKED { // 0x10
+        u32 offset;
+        u16 fieldIndex;
+    } table_field_layout_t;
+
     typedef struct PACKED { // 0x04
         u16 flags;
         u16 nameIndex;
         u16 signatureIndex;
     } table_field_t;
 
+    typedef struct PACKED { // 0x11
+        u16 signatureIndex;
+    } table_stand_alone_sig_t;
+
+    typedef struct PACKED { // 0x19
+        u16 classIndex;
+        u16 methodBodyIndex;
+        u16 methodDeclarationIndex;
+    } table_method_impl_t;
+
+    typedef struct PACKED { // 0x1B
+        u16 signatureIndex;
+    } table_type_spec_t;
+
+    typedef struct PACKED { // 0x2B
+        u16 methodIndex;
+        u16 instantiationIndex;
+    } table_method_spec_t;
+
+#define FIELD_ATTRIBUTE_STATIC      0x0010
+#define FIELD_ATTRIBUTE_LITERAL     0x0040
+
+#define TYPE_ATTRIBUTE_INTERFACE            0x0020
+#define TYPE_ATTRIBUTE_SEALED               0x0100
+#define TYPE_ATTRIBUTE_LAYOUT_MASK          0x0018
+#define TYPE_ATTRIBUTE_AUTO_LAYOUT          0x0000
+#define TYPE_ATTRIBUTE_SEQUENTIAL_LAYOUT    0x0008
+#define TYPE_ATTRIBUTE_EXPLICIT_LAYOUT      0x0010
+#define TYPE_ATTRIBUTE_BEFORE_FIELD_INIT    0x00100000
+
+#define METHOD_ATTRIBUTE_STATIC     0x0010
+#define METHOD_ATTRIBUTE_VIRTUAL    0x0040
+#define METHOD_ATTRIBUTE_NEW_SLOT   0x0100
+#define METHOD_ATTRIBUTE_ABSTRACT   0x0400
+
 #define TYPE_DEF_OR_REF 2
 #define HAS_CONSTANT 2
 #define HAS_CUSTOM_ATTRIBUTE 5
@@ -90,7 +141,7 @@ namespace ili {
 #define RESOLUTION_SCOPE 2
 #define TYPE_OR_METHOD_DEF 1
 
-#define INDEX_TAG(index, tag_type) index & (0xFFFFFFFF << tag_type)
+#define INDEX_TAG(index, tag_type) ((index) & ((1 << (tag_type)) - 1))
 #define INDEX_INDEX(index, tag_type) (index >> tag_type)
 
 }
\ No newline at end of file
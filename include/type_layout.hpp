@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.hpp"
+#include "signature.hpp"
+
+#include <vector>
+
+namespace ili {
+
+    struct FieldLayout {
+        u32 fieldIndex;
+        TypeSignature type;
+        u32 offset;
+        u32 size;
+    };
+
+    // Memory layout of a type's instance fields, computed once per TypeDef or generic instantiation.
+    // Offsets are relative to the start of the instance data and already account for all base class fields
+    struct TypeLayout {
+        u32 size = 0;
+        u32 alignment = 1;
+
+        // TypeDef index of the base class if it's defined in the same assembly, 0 otherwise
+        u32 baseTypeIndex = 0;
+
+        // Instance fields declared by the type itself, in declaration order
+        std::vector<FieldLayout> fields;
+
+        // Static fields get their own storage per type. Offsets are relative to its start
+        u32 staticSize = 0;
+        std::vector<FieldLayout> staticFields;
+    };
+
+}
@@ -24,48 +24,53 @@ enum class Type : u8 {
     Native_unsigned_int     = 8,
     F                       = 16,
     O                       = 32,
-    Pointer                 = 64
+    Pointer                 = 64,
+
+    // Value types take up as many stack slots as they need. Their topmost slot is tagged
+    // ValueType, all slots below it that belong to the same value are tagged ValueTypePart
+    ValueType               = 128,
+    ValueTypePart           = 129
 };
 
 enum class SignatureElementType : u8 {
-    End,
-    Void,
-    Boolean,
-    Char,
-    I1,
-    U1,
-    I2,
-    U2,
-    I4,
-    U4,
-    I8,
-    U8,
-    R4,
-    R8,
-    String,
-    Ptr,
-    ByRef,
-    ValueType,
-    Class,
-    Var,
-    Array,
-    GenericInst,
-    TypedByRef,
-    I,
-    U,
-    FuncPtr,
-    Object,
-    SzArray,
-    MVar,
-    CmodReqd,
-    CmodOpt,
-    Internal,
-    Modifier,
-    Sentinel,
-    Pinned
+    End             = 0x00,
+    Void            = 0x01,
+    Boolean         = 0x02,
+    Char            = 0x03,
+    I1              = 0x04,
+    U1              = 0x05,
+    I2              = 0x06,
+    U2              = 0x07,
+    I4              = 0x08,
+    U4              = 0x09,
+    I8              = 0x0A,
+    U8              = 0x0B,
+    R4              = 0x0C,
+    R8              = 0x0D,
+    String          = 0x0E,
+    Ptr             = 0x0F,
+    ByRef           = 0x10,
+    ValueType       = 0x11,
+    Class           = 0x12,
+    Var             = 0x13,
+    Array           = 0x14,
+    GenericInst     = 0x15,
+    TypedByRef      = 0x16,
+    I               = 0x18,
+    U               = 0x19,
+    FuncPtr         = 0x1B,
+    Object          = 0x1C,
+    SzArray         = 0x1D,
+    MVar            = 0x1E,
+    CmodReqd        = 0x1F,
+    CmodOpt         = 0x20,
+    Internal        = 0x21,
+    Modifier        = 0x40,
+    Sentinel        = 0x41,
+    Pinned          = 0x45
 };
 
-static u8 getSignatureElementTypeSize(SignatureElementType type) {
+inline u8 getSignatureElementTypeSize(SignatureElementType type) {
     switch (type) {
         case SignatureElementType::Boolean: return 1;
         case SignatureElementType::Char: return 2;
@@ -81,11 +86,57 @@ static u8 getSignatureElementTypeSize(SignatureElementType type) {
         case SignatureElementType::R8: return 8;
         case SignatureElementType::String: return 8;
         case SignatureElementType::Ptr: return 8;
+        case SignatureElementType::ByRef: return 8;
+        case SignatureElementType::Class: return 8;
+        case SignatureElementType::Array: return 8;
+        case SignatureElementType::I: return 8;
+        case SignatureElementType::U: return 8;
+        case SignatureElementType::FuncPtr: return 8;
+        case SignatureElementType::Object: return 8;
+        case SignatureElementType::SzArray: return 8;
+        case SignatureElementType::TypedByRef: return 16;
         default: return 0;
     }
 }
 
-static u8 getTypeSize(Type type) {
+// Type a value of the given signature type has once it got loaded onto the evaluation stack
+inline Type getStackType(SignatureElementType type) {
+    switch (type) {
+        case SignatureElementType::Boolean:
+        case SignatureElementType::Char:
+        case SignatureElementType::I1:
+        case SignatureElementType::U1:
+        case SignatureElementType::I2:
+        case SignatureElementType::U2:
+        case SignatureElementType::I4:
+        case SignatureElementType::U4:
+            return Type::Int32;
+        case SignatureElementType::I8:
+        case SignatureElementType::U8:
+            return Type::Int64;
+        case SignatureElementType::R4:
+        case SignatureElementType::R8:
+            return Type::F;
+        case SignatureElementType::I:
+        case SignatureElementType::U:
+        case SignatureElementType::Ptr:
+        case SignatureElementType::FuncPtr:
+            return Type::Native_int;
+        case SignatureElementType::ByRef:
+            return Type::Pointer;
+        case SignatureElementType::String:
+        case SignatureElementType::Class:
+        case SignatureElementType::Array:
+        case SignatureElementType::Object:
+        case SignatureElementType::SzArray:
+        case SignatureElementType::GenericInst:
+            return Type::O;
+        default:
+            return Type::Invalid;
+    }
+}
+
+inline u8 getTypeSize(Type type) {
     switch (type) {
         case Type::Int32: return 4;
         case Type::Int64: return 8;
@@ -94,6 +145,8 @@ static u8 getTypeSize(Type type) {
         case Type::F: return 8;
         case Type::O: return 8;
         case Type::Pointer: return 8;
+        case Type::ValueType: return 8;
+        case Type::ValueTypePart: return 8;
         default: return 0;
     }
 }
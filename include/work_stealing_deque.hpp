@@ -0,0 +1,120 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace ili {
+
+    // Chase-Lev deque. Its owner pushes and pops at the bottom without taking any locks, other threads steal from
+    // the top and only race with each other, or the owner taking the last item, through a compare and swap on top.
+    // Full buffers are replaced by ones twice as large. Old buffers stay alive until the deque is gone, since a
+    // thief might still be reading from one
+    template<typename T>
+    class WorkStealingDeque {
+    public:
+        explicit WorkStealingDeque(size_t capacity = 0x1000) {
+            this->m_buffers.push_back(std::make_unique<Buffer>(capacity));
+            this->m_buffer.store(this->m_buffers.back().get(), std::memory_order_relaxed);
+        }
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+        // Owner only
+        void push(T item) {
+            s64 bottom = this->m_bottom.load(std::memory_order_relaxed);
+            s64 top = this->m_top.load(std::memory_order_acquire);
+            Buffer *buffer = this->m_buffer.load(std::memory_order_relaxed);
+
+            if (bottom - top >= static_cast<s64>(buffer->capacity))
+                buffer = grow(buffer, top, bottom);
+
+            buffer->put(bottom, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            this->m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        // Owner only. Returns false if the deque is empty
+        bool pop(T &item) {
+            s64 bottom = this->m_bottom.load(std::memory_order_relaxed) - 1;
+            Buffer *buffer = this->m_buffer.load(std::memory_order_relaxed);
+
+            this->m_bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 top = this->m_top.load(std::memory_order_relaxed);
+
+            if (top > bottom) {
+                this->m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                return false;
+            }
+
+            item = buffer->get(bottom);
+            if (top != bottom)
+                return true;
+
+            // Last item, a thief might be taking it at the same time
+            bool taken = this->m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            this->m_bottom.store(bottom + 1, std::memory_order_relaxed);
+
+            return taken;
+        }
+
+        // Any thread. Returns false if the deque is empty or another thread got the item first
+        bool steal(T &item) {
+            s64 top = this->m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 bottom = this->m_bottom.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+                return false;
+
+            item = this->m_buffer.load(std::memory_order_acquire)->get(top);
+
+            return this->m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+
+        bool empty() const {
+            return this->m_top.load(std::memory_order_acquire) >= this->m_bottom.load(std::memory_order_acquire);
+        }
+
+    private:
+        struct Buffer {
+            explicit Buffer(size_t capacity) : capacity(capacity), items(std::make_unique<std::atomic<T>[]>(capacity)) { }
+
+            T get(s64 index) const {
+                return this->items[static_cast<size_t>(index) & (this->capacity - 1)].load(std::memory_order_relaxed);
+            }
+
+            void put(s64 index, T item) {
+                this->items[static_cast<size_t>(index) & (this->capacity - 1)].store(item, std::memory_order_relaxed);
+            }
+
+            // Always a power of two
+            size_t capacity;
+            std::unique_ptr<std::atomic<T>[]> items;
+        };
+
+        Buffer* grow(Buffer *buffer, s64 top, s64 bottom) {
+            this->m_buffers.push_back(std::make_unique<Buffer>(buffer->capacity * 2));
+            Buffer *grown = this->m_buffers.back().get();
+
+            for (s64 i = top; i < bottom; i++)
+                grown->put(i, buffer->get(i));
+
+            this->m_buffer.store(grown, std::memory_order_release);
+
+            return grown;
+        }
+
+        // Top and bottom get their own cache lines, they are written by different threads
+        alignas(64) std::atomic<s64> m_top = 0;
+        alignas(64) std::atomic<s64> m_bottom = 0;
+        std::atomic<Buffer*> m_buffer;
+
+        std::vector<std::unique_ptr<Buffer>> m_buffers;
+    };
+
+}
@@ -4,6 +4,8 @@
 #include "file_headers.hpp"
 #include "tables.hpp"
 #include "logger.hpp"
+#include "signature.hpp"
+#include "method_table.hpp"
 
 #include <string>
 #include <stdio.h>
@@ -11,6 +13,7 @@
 #include <vector>
 #include <codecvt>
 #include <locale>
+#include <algorithm>
 
 namespace ili {
 
@@ -182,6 +185,26 @@ namespace ili {
         return reinterpret_cast<table_field_t*>(this->m_tildeTableData[TABLE_ID_FIELD][index - 1].base);
     }
 
+    table_stand_alone_sig_t* DLL::getStandAloneSigByIndex(u32 index) {
+        return reinterpret_cast<table_stand_alone_sig_t*>(this->m_tildeTableData[TABLE_ID_STAND_ALONE_SIG][index - 1].base);
+    }
+
+    table_type_spec_t* DLL::getTypeSpecByIndex(u32 index) {
+        return reinterpret_cast<table_type_spec_t*>(this->m_tildeTableData[TABLE_ID_TYPESPEC][index - 1].base);
+    }
+
+    table_method_impl_t* DLL::getMethodImplByIndex(u32 index) {
+        return reinterpret_cast<table_method_impl_t*>(this->m_tildeTableData[TABLE_ID_METHOD_IMPL][index - 1].base);
+    }
+
+    table_interface_impl_t* DLL::getInterfaceImplByIndex(u32 index) {
+        return reinterpret_cast<table_interface_impl_t*>(this->m_tildeTableData[TABLE_ID_INTERFACE_IMPL][index - 1].base);
+    }
+
+    table_method_spec_t* DLL::getMethodSpecByIndex(u32 index) {
+        return reinterpret_cast<table_method_spec_t*>(this->m_tildeTableData[TABLE_ID_METHODSPEC][index - 1].base);
+    }
+
     u32 DLL::getEntryMethodToken() {
         return this->m_crlRuntimeHeader->entryPointToken;
     }
@@ -190,6 +213,17 @@ namespace ili {
         return reinterpret_cast<char*>(&this->m_stringsHeap[index]);
     }
 
+    u8 DLL::getCompressedHeaderSize(u8 firstByte) {
+        if ((firstByte & 0x80) == 0x00)
+            return 1;
+        if ((firstByte & 0xC0) == 0x80)
+            return 2;
+        if ((firstByte & 0xE0) == 0xC0)
+            return 4;
+
+        return 0;
+    }
+
     u32 DLL::getBlobSize(u32 index) {
         switch (getBlobHeaderSize(index)) {
             case 1: return this->m_blobHeap[index];
@@ -203,19 +237,14 @@ namespace ili {
     }
 
     u8 DLL::getBlobHeaderSize(u32 index) {
-        if ((this->m_userStringsHeap[index] & 0x80) == 0x00)
-            return 1;
-        if ((this->m_userStringsHeap[index] & 0xC0) == 0x80)
-            return 2;
-        if ((this->m_userStringsHeap[index] & 0xE0) == 0xC0)
-            return 4;
-
-        return 0;
+        return getCompressedHeaderSize(this->m_blobHeap[index]);
     }
 
     const char16_t* DLL::getUserString(u32 index) {
-        if ((index >> 24) == 0x70)
-            return reinterpret_cast<char16_t*>(&this->m_userStringsHeap[index & 0x00FFFFFF] + getBlobHeaderSize(index));
+        if ((index >> 24) == 0x70) {
+            u8 *userString = &this->m_userStringsHeap[index & 0x00FFFFFF];
+            return reinterpret_cast<char16_t*>(userString + getCompressedHeaderSize(*userString));
+        }
 
         return nullptr;
     }
@@ -234,7 +263,18 @@ namespace ili {
 
     std::string DLL::getFullMethodName(u32 methodToken) {
         auto memberRef = this->getMemberRefByMetadataToken(methodToken);
-        auto typeRef = this->getTypeRefByIndex(INDEX_INDEX(memberRef->classIndex, MEMBER_REF_PARENT));
+        u32 parentToken = this->decodeMemberRefParent(memberRef->classIndex);
+
+        // Methods of generic instances are named after their generic type definition
+        if (TABLE_ID(parentToken) == TABLE_ID_TYPESPEC)
+            parentToken = this->resolveTypeToken(parentToken).typeToken;
+
+        if (TABLE_ID(parentToken) != TABLE_ID_TYPEREF) {
+            Logger::error("Method %08x is not defined in another assembly!", methodToken);
+            exit(1);
+        }
+
+        auto typeRef = this->getTypeRefByIndex(TABLE_INDEX(parentToken));
         auto assemblyRef = this->getAssemblyRefByIndex(INDEX_INDEX(typeRef->resolutionScopeIndex, RESOLUTION_SCOPE));
 
         auto assembly = this->getString(assemblyRef->nameIndex);
@@ -262,34 +302,515 @@ namespace ili {
     }
 
     u16 DLL::findTypeDefWithMethod(u32 methodToken) {
-        table_method_def_t *methodToFind = this->getMethodDefByMetadataToken(methodToken);
-
-        if (methodToFind == nullptr)
+        if (TABLE_ID(methodToken) != TABLE_ID_METHODDEF)
             return 0;
 
-        // Check all rows in the typedef table except the last one for if it contains the method
-        for (u32 i = 0; i < this->m_numRows[TABLE_ID_METHODDEF] - 1; i++) {
-            table_type_def_t* currTypeDef = reinterpret_cast<table_type_def_t*>(this->m_tildeTableData[TABLE_ID_TYPEDEF][i].base);
-            table_type_def_t* nextTypeDef = reinterpret_cast<table_type_def_t*>(this->m_tildeTableData[TABLE_ID_TYPEDEF][i + 1].base);
+        u32 methodIndex = TABLE_INDEX(methodToken);
 
-            table_method_def_t* currMethodDef = this->getMethodDefByIndex(currTypeDef->methodListIndex);
-            table_method_def_t* nextMethodDef = this->getMethodDefByIndex(nextTypeDef->methodListIndex);
+        // Every type owns the methods from its own method list index up to the one of the next type
+        for (u32 i = this->m_numRows[TABLE_ID_TYPEDEF]; i > 0; i--) {
+            if (this->getTypeDefByIndex(i)->methodListIndex <= methodIndex)
+                return i;
+        }
 
-            if (methodToFind >= currMethodDef && methodToFind < nextMethodDef)
-                return i + 1;
+        return 0;
+    }
+
+    u16 DLL::findTypeDefWithField(u32 fieldIndex) {
+        // Same as for methods, the field lists of all types are stored back to back
+        for (u32 i = this->m_numRows[TABLE_ID_TYPEDEF]; i > 0; i--) {
+            if (this->getTypeDefByIndex(i)->fieldListIndex <= fieldIndex)
+                return i;
         }
 
-        // When the method hasn't been found in the previous rows, it has to be in the last one
-        // since if it wouldn't exist at all, methodToFind would have been nullptr
-        return this->m_numRows[TABLE_ID_METHODDEF];
+        return 0;
+    }
+
+    u32 DLL::getFieldListEnd(u32 typeDefIndex) {
+        if (typeDefIndex < this->m_numRows[TABLE_ID_TYPEDEF])
+            return this->getTypeDefByIndex(typeDefIndex + 1)->fieldListIndex;
+
+        return this->m_numRows[TABLE_ID_FIELD] + 1;
+    }
+
+    u32 DLL::getMethodListEnd(u32 typeDefIndex) {
+        if (typeDefIndex < this->m_numRows[TABLE_ID_TYPEDEF])
+            return this->getTypeDefByIndex(typeDefIndex + 1)->methodListIndex;
+
+        return this->m_numRows[TABLE_ID_METHODDEF] + 1;
+    }
+
+    // Returns the MethodDef token of the first method of the type with the given name, or 0 if there is none
+    u32 DLL::findMethodByName(u32 typeDefIndex, const char *name) {
+        for (u32 i = this->getTypeDefByIndex(typeDefIndex)->methodListIndex; i < this->getMethodListEnd(typeDefIndex); i++) {
+            if (std::strcmp(this->getString(this->getMethodDefByIndex(i)->nameIndex), name) == 0)
+                return (TABLE_ID_METHODDEF << 24) | i;
+        }
+
+        return 0;
+    }
+
+    u32 DLL::findMethodBySignature(u32 typeDefIndex, u32 methodToken) {
+        for (u32 i = this->getTypeDefByIndex(typeDefIndex)->methodListIndex; i < this->getMethodListEnd(typeDefIndex); i++) {
+            if (this->hasSameNameAndSignature((TABLE_ID_METHODDEF << 24) | i, methodToken))
+                return (TABLE_ID_METHODDEF << 24) | i;
+        }
+
+        return 0;
     }
 
-    table_class_layout_t* DLL::getClassLayoutOfType(table_type_def_t *typeDef) {
+    // MemberRefs to methods of generic instances of types defined here refer to a MethodDef of the generic type.
+    // All other tokens are returned unchanged
+    u32 DLL::resolveMethodDefinition(u32 methodToken) {
+        if (TABLE_ID(methodToken) != TABLE_ID_MEMBERREF)
+            return methodToken;
+
+        u32 parentToken = this->decodeMemberRefParent(this->getMemberRefByMetadataToken(methodToken)->classIndex);
+        if (TABLE_ID(parentToken) == TABLE_ID_TYPESPEC)
+            parentToken = this->resolveTypeToken(parentToken).typeToken;
+
+        if (TABLE_ID(parentToken) != TABLE_ID_TYPEDEF)
+            return methodToken;
+
+        if (u32 methodDef = this->findMethodBySignature(TABLE_INDEX(parentToken), methodToken); methodDef != 0)
+            return methodDef;
+
+        return methodToken;
+    }
+
+    u32 DLL::findFieldByName(u32 typeDefIndex, const char *name) {
+        for (u32 i = this->getTypeDefByIndex(typeDefIndex)->fieldListIndex; i < this->getFieldListEnd(typeDefIndex); i++) {
+            if (std::strcmp(this->getString(this->getFieldByIndex(i)->nameIndex), name) == 0)
+                return i;
+        }
+
+        return 0;
+    }
+
+    u32 DLL::decodeTypeDefOrRef(u32 codedIndex) {
+        u32 index = INDEX_INDEX(codedIndex, TYPE_DEF_OR_REF);
+
+        switch (INDEX_TAG(codedIndex, TYPE_DEF_OR_REF)) {
+            case 0: return (TABLE_ID_TYPEDEF << 24) | index;
+            case 1: return (TABLE_ID_TYPEREF << 24) | index;
+            case 2: return (TABLE_ID_TYPESPEC << 24) | index;
+            default: return 0;
+        }
+    }
+
+    u32 DLL::decodeMethodDefOrRef(u32 codedIndex) {
+        u32 index = INDEX_INDEX(codedIndex, METHOD_DEF_OR_REF);
+
+        switch (INDEX_TAG(codedIndex, METHOD_DEF_OR_REF)) {
+            case 0: return (TABLE_ID_METHODDEF << 24) | index;
+            case 1: return (TABLE_ID_MEMBERREF << 24) | index;
+            default: return 0;
+        }
+    }
+
+    u32 DLL::decodeMemberRefParent(u32 codedIndex) {
+        u32 index = INDEX_INDEX(codedIndex, MEMBER_REF_PARENT);
+
+        switch (INDEX_TAG(codedIndex, MEMBER_REF_PARENT)) {
+            case 0: return (TABLE_ID_TYPEDEF << 24) | index;
+            case 1: return (TABLE_ID_TYPEREF << 24) | index;
+            case 3: return (TABLE_ID_METHODDEF << 24) | index;
+            case 4: return (TABLE_ID_TYPESPEC << 24) | index;
+            default: return 0;
+        }
+    }
+
+    // Compares name and signature blob of two MethodDefs or MemberRefs. Methods of generic types may only match
+    // once their generic parameters got substituted, so with contexts the decoded signatures are compared instead
+    bool DLL::hasSameNameAndSignature(u32 methodTokenA, u32 methodTokenB, const GenericContext *contextA, const GenericContext *contextB) {
+        auto getNameAndSignature = [this](u32 methodToken, const char *&name, u32 &signatureIndex) {
+            if (TABLE_ID(methodToken) == TABLE_ID_METHODDEF) {
+                auto methodDef = this->getMethodDefByMetadataToken(methodToken);
+                name = this->getString(methodDef->nameIndex);
+                signatureIndex = methodDef->signatureIndex;
+            } else {
+                auto memberRef = this->getMemberRefByMetadataToken(methodToken);
+                name = this->getString(memberRef->nameIndex);
+                signatureIndex = memberRef->signatureIndex;
+            }
+        };
+
+        const char *nameA, *nameB;
+        u32 signatureA, signatureB;
+        getNameAndSignature(methodTokenA, nameA, signatureA);
+        getNameAndSignature(methodTokenB, nameB, signatureB);
+
+        if (std::strcmp(nameA, nameB) != 0)
+            return false;
+
+        if (signatureA == signatureB)
+            return true;
+
+        if (contextA != nullptr || contextB != nullptr) {
+            auto decode = [this](u32 signatureIndex, const GenericContext *context) {
+                auto signature = SignatureReader(this, this->getBlob(signatureIndex)).readMethodSignature();
+                return context != nullptr ? context->substitute(signature) : signature;
+            };
+
+            auto decodedA = decode(signatureA, contextA);
+            auto decodedB = decode(signatureB, contextB);
+
+            return decodedA.hasThis == decodedB.hasThis && decodedA.genericParameterCount == decodedB.genericParameterCount
+                && decodedA.returnType == decodedB.returnType && decodedA.parameters == decodedB.parameters;
+        }
+
+        u32 size = this->getBlobSize(signatureA);
+        return size == this->getBlobSize(signatureB) && std::memcmp(this->getBlob(signatureA), this->getBlob(signatureB), size) == 0;
+    }
+
+    bool DLL::isValueType(u32 typeDefIndex) {
+        u32 baseToken = this->decodeTypeDefOrRef(this->getTypeDefByIndex(typeDefIndex)->extendsIndex);
+
+        // Value types can only derive from System.ValueType or System.Enum which both live in the core library
+        if (TABLE_ID(baseToken) != TABLE_ID_TYPEREF || TABLE_INDEX(baseToken) == 0)
+            return false;
+
+        auto baseType = this->getTypeRefByIndex(TABLE_INDEX(baseToken));
+        std::string nameSpace = this->getString(baseType->typeNamespaceIndex);
+        std::string name = this->getString(baseType->typeNameIndex);
+
+        return nameSpace == "System" && (name == "ValueType" || name == "Enum");
+    }
+
+    bool DLL::isInterface(u32 typeDefIndex) {
+        return (this->getTypeDefByIndex(typeDefIndex)->flags & TYPE_ATTRIBUTE_INTERFACE) != 0;
+    }
+
+    TypeSignature DLL::resolveTypeToken(u32 typeToken) {
+        TypeSignature type;
+        type.typeToken = typeToken;
+
+        switch (TABLE_ID(typeToken)) {
+            case TABLE_ID_TYPEDEF:
+                type.elementType = this->isValueType(TABLE_INDEX(typeToken)) ? SignatureElementType::ValueType : SignatureElementType::Class;
+                break;
+            case TABLE_ID_TYPEREF: {
+                auto typeRef = this->getTypeRefByIndex(TABLE_INDEX(typeToken));
+                std::string nameSpace = this->getString(typeRef->typeNamespaceIndex);
+                std::string name = this->getString(typeRef->typeNameIndex);
+
+                type.elementType = SignatureElementType::Class;
+
+                if (nameSpace != "System")
+                    break;
+
+                // Core library types that have their own signature element type
+                constexpr static std::pair<const char*, SignatureElementType> PrimitiveTypes[] = {
+                    { "Boolean", SignatureElementType::Boolean }, { "Char", SignatureElementType::Char },
+                    { "SByte", SignatureElementType::I1 },        { "Byte", SignatureElementType::U1 },
+                    { "Int16", SignatureElementType::I2 },        { "UInt16", SignatureElementType::U2 },
+                    { "Int32", SignatureElementType::I4 },        { "UInt32", SignatureElementType::U4 },
+                    { "Int64", SignatureElementType::I8 },        { "UInt64", SignatureElementType::U8 },
+                    { "Single", SignatureElementType::R4 },       { "Double", SignatureElementType::R8 },
+                    { "IntPtr", SignatureElementType::I },        { "UIntPtr", SignatureElementType::U },
+                    { "String", SignatureElementType::String },   { "Object", SignatureElementType::Object }
+                };
+
+                for (auto &[primitiveName, elementType] : PrimitiveTypes) {
+                    if (name == primitiveName)
+                        type.elementType = elementType;
+                }
+                break;
+            }
+            case TABLE_ID_TYPESPEC:
+                type = SignatureReader(this, this->getBlob(this->getTypeSpecByIndex(TABLE_INDEX(typeToken))->signatureIndex)).readType();
+                break;
+        }
+
+        return type;
+    }
+
+    // Fields are laid out in declaration order at their natural alignment, capped by the packing size of
+    // the type's ClassLayout row. Explicit layout types take their offsets from the FieldLayout table instead,
+    // auto layout types get their fields reordered by orderAutoLayoutFields.
+    // Static fields are laid out separately in declaration order
+    // Generic types get one layout per instantiation, with the generic parameters of their fields substituted
+    const TypeLayout& DLL::getTypeLayout(u32 typeDefIndex, const std::vector<TypeSignature> &typeArguments) {
+        bool isGeneric = !typeArguments.empty();
+        std::string genericKey;
+
+        if (isGeneric) {
+            genericKey = getTypeKey(TypeSignature { SignatureElementType::GenericInst, (TABLE_ID_TYPEDEF << 24) | typeDefIndex, SignatureElementType::End, typeArguments });
+
+            if (auto cached = this->m_genericTypeLayouts.find(genericKey); cached != this->m_genericTypeLayouts.end())
+                return cached->second;
+        } else if (auto cached = this->m_typeLayouts.find(typeDefIndex); cached != this->m_typeLayouts.end()) {
+            return cached->second;
+        }
+
+        auto typeDef = this->getTypeDefByIndex(typeDefIndex);
+        GenericContext instantiation = { typeArguments, { } };
+
+        TypeLayout layout;
+
+        // Base class fields come first so a derived instance can be used wherever its base class is expected
+        TypeSignature baseType;
+        if (u32 baseToken = this->decodeTypeDefOrRef(typeDef->extendsIndex); TABLE_INDEX(baseToken) != 0)
+            baseType = instantiation.substitute(this->resolveTypeToken(baseToken));
+
+        bool isBaseDefinedHere = (baseType.elementType == SignatureElementType::Class || baseType.elementType == SignatureElementType::GenericInst)
+            && TABLE_ID(baseType.typeToken) == TABLE_ID_TYPEDEF;
+
+        if (isBaseDefinedHere) {
+            auto &baseLayout = this->getTypeLayout(TABLE_INDEX(baseType.typeToken), baseType.typeArguments);
+
+            layout.baseTypeIndex = TABLE_INDEX(baseType.typeToken);
+            layout.size = baseLayout.size;
+            layout.alignment = baseLayout.alignment;
+        }
+
+        auto classLayout = this->getClassLayoutOfType(typeDefIndex);
+        u32 packing = (classLayout != nullptr && classLayout->packingSize != 0) ? classLayout->packingSize : 8;
+        bool explicitLayout = (typeDef->flags & TYPE_ATTRIBUTE_LAYOUT_MASK) == TYPE_ATTRIBUTE_EXPLICIT_LAYOUT;
+        bool autoLayout = (typeDef->flags & TYPE_ATTRIBUTE_LAYOUT_MASK) == TYPE_ATTRIBUTE_AUTO_LAYOUT;
+        u32 baseSize = layout.size;
+
+        // Fields of auto layout types are placed once all of them are known, along with their alignment
+        std::vector<std::pair<FieldLayout, u32>> autoLayoutFields;
+
+        if (this->m_fieldOffsets.empty() && !isGeneric)
+            this->m_fieldOffsets.resize(this->m_numRows[TABLE_ID_FIELD] + 1, UnknownFieldOffset);
+
+        for (u32 i = typeDef->fieldListIndex; i < this->getFieldListEnd(typeDefIndex); i++) {
+            auto field = this->getFieldByIndex(i);
+
+            // Constants are baked into the IL that uses them and need no storage
+            if ((field->flags & FIELD_ATTRIBUTE_LITERAL) != 0)
+                continue;
+
+            TypeSignature type = instantiation.substitute(SignatureReader(this, this->getBlob(field->signatureIndex)).readFieldSignature());
+            u32 size = this->getTypeSize(type);
+            u32 alignment = std::min(this->getTypeAlignment(type), packing);
+
+            if ((field->flags & FIELD_ATTRIBUTE_STATIC) != 0) {
+                u32 offset = (layout.staticSize + alignment - 1) & ~(alignment - 1);
+
+                Logger::debug("  Static field %s [0x%02x] at 0x%02x", this->getString(field->nameIndex), size, offset);
+
+                layout.staticFields.push_back({ i, type, offset, size });
+                layout.staticSize = offset + size;
+
+                if (!isGeneric)
+                    this->m_fieldOffsets[i] = offset;
+                continue;
+            }
+
+            if (autoLayout) {
+                autoLayoutFields.push_back({ { i, type, 0, size }, alignment });
+                continue;
+            }
+
+            u32 offset;
+            if (auto fieldLayout = explicitLayout ? this->getFieldLayoutOfField(i) : nullptr; fieldLayout != nullptr)
+                offset = baseSize + fieldLayout->offset;
+            else
+                offset = (layout.size + alignment - 1) & ~(alignment - 1);
+
+            Logger::debug("  Field %s [0x%02x] at 0x%02x", this->getString(field->nameIndex), size, offset);
+
+            layout.fields.push_back({ i, type, offset, size });
+            layout.size = std::max(layout.size, offset + size);
+            layout.alignment = std::max(layout.alignment, alignment);
+
+            if (!isGeneric)
+                this->m_fieldOffsets[i] = offset;
+        }
+
+        if (autoLayout) {
+            // Boxed and heap allocated instances start with an object header, the fields follow right after it
+            this->orderAutoLayoutFields(autoLayoutFields, baseSize + (this->isValueType(typeDefIndex) ? 0 : ObjectHeaderSize));
+
+            for (auto &[fieldLayout, alignment] : autoLayoutFields) {
+                fieldLayout.offset = (layout.size + alignment - 1) & ~(alignment - 1);
+
+                Logger::debug("  Field %s [0x%02x] at 0x%02x", this->getString(this->getFieldByIndex(fieldLayout.fieldIndex)->nameIndex), fieldLayout.size, fieldLayout.offset);
+
+                layout.size = fieldLayout.offset + fieldLayout.size;
+                layout.alignment = std::max(layout.alignment, alignment);
+
+                if (!isGeneric)
+                    this->m_fieldOffsets[fieldLayout.fieldIndex] = fieldLayout.offset;
+            }
+
+            // Keep the fields in declaration order like every other layout
+            std::sort(autoLayoutFields.begin(), autoLayoutFields.end(), [](auto &a, auto &b) { return a.first.fieldIndex < b.first.fieldIndex; });
+            for (auto &[fieldLayout, alignment] : autoLayoutFields)
+                layout.fields.push_back(std::move(fieldLayout));
+        }
+
+        layout.size = (layout.size + layout.alignment - 1) & ~(layout.alignment - 1);
+
+        if (classLayout != nullptr)
+            layout.size = std::max(layout.size, classLayout->classSize);
+
+        if (isGeneric)
+            return this->m_genericTypeLayouts.emplace(genericKey, std::move(layout)).first->second;
+
+        return this->m_typeLayouts.emplace(typeDefIndex, std::move(layout)).first->second;
+    }
+
+    // Auto layout leaves the field order up to the runtime. Sorting the fields by decreasing alignment leaves no
+    // padding between them. With a field profile loaded, the most accessed fields are moved in front of all others
+    // as long as they fit into the cache line the object header starts, so cold fields don't take up room there
+    void DLL::orderAutoLayoutFields(std::vector<std::pair<FieldLayout, u32>> &fields, u32 startOffset) {
+        auto byAlignment = [](auto &a, auto &b) { return a.second > b.second; };
+        auto accessCount = [this](auto &field) { return field.first.fieldIndex < this->m_fieldAccessCounts.size() ? this->m_fieldAccessCounts[field.first.fieldIndex] : 0; };
+
+        std::stable_sort(fields.begin(), fields.end(), byAlignment);
+
+        if (this->m_fieldAccessCounts.empty())
+            return;
+
+        std::vector<std::pair<FieldLayout, u32>> byAccessCount = fields;
+        std::stable_sort(byAccessCount.begin(), byAccessCount.end(), [&](auto &a, auto &b) { return accessCount(a) > accessCount(b); });
+
+        // Whatever the header and the base class don't take up of the first cache line is left for the hot fields
+        s64 budget = static_cast<s64>(CacheLineSize) - startOffset;
+        std::vector<u32> hotFields;
+        for (auto &field : byAccessCount) {
+            if (accessCount(field) == 0)
+                break;
+            if (budget < static_cast<s64>(field.first.size))
+                continue;
+
+            budget -= field.first.size;
+            hotFields.push_back(field.first.fieldIndex);
+        }
+
+        auto isHot = [&](auto &field) { return std::find(hotFields.begin(), hotFields.end(), field.first.fieldIndex) != hotFields.end(); };
+        std::stable_partition(fields.begin(), fields.end(), isHot);
+    }
+
+    // Field profiles hold the number of times each field was accessed during a profiled run, indexed by field index
+    void DLL::loadFieldProfile(const std::string &filePath) {
+        FILE *profileFile = fopen(filePath.c_str(), "rb");
+
+        if (profileFile == nullptr)
+            return;
+
+        std::vector<u64> accessCounts(this->m_numRows[TABLE_ID_FIELD] + 1);
+        size_t read = fread(accessCounts.data(), sizeof(u64), accessCounts.size(), profileFile);
+        bool isAtEnd = fgetc(profileFile) == EOF;
+        fclose(profileFile);
+
+        if (read != accessCounts.size() || !isAtEnd) {
+            Logger::error("Field profile %s doesn't belong to this assembly, ignoring it", filePath.c_str());
+            return;
+        }
+
+        Logger::info("Laying out auto layout types using field profile %s", filePath.c_str());
+        this->m_fieldAccessCounts = std::move(accessCounts);
+    }
+
+    void DLL::saveFieldProfile(const std::string &filePath, const std::vector<u64> &accessCounts) {
+        if (accessCounts.empty())
+            return;
+
+        FILE *profileFile = fopen(filePath.c_str(), "wb");
+
+        if (profileFile == nullptr) {
+            Logger::error("Cannot write field profile %s!", filePath.c_str());
+            return;
+        }
+
+        fwrite(accessCounts.data(), sizeof(u64), accessCounts.size(), profileFile);
+        fclose(profileFile);
+    }
+
+    u32 DLL::getFieldOffset(u32 fieldIndex) {
+        if (this->m_fieldOffsets.empty() || this->m_fieldOffsets[fieldIndex] == UnknownFieldOffset)
+            this->getTypeLayout(this->findTypeDefWithField(fieldIndex));
+
+        return this->m_fieldOffsets[fieldIndex];
+    }
+
+    // Type a pointer, byref or array refers to
+    TypeSignature DLL::getElementType(const TypeSignature &type) {
+        if (!type.nestedType.empty())
+            return type.nestedType.front();
+
+        TypeSignature element = { type.innerType, type.typeToken, SignatureElementType::End, type.typeArguments };
+
+        if (element.elementType == SignatureElementType::GenericInst) {
+            bool isValueType = TABLE_ID(element.typeToken) == TABLE_ID_TYPEDEF && this->isValueType(TABLE_INDEX(element.typeToken));
+            element.innerType = isValueType ? SignatureElementType::ValueType : SignatureElementType::Class;
+        } else if ((element.elementType == SignatureElementType::Class || element.elementType == SignatureElementType::ValueType) && TABLE_ID(element.typeToken) == TABLE_ID_TYPEREF) {
+            // Core library types like System.Int32 can also be referenced by name
+            element = this->resolveTypeToken(element.typeToken);
+        }
+
+        return element;
+    }
+
+    u32 DLL::getTypeSize(const TypeSignature &type) {
+        if (type.elementType == SignatureElementType::GenericInst) {
+            if (type.innerType != SignatureElementType::ValueType)
+                return 8;
+
+            if (TABLE_ID(type.typeToken) != TABLE_ID_TYPEDEF) {
+                Logger::error("Size of external generic value type %08x is unknown!", type.typeToken);
+                exit(1);
+            }
+
+            return std::max<u32>(1, this->getTypeLayout(TABLE_INDEX(type.typeToken), type.typeArguments).size);
+        }
+
+        if (type.elementType == SignatureElementType::Var || type.elementType == SignatureElementType::MVar) {
+            Logger::error("Size of generic parameter %u is unknown outside of an instantiation!", type.typeToken);
+            exit(1);
+        }
+
+        if (type.elementType != SignatureElementType::ValueType)
+            return getSignatureElementTypeSize(type.elementType);
+
+        if (TABLE_ID(type.typeToken) != TABLE_ID_TYPEDEF) {
+            TypeSignature resolvedType = this->resolveTypeToken(type.typeToken);
+
+            if (resolvedType.elementType == SignatureElementType::ValueType || resolvedType.elementType == SignatureElementType::Class) {
+                Logger::error("Size of external value type %08x is unknown!", type.typeToken);
+                exit(1);
+            }
+
+            return getSignatureElementTypeSize(resolvedType.elementType);
+        }
+
+        // Empty structs still take up one byte so every instance has its own address
+        return std::max<u32>(1, this->getTypeLayout(TABLE_INDEX(type.typeToken)).size);
+    }
+
+    u32 DLL::getTypeAlignment(const TypeSignature &type) {
+        if (type.elementType == SignatureElementType::ValueType && TABLE_ID(type.typeToken) == TABLE_ID_TYPEDEF)
+            return this->getTypeLayout(TABLE_INDEX(type.typeToken)).alignment;
+
+        if (type.getStorageType() == SignatureElementType::ValueType && TABLE_ID(type.typeToken) == TABLE_ID_TYPEDEF)
+            return this->getTypeLayout(TABLE_INDEX(type.typeToken), type.typeArguments).alignment;
+
+        // Primitives are aligned to their own size, everything else is pointer sized
+        return std::clamp<u32>(this->getTypeSize(type), 1, 8);
+    }
+
+    table_class_layout_t* DLL::getClassLayoutOfType(u32 typeDefIndex) {
         for (u32 i = 0; i < this->m_numRows[TABLE_ID_CLASS_LAYOUT]; i++) {
-            table_class_layout_t *currClassLayout = reinterpret_cast<table_class_layout_t*>(this->m_tildeTableData[TABLE_ID_CLASS_LAYOUT][i].base);
+            auto classLayout = reinterpret_cast<table_class_layout_t*>(this->m_tildeTableData[TABLE_ID_CLASS_LAYOUT][i].base);
+
+            if (classLayout->parentIndex == typeDefIndex)
+                return classLayout;
+        }
+
+        return nullptr;
+    }
+
+    table_field_layout_t* DLL::getFieldLayoutOfField(u32 fieldIndex) {
+        for (u32 i = 0; i < this->m_numRows[TABLE_ID_FIELD_LAYOUT]; i++) {
+            auto fieldLayout = reinterpret_cast<table_field_layout_t*>(this->m_tildeTableData[TABLE_ID_FIELD_LAYOUT][i].base);
 
-            if (reinterpret_cast<table_type_def_t*>(this->m_tildeTableData[TABLE_ID_TYPEDEF][currClassLayout->parentIndex].base) == typeDef)
-                return currClassLayout;
+            if (fieldLayout->fieldIndex == fieldIndex)
+                return fieldLayout;
         }
 
         return nullptr;
@@ -0,0 +1,917 @@
+#include "gc.hpp"
+
+#include "context.hpp"
+#include "dll.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace ili {
+
+    // Set in the header word of nursery objects that were copied, the rest of the word is where they went
+    static constexpr u64 ForwardedBit = 2;
+
+    // Storage types of class types, which are stored as a single reference
+    static bool isReferenceType(SignatureElementType storageType) {
+        switch (storageType) {
+            case SignatureElementType::Class: case SignatureElementType::Object: case SignatureElementType::String:
+            case SignatureElementType::SzArray: case SignatureElementType::Array: case SignatureElementType::GenericInst:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Calls visit with every reference slot of the object that lies within [from, to). Only the elements of arrays
+    // overlapping the range are looked at, so scanning a dirty card of a large array stays cheap
+    template<typename Visitor>
+    static void visitReferences(Context &ctx, u8 *object, const u8 *from, const u8 *to, Visitor &&visit) {
+        auto methodTable = reinterpret_cast<ObjectHeader*>(object)->methodTable;
+
+        if (methodTable->rank != 0) {
+            u64 length = reinterpret_cast<ArrayHeader*>(object + ObjectHeaderSize)->length;
+            u64 elementSize = methodTable->elementSize;
+            u8 *elements = object + methodTable->dataOffset;
+
+            if (to <= elements || elementSize == 0)
+                return;
+
+            u64 first = from > elements ? (from - elements) / elementSize : 0;
+            u64 last = std::min<u64>(length, (to - elements + elementSize - 1) / elementSize);
+
+            if (isReferenceType(methodTable->elementStorageType)) {
+                for (u64 i = first; i < last; i++)
+                    visit(reinterpret_cast<u64*>(elements) + i);
+            } else if (methodTable->elementStorageType == SignatureElementType::ValueType) {
+                auto &offsets = methodTable->elementType->getReferenceOffsets(ctx);
+
+                for (u64 i = first; i < last && !offsets.empty(); i++) {
+                    for (u32 offset : offsets) {
+                        u8 *slot = elements + i * elementSize + offset - ObjectHeaderSize;
+
+                        if (slot >= from && slot < to)
+                            visit(reinterpret_cast<u64*>(slot));
+                    }
+                }
+            }
+
+            return;
+        }
+
+        for (u32 offset : methodTable->getReferenceOffsets(ctx)) {
+            u8 *slot = object + offset;
+
+            if (slot >= from && slot < to)
+                visit(reinterpret_cast<u64*>(slot));
+        }
+    }
+
+    GarbageCollector::GarbageCollector(Context &ctx) : m_ctx(ctx) {
+        this->m_markingThreadCount = std::clamp<u32>(std::thread::hardware_concurrency(), 1, MaxMarkingThreads);
+    }
+
+    GarbageCollector::~GarbageCollector() {
+        if (this->m_backgroundThread.joinable())
+            this->m_backgroundThread.join();
+
+        {
+            std::scoped_lock lock(this->m_markingMutex);
+            this->m_stopMarkingWorkers = true;
+        }
+
+        this->m_markingStarted.notify_all();
+
+        for (auto &worker : this->m_markingWorkers)
+            worker.join();
+    }
+
+    void GarbageCollector::setMarkingThreadCount(u32 count) {
+        if (this->m_markingThreads.empty())
+            this->m_markingThreadCount = std::clamp<u32>(count, 1, MaxMarkingThreads);
+    }
+
+    // While a background thread is busy the nursery grows instead, until the thread is done or the nursery can't grow
+    // any further. The request is cleared before checking, a thread finishing right then asks for another safepoint
+    void GarbageCollector::collect() {
+        auto start = std::chrono::steady_clock::now();
+        auto &heap = this->m_ctx.heap;
+
+        bool concurrent = this->m_backgroundPhase != BackgroundPhase::None;
+        bool paused = false;
+        this->m_pauseKind = PauseKind::Minor;
+
+        while (this->m_backgroundPhase != BackgroundPhase::None) {
+            heap.collectionRequested = false;
+
+            bool done = this->m_backgroundDone.load(std::memory_order_acquire);
+            if (!done && heap.deferNurseryCollection())
+                break;
+
+            if (this->m_backgroundPhase == BackgroundPhase::Marking) {
+                if (done && heap.deferNurseryCollection() && continueConcurrentMarking())
+                    break;
+
+                remark();
+                paused = true;
+            } else {
+                finishConcurrentSweep();
+            }
+        }
+
+        if (!concurrent || (this->m_backgroundPhase == BackgroundPhase::None && heap.isNurseryFull())) {
+            this->m_roots.clear();
+            this->m_interiorPointers.clear();
+            this->m_nurseryPointers.clear();
+            this->m_pinnedObjects.clear();
+            this->m_dirtyCards.clear();
+            this->m_promotedSize = 0;
+
+            heap.retireAllocationBuffer(this->m_ctx.allocationBuffer);
+            gatherRoots();
+            collectNursery();
+            paused = true;
+
+            if (heap.fullCollectionRequested) {
+                if (heap.concurrentMarking)
+                    startConcurrentMarking();
+                else
+                    collectOldGeneration();
+            }
+        }
+
+        if (paused) {
+            auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+            this->m_pauseHistograms[static_cast<size_t>(this->m_pauseKind)].record(duration.count());
+        }
+    }
+
+    void GarbageCollector::logPauseHistograms() const {
+        static constexpr const char *Names[] = { "Minor", "Full", "Initial mark", "Remark" };
+
+        for (size_t kind = 0; kind < this->m_pauseHistograms.size(); kind++) {
+            auto &histogram = this->m_pauseHistograms[kind];
+            if (histogram.count == 0)
+                continue;
+
+            Logger::debug("%s pauses: %llu, %.3f ms on average, %.3f ms at most", Names[kind], histogram.count, histogram.totalTime / histogram.count, histogram.maxTime);
+
+            for (u32 i = 0; i < PauseHistogram::BucketCount; i++) {
+                if (histogram.buckets[i] != 0)
+                    Logger::debug("  < %8llu us: %llu", u64(1) << i, histogram.buckets[i]);
+            }
+        }
+    }
+
+    // Bucket n holds pauses shorter than 2^n microseconds that didn't fit into the one before
+    void GarbageCollector::PauseHistogram::record(double milliseconds) {
+        auto microseconds = static_cast<u64>(milliseconds * 1000);
+
+        this->buckets[std::min<u32>(std::bit_width(microseconds), BucketCount - 1)]++;
+        this->count++;
+        this->totalTime += milliseconds;
+        this->maxTime = std::max(this->maxTime, milliseconds);
+    }
+
+    void GarbageCollector::gatherRoots() {
+        auto &ctx = this->m_ctx;
+
+        // Frames own the part of the context stack between their arguments and the arguments of the frame they called.
+        // Whatever lies below the outermost frame was pushed before it started
+        u8 *stackEnd = ctx.stackPointer;
+        Type *typeStackEnd = ctx.typeStackPointer;
+
+        for (Frame *frame = ctx.currentFrame; frame != nullptr; frame = frame->caller) {
+            addFrame(*frame, stackEnd, typeStackEnd);
+
+            stackEnd = frame->arguments;
+            typeStackEnd = frame->typeFrameBase;
+        }
+
+        addEvaluationStack(ctx.stack, ctx.typeStack, stackEnd, typeStackEnd);
+
+        // Static fields
+        for (auto &area : ctx.allocatedStaticAreas) {
+            auto &layout = ctx.dll->getTypeLayout(area.typeDefIndex, area.instantiation != nullptr ? area.instantiation->typeArguments : std::vector<TypeSignature> { });
+
+            for (auto &field : layout.staticFields)
+                addValue(field.type, area.data + field.offset);
+        }
+
+        // Objects the runtime holds on to itself
+        addRoot(&ctx.exception, RootKind::Reference);
+
+        for (u64 &box : ctx.boxedInt32Cache)
+            addRoot(&box, RootKind::Reference);
+        for (u64 &box : ctx.boxedBooleanCache)
+            addRoot(&box, RootKind::Reference);
+
+        for (auto &[key, methodInfo] : ctx.methodInfos)
+            addRoot(&methodInfo, RootKind::Reference);
+        for (auto &[key, exception] : ctx.typeInitializationErrors)
+            addRoot(&exception, RootKind::Reference);
+
+        for (auto &[key, methodTable] : ctx.methodTables)
+            addRoot(&methodTable->runtimeType, RootKind::Reference);
+        for (auto &[key, methodTable] : ctx.arrayMethodTables)
+            addRoot(&methodTable->runtimeType, RootKind::Reference);
+        for (auto &[key, methodTable] : ctx.genericMethodTables)
+            addRoot(&methodTable->runtimeType, RootKind::Reference);
+
+        for (auto &methodTable : { ctx.runtimeTypeTable.get(), ctx.runtimeMethodInfoTable.get() }) {
+            if (methodTable != nullptr)
+                addRoot(&methodTable->runtimeType, RootKind::Reference);
+        }
+    }
+
+    // Pinned locals keep what they point to from moving while native pointers derived from them are in use
+    void GarbageCollector::addFrame(Frame &frame, u8 *stackEnd, Type *typeStackEnd) {
+        for (auto &argument : frame.body->arguments)
+            addValue(argument.type, frame.arguments + argument.offset);
+
+        for (auto &local : frame.body->locals) {
+            if (local.type.isPinned)
+                addRoot(reinterpret_cast<u64*>(frame.locals + local.offset), RootKind::Ambiguous);
+            else
+                addValue(local.type, frame.locals + local.offset);
+        }
+
+        addRoot(&frame.exception, RootKind::Reference);
+        for (u64 &exception : frame.suspendedExceptions)
+            addRoot(&exception, RootKind::Reference);
+
+        addEvaluationStack(frame.stackBase, frame.typeStackBase, stackEnd, typeStackEnd);
+    }
+
+    // Evaluation stack slots only carry their stack type. Value types don't say what they contain, so all of their
+    // slots are ambiguous
+    void GarbageCollector::addEvaluationStack(u8 *stackBase, Type *typeStackBase, u8 *stackEnd, Type *typeStackEnd) {
+        u64 slots = std::min<u64>((stackEnd - stackBase) / Context::StackSlotSize, typeStackEnd - typeStackBase);
+
+        for (u64 i = 0; i < slots; i++) {
+            auto slot = reinterpret_cast<u64*>(stackBase + i * Context::StackSlotSize);
+
+            switch (typeStackBase[i]) {
+                case Type::O:
+                    addRoot(slot, RootKind::Reference);
+                    break;
+                case Type::Pointer:
+                    addRoot(slot, RootKind::Interior);
+                    break;
+                case Type::ValueType:
+                case Type::ValueTypePart:
+                    addRoot(slot, RootKind::Ambiguous);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // Adds the references in a value of the given type stored at address, e.g. an argument, local or static field
+    void GarbageCollector::addValue(const TypeSignature &type, u8 *address) {
+        auto storageType = type.getStorageType();
+
+        switch (storageType) {
+            case SignatureElementType::ValueType:
+                if (type.elementType == SignatureElementType::TypedByRef) {
+                    addRoot(reinterpret_cast<u64*>(&reinterpret_cast<TypedReference*>(address)->address), RootKind::Interior);
+                    break;
+                }
+
+                for (u32 offset : this->m_ctx.getMethodTable(type)->getReferenceOffsets(this->m_ctx))
+                    addRoot(reinterpret_cast<u64*>(address + offset - ObjectHeaderSize), RootKind::Reference);
+                break;
+            case SignatureElementType::ByRef:
+                addRoot(reinterpret_cast<u64*>(address), RootKind::Interior);
+                break;
+            case SignatureElementType::Var:
+            case SignatureElementType::MVar:
+                addRoot(reinterpret_cast<u64*>(address), RootKind::Ambiguous);
+                break;
+            default:
+                if (isReferenceType(storageType))
+                    addRoot(reinterpret_cast<u64*>(address), RootKind::Reference);
+                break;
+        }
+    }
+
+    // Things like user strings are passed around as references too, only references into the heap are objects
+    void GarbageCollector::addRoot(u64 *slot, RootKind kind) {
+        if (this->m_ctx.heap.contains(*slot))
+            this->m_roots.push_back({ slot, kind });
+    }
+
+    // Copies everything reachable from the roots and dirty cards out of the nursery. The copies are scanned in turn,
+    // until every reference to a nursery object points to its copy
+    void GarbageCollector::collectNursery() {
+        auto start = std::chrono::steady_clock::now();
+        auto &heap = this->m_ctx.heap;
+
+        heap.clearNurseryMarks();
+        findNurseryObjects();
+
+        for (auto &pointer : this->m_nurseryPointers) {
+            if (pointer.object != nullptr && pointer.root->kind == RootKind::Ambiguous && heap.mark(pointer.object)) {
+                this->m_pinnedObjects.push_back(pointer.object);
+                this->m_markStack.push_back(pointer.object);
+            }
+        }
+
+        for (auto &root : this->m_roots) {
+            if (root.kind == RootKind::Reference)
+                updateReference(root.slot);
+        }
+
+        for (auto &pointer : this->m_nurseryPointers) {
+            if (pointer.object != nullptr && pointer.root->kind == RootKind::Interior) {
+                u64 object = reinterpret_cast<u64>(pointer.object);
+                *pointer.root->slot = forward(object) + (pointer.address - object);
+            }
+        }
+
+        heap.takeDirtyCards(this->m_dirtyCards);
+        for (u8 *card : this->m_dirtyCards)
+            scanCard(card);
+
+        while (!this->m_markStack.empty()) {
+            u8 *object = this->m_markStack.back();
+            this->m_markStack.pop_back();
+
+            visitReferences(this->m_ctx, object, object, object + getObjectSize(object), [this](u64 *slot) { updateReference(slot); });
+        }
+
+        u8 *top = finishNursery();
+
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        Logger::debug("Collected the nursery in %.3f ms, %llu bytes promoted, %llu bytes pinned", duration.count(), this->m_promotedSize, top - heap.getNurseryStart());
+    }
+
+    // Finds the objects the interior and ambiguous roots into the nursery point into, walking the nursery only once
+    void GarbageCollector::findNurseryObjects() {
+        auto &heap = this->m_ctx.heap;
+
+        for (auto &root : this->m_roots) {
+            if (root.kind != RootKind::Reference && heap.isYoung(*root.slot))
+                this->m_nurseryPointers.push_back({ *root.slot, &root, nullptr });
+        }
+
+        std::sort(this->m_nurseryPointers.begin(), this->m_nurseryPointers.end(), [](const NurseryPointer &a, const NurseryPointer &b) {
+            return a.address < b.address;
+        });
+
+        u8 *block = heap.getNurseryStart();
+        u64 top = reinterpret_cast<u64>(heap.getNurseryTop());
+
+        for (auto &pointer : this->m_nurseryPointers) {
+            if (pointer.address >= top)
+                break;
+
+            for (u8 *blockEnd = block + getBlockSize(block); pointer.address >= reinterpret_cast<u64>(blockEnd); blockEnd = block + getBlockSize(block))
+                block = blockEnd;
+
+            if (!Heap::isFree(block))
+                pointer.object = block;
+        }
+    }
+
+    // Returns where a nursery object lives now, copying it into the old generation if that didn't happen yet.
+    // Pinned objects stay where they are
+    u64 GarbageCollector::forward(u64 reference) {
+        auto object = reinterpret_cast<u8*>(reference);
+        u64 header = *reinterpret_cast<u64*>(object);
+
+        if ((header & ForwardedBit) != 0)
+            return header & ~ForwardedBit;
+
+        if (this->m_ctx.heap.isMarked(object))
+            return reference;
+
+        size_t size = getObjectSize(object);
+        u8 *copy = this->m_ctx.heap.allocateOld(size);
+
+        std::memcpy(copy, object, size);
+        *reinterpret_cast<u64*>(object) = reinterpret_cast<u64>(copy) | ForwardedBit;
+
+        this->m_markStack.push_back(copy);
+        this->m_promotedSize += size;
+
+        return reinterpret_cast<u64>(copy);
+    }
+
+    // References that keep pointing into the nursery, to pinned objects, need their card dirty for the next collection
+    void GarbageCollector::updateReference(u64 *slot) {
+        u64 reference = *slot;
+        if (!this->m_ctx.heap.isYoung(reference))
+            return;
+
+        reference = forward(reference);
+        *slot = reference;
+
+        this->m_ctx.heap.writeBarrier(slot, reference);
+    }
+
+    // Updates the references of every object overlapping the card that lie on the card. The region objects are
+    // being promoted into is zeroed past the last copy, the walk continues behind it since the region may be a free
+    // chunk that ends in the middle of the card
+    void GarbageCollector::scanCard(u8 *card) {
+        auto &heap = this->m_ctx.heap;
+        u8 *cardEnd = card + Heap::CardSize;
+
+        for (u8 *block = heap.findBlockBefore(card); block < cardEnd; ) {
+            if (block == heap.getRegionTop() && block != heap.getRegionLimit()) {
+                block = heap.getRegionLimit();
+                continue;
+            }
+
+            size_t size = getBlockSize(block);
+
+            if (!Heap::isFree(block) && block + size > card)
+                visitReferences(this->m_ctx, block, card, cardEnd, [this](u64 *slot) { updateReference(slot); });
+
+            block += size;
+        }
+    }
+
+    // Pinned objects stay where they are with free blocks between them, allocation continues after the last one.
+    // Returns where that is
+    u8* GarbageCollector::finishNursery() {
+        auto &heap = this->m_ctx.heap;
+        std::sort(this->m_pinnedObjects.begin(), this->m_pinnedObjects.end());
+
+        u8 *top = heap.getNurseryStart();
+        for (u8 *object : this->m_pinnedObjects) {
+            if (object != top)
+                Heap::formatFree(top, object - top);
+
+            top = object + getObjectSize(object);
+        }
+
+        heap.resetNursery(top);
+
+        return top;
+    }
+
+    void GarbageCollector::collectOldGeneration() {
+        auto start = std::chrono::steady_clock::now();
+        auto &heap = this->m_ctx.heap;
+        this->m_pauseKind = PauseKind::Full;
+
+        heap.retireRegion();
+        heap.clearMarks();
+        markRoots();
+
+        u32 threads = markInParallel();
+
+        std::vector<Heap::FreeChunk> chunks;
+        size_t liveSize = sweep(heap.getSegments(), chunks);
+        heap.setFreeChunks(std::move(chunks), liveSize);
+
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        Logger::debug("Collected garbage in %.3f ms on %u threads, %llu of %llu bytes live", duration.count(), threads, liveSize, heap.getCommittedSize());
+    }
+
+    // Runs right after a minor collection, with the roots it gathered
+    void GarbageCollector::markRoots() {
+        auto &heap = this->m_ctx.heap;
+
+        for (auto &root : this->m_roots) {
+            if (root.kind == RootKind::Reference)
+                markReference(*root.slot);
+            else if (heap.contains(*root.slot))
+                this->m_interiorPointers.push_back(*root.slot);
+        }
+
+        // Objects that stayed in the nursery were pinned by the minor collection that just ran. They live until a
+        // later one finds them unreachable
+        for (u8 *block = heap.getNurseryStart(); block < heap.getNurseryTop(); block += getBlockSize(block)) {
+            if (!Heap::isFree(block))
+                markReference(reinterpret_cast<u64>(block));
+        }
+
+        markInteriorPointers();
+    }
+
+    void GarbageCollector::markReference(u64 reference) {
+        if (!this->m_ctx.heap.contains(reference))
+            return;
+
+        auto object = reinterpret_cast<u8*>(reference);
+        if (this->m_ctx.heap.mark(object))
+            this->m_markStack.push_back(object);
+    }
+
+    // Reference maps are built the first time they're needed, which can't happen while several threads use them
+    void GarbageCollector::prepareReferenceMaps() {
+        auto &ctx = this->m_ctx;
+        std::vector<MethodTable*> methodTables;
+
+        for (auto &[key, methodTable] : ctx.methodTables)
+            methodTables.push_back(methodTable.get());
+        for (auto &[key, methodTable] : ctx.arrayMethodTables)
+            methodTables.push_back(methodTable.get());
+        for (auto &[key, methodTable] : ctx.genericMethodTables)
+            methodTables.push_back(methodTable.get());
+
+        for (auto &methodTable : { ctx.runtimeTypeTable.get(), ctx.runtimeMethodInfoTable.get() }) {
+            if (methodTable != nullptr)
+                methodTables.push_back(methodTable);
+        }
+
+        // Building a map may create MethodTables for the value types it contains, those get their maps built as well
+        for (auto methodTable : methodTables) {
+            methodTable->getReferenceOffsets(ctx);
+
+            if (methodTable->rank != 0 && methodTable->elementType != nullptr)
+                methodTable->elementType->getReferenceOffsets(ctx);
+        }
+    }
+
+    void GarbageCollector::startMarkingWorkers() {
+        for (u32 i = 0; i < this->m_markingThreadCount; i++)
+            this->m_markingThreads.push_back(std::make_unique<MarkingThread>());
+
+        for (u32 i = 1; i < this->m_markingThreadCount; i++)
+            this->m_markingWorkers.emplace_back([this, i] { runMarkingWorker(i); });
+    }
+
+    // Sleeps until markInParallel starts a cycle this worker is needed for, or the collector goes away
+    void GarbageCollector::runMarkingWorker(u32 index) {
+        // Workers are started before the first cycle, which might begin before this one gets to run
+        std::unique_lock lock(this->m_markingMutex);
+        u64 cycle = 0;
+
+        while (true) {
+            this->m_markingStarted.wait(lock, [this, cycle] { return this->m_stopMarkingWorkers || this->m_markingCycle != cycle; });
+
+            if (this->m_stopMarkingWorkers)
+                return;
+
+            cycle = this->m_markingCycle;
+            if (index >= this->m_activeMarkingThreads)
+                continue;
+
+            lock.unlock();
+            drainGreyObjects(index);
+            lock.lock();
+
+            if (--this->m_busyMarkingWorkers == 0)
+                this->m_markingFinished.notify_one();
+        }
+    }
+
+    // Spreads the objects the roots reached over the marking threads and traces until no grey objects are left. The
+    // calling thread is the first marking thread. Returns how many took part
+    u32 GarbageCollector::markInParallel() {
+        prepareReferenceMaps();
+
+        if (this->m_markingThreads.empty())
+            startMarkingWorkers();
+
+        u32 count = std::min<u64>(this->m_markingThreads.size(), std::max<u64>(1, this->m_markStack.size()));
+        this->m_idleMarkingThreads.store(0);
+
+        for (size_t i = 0; i < this->m_markStack.size(); i++)
+            this->m_markingThreads[i % count]->greyObjects.push(this->m_markStack[i]);
+        this->m_markStack.clear();
+
+        {
+            std::scoped_lock lock(this->m_markingMutex);
+            this->m_activeMarkingThreads = count;
+            this->m_busyMarkingWorkers = count - 1;
+
+            if (count > 1)
+                this->m_markingCycle++;
+        }
+
+        if (count > 1)
+            this->m_markingStarted.notify_all();
+
+        drainGreyObjects(0);
+
+        if (count > 1) {
+            std::unique_lock lock(this->m_markingMutex);
+            this->m_markingFinished.wait(lock, [this] { return this->m_busyMarkingWorkers == 0; });
+        }
+
+        return count;
+    }
+
+    // Marking is done once every thread ran out of grey objects at the same time. Threads that still find some in
+    // another thread's deque while waiting for that go back to stealing
+    void GarbageCollector::drainGreyObjects(u32 index) {
+        auto &thread = *this->m_markingThreads[index];
+        u32 count = this->m_activeMarkingThreads;
+
+        while (true) {
+            u8 *object;
+
+            while (thread.greyObjects.pop(object))
+                traceObject(thread, object);
+
+            if (stealGreyObject(index, object)) {
+                traceObject(thread, object);
+                continue;
+            }
+
+            this->m_idleMarkingThreads.fetch_add(1);
+
+            while (true) {
+                if (this->m_idleMarkingThreads.load() == count)
+                    return;
+
+                bool found = false;
+                for (u32 i = 0; i < count; i++)
+                    found |= !this->m_markingThreads[i]->greyObjects.empty();
+
+                if (found) {
+                    this->m_idleMarkingThreads.fetch_sub(1);
+                    break;
+                }
+
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Victims are tried round robin, starting with the next thread
+    bool GarbageCollector::stealGreyObject(u32 index, u8 *&object) {
+        u32 count = this->m_activeMarkingThreads;
+
+        for (u32 i = 1; i < count; i++) {
+            if (this->m_markingThreads[(index + i) % count]->greyObjects.steal(object))
+                return true;
+        }
+
+        return false;
+    }
+
+    // Children are prefetched as they're pushed, by the time they are popped their headers are usually in the cache
+    void GarbageCollector::traceObject(MarkingThread &thread, u8 *object) {
+        auto &heap = this->m_ctx.heap;
+
+        visitReferences(this->m_ctx, object, object, object + getObjectSize(object), [&heap, &thread](u64 *slot) {
+            u64 reference = *slot;
+
+            if (heap.contains(reference) && heap.mark(reinterpret_cast<u8*>(reference))) {
+                __builtin_prefetch(reinterpret_cast<u8*>(reference));
+                thread.greyObjects.push(reinterpret_cast<u8*>(reference));
+            }
+        });
+    }
+
+    // Walks every segment some of the pointers point into once, in address order, and marks the objects containing
+    // them. Pointers into the nursery are skipped, everything there is marked anyway
+    void GarbageCollector::markInteriorPointers() {
+        auto &pointers = this->m_interiorPointers;
+        std::sort(pointers.begin(), pointers.end());
+
+        size_t next = 0;
+        while (next < pointers.size()) {
+            auto segment = this->m_ctx.heap.findSegment(pointers[next]);
+            if (segment == nullptr) {
+                next++;
+                continue;
+            }
+
+            for (u8 *block = segment->start; block < segment->end && next < pointers.size(); ) {
+                u8 *blockEnd = block + getBlockSize(block);
+
+                for (; next < pointers.size() && pointers[next] < reinterpret_cast<u64>(blockEnd); next++) {
+                    if (!Heap::isFree(block))
+                        markReference(reinterpret_cast<u64>(block));
+                }
+
+                block = blockEnd;
+            }
+        }
+    }
+
+    // Merges every run of dead objects and free blocks into a single free block and records where the remaining
+    // blocks start. Free blocks large enough to allocate from are added to chunks. Returns the number of bytes still live
+    size_t GarbageCollector::sweep(const std::vector<Heap::Segment> &segments, std::vector<Heap::FreeChunk> &chunks) {
+        auto &heap = this->m_ctx.heap;
+        size_t liveSize = 0;
+
+        auto addFreeChunk = [&heap, &chunks](u8 *start, u8 *end) {
+            Heap::formatFree(start, end - start);
+            heap.recordBlock(start);
+
+            if (static_cast<size_t>(end - start) >= Heap::MinFreeChunkSize)
+                chunks.push_back({ start, static_cast<size_t>(end - start) });
+        };
+
+        for (auto &segment : segments) {
+            u8 *freeStart = nullptr;
+            heap.clearBlocks(segment);
+
+            for (u8 *block = segment.start; block < segment.end; ) {
+                size_t size = getBlockSize(block);
+
+                if (!Heap::isFree(block) && heap.isMarked(block)) {
+                    liveSize += size;
+                    heap.recordBlock(block);
+
+                    if (freeStart != nullptr) {
+                        addFreeChunk(freeStart, block);
+                        freeStart = nullptr;
+                    }
+                } else if (freeStart == nullptr) {
+                    freeStart = block;
+                }
+
+                block += size;
+            }
+
+            if (freeStart != nullptr)
+                addFreeChunk(freeStart, segment.end);
+        }
+
+        return liveSize;
+    }
+
+    // Marks the roots and the nursery, which only holds objects that had to stay by now, with the program paused and
+    // leaves the rest of the old generation to the marker
+    void GarbageCollector::startConcurrentMarking() {
+        auto &heap = this->m_ctx.heap;
+        this->m_pauseKind = PauseKind::InitialMark;
+
+        heap.retireRegion();
+        heap.clearMarks();
+        markRoots();
+        prepareReferenceMaps();
+
+        // The marker only follows references into the old generation, nursery objects are traced right away
+        for (size_t i = 0; i < this->m_markStack.size(); i++) {
+            u8 *object = this->m_markStack[i];
+
+            if (heap.isYoung(reinterpret_cast<u64>(object)))
+                visitReferences(this->m_ctx, object, object, object + getObjectSize(object), [this](u64 *slot) { markReference(*slot); });
+        }
+
+        std::erase_if(this->m_markStack, [&heap](u8 *object) { return heap.isYoung(reinterpret_cast<u64>(object)); });
+
+        heap.startMarking();
+        this->m_snapshotEnd = heap.getOldEnd();
+        this->m_concurrentMarkingRounds = 1;
+
+        this->m_backgroundPhase = BackgroundPhase::Marking;
+        this->m_backgroundDone.store(false, std::memory_order_relaxed);
+        this->m_backgroundThread = std::thread([this] { markConcurrently(); });
+    }
+
+    // Called at a safepoint once the marker ran out of work. Hands it what the program overwrote since it last took
+    // the barrier's log and lets it go on in the background, instead of marking all of it in the remark pause. An
+    // overwritten reference can be all that still leads to a large structure, the program may have moved the only
+    // other path to it into the nursery, which the marker never looks at. Returns false once nothing was overwritten
+    // or the marker had its rounds
+    bool GarbageCollector::continueConcurrentMarking() {
+        if (this->m_concurrentMarkingRounds == MaxConcurrentMarkingRounds || !this->m_ctx.heap.publishOverwrittenLog())
+            return false;
+
+        this->m_backgroundThread.join();
+        this->m_concurrentMarkingRounds++;
+
+        this->m_backgroundDone.store(false, std::memory_order_relaxed);
+        this->m_backgroundThread = std::thread([this] { markConcurrently(); });
+
+        return true;
+    }
+
+    // Runs on the background thread, slots are read while the program may be storing to them. Whatever it overwrote
+    // before the marker got there was logged by the barrier. Filled logs are taken over whenever the marker runs out
+    // of grey objects
+    void GarbageCollector::markConcurrently() {
+        auto start = std::chrono::steady_clock::now();
+        auto &heap = this->m_ctx.heap;
+        auto &greyObjects = this->m_markStack;
+
+        auto shade = [&heap, &greyObjects](u64 reference) {
+            if (heap.isOldReference(reference) && heap.mark(reinterpret_cast<u8*>(reference))) {
+                __builtin_prefetch(reinterpret_cast<u8*>(reference));
+                greyObjects.push_back(reinterpret_cast<u8*>(reference));
+            }
+        };
+
+        std::vector<Heap::OverwrittenLog> logs;
+        size_t loggedCount = 0;
+
+        do {
+            for (auto &log : logs) {
+                for (u64 reference : log.references)
+                    shade(reference);
+
+                for (u64 value : log.values) {
+                    if (u8 *object = findOldObject(value); object != nullptr)
+                        shade(reinterpret_cast<u64>(object));
+                }
+
+                loggedCount += log.references.size() + log.values.size();
+            }
+
+            while (!greyObjects.empty()) {
+                u8 *object = greyObjects.back();
+                greyObjects.pop_back();
+
+                visitReferences(this->m_ctx, object, object, object + getObjectSize(object), [&shade](u64 *slot) {
+                    shade(std::atomic_ref<u64>(*slot).load(std::memory_order_relaxed));
+                });
+            }
+        } while (heap.takeOverwrittenLogs(logs));
+
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        Logger::debug("Marked the old generation in the background in %.3f ms, round %u, %llu logged entries", duration.count(), this->m_concurrentMarkingRounds, loggedCount);
+
+        this->m_backgroundDone.store(true, std::memory_order_release);
+        heap.collectionRequested = true;
+    }
+
+    // Waits for the marker, then marks what the barrier logged since the marker last took its log and everything it
+    // reaches. The roots don't need another look, whatever they reach now was either reachable when marking started
+    // or allocated since. Objects allocated in the old generation since were marked right away, the nursery isn't
+    // swept. The old generation is handed to the sweeper after that, segments added from then on only hold objects
+    // allocated since and are left alone
+    void GarbageCollector::remark() {
+        auto &heap = this->m_ctx.heap;
+        this->m_pauseKind = PauseKind::Remark;
+
+        this->m_backgroundThread.join();
+
+        heap.retireRegion();
+        heap.finishMarking(this->m_overwrittenLog);
+
+        for (u64 reference : this->m_overwrittenLog.references)
+            markReference(reference);
+
+        for (u64 value : this->m_overwrittenLog.values) {
+            if (u8 *object = findOldObject(value); object != nullptr)
+                markReference(reinterpret_cast<u64>(object));
+        }
+
+        u32 threads = markInParallel();
+        Logger::debug("Remarked %llu overwritten references and %llu overwritten values on %u threads", this->m_overwrittenLog.references.size(), this->m_overwrittenLog.values.size(), threads);
+
+        this->m_sweptSegments = heap.getSegments();
+
+        this->m_backgroundPhase = BackgroundPhase::Sweeping;
+        this->m_backgroundDone.store(false, std::memory_order_relaxed);
+        this->m_backgroundThread = std::thread([this] { sweepConcurrently(); });
+    }
+
+    // Runs on the background thread. Nothing is allocated in the segments being swept until it's done, and the
+    // program never touches the dead objects in them
+    void GarbageCollector::sweepConcurrently() {
+        auto start = std::chrono::steady_clock::now();
+
+        this->m_liveSize = sweep(this->m_sweptSegments, this->m_freeChunks);
+
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        Logger::debug("Swept the old generation in the background in %.3f ms, %llu bytes live", duration.count(), this->m_liveSize);
+
+        this->m_backgroundDone.store(true, std::memory_order_release);
+        this->m_ctx.heap.collectionRequested = true;
+    }
+
+    void GarbageCollector::finishConcurrentSweep() {
+        this->m_backgroundThread.join();
+        this->m_backgroundPhase = BackgroundPhase::None;
+
+        this->m_ctx.heap.setFreeChunks(std::move(this->m_freeChunks), this->m_liveSize);
+        this->m_freeChunks.clear();
+    }
+
+    // Returns the object of the old generation address points into, if there is one and it was there when marking
+    // started. Walking the blocks from the first one starting before it only takes about a card. The program doesn't
+    // allocate in that part of the old generation while marking, so the marker can walk it too
+    u8* GarbageCollector::findOldObject(u64 address) {
+        auto &heap = this->m_ctx.heap;
+
+        if (!heap.isOldReference(address) || address >= reinterpret_cast<u64>(this->m_snapshotEnd))
+            return nullptr;
+
+        u8 *block = heap.findBlockBefore(reinterpret_cast<u8*>(address));
+        while (reinterpret_cast<u64>(block + getBlockSize(block)) <= address)
+            block += getBlockSize(block);
+
+        return Heap::isFree(block) ? nullptr : block;
+    }
+
+    // Arrays are followed by their elements, all other objects have a fixed size
+    size_t GarbageCollector::getObjectSize(const u8 *object) {
+        auto methodTable = reinterpret_cast<const ObjectHeader*>(object)->methodTable;
+        size_t size = methodTable->instanceSize;
+
+        if (methodTable->rank != 0)
+            size = methodTable->dataOffset + reinterpret_cast<const ArrayHeader*>(object + ObjectHeaderSize)->length * methodTable->elementSize;
+
+        return (size + Heap::ObjectAlignment - 1) & ~(Heap::ObjectAlignment - 1);
+    }
+
+    size_t GarbageCollector::getBlockSize(const u8 *block) {
+        return Heap::isFree(block) ? Heap::getFreeSize(block) : getObjectSize(block);
+    }
+
+}
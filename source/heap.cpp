@@ -0,0 +1,314 @@
+#include "heap.hpp"
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace ili {
+
+    static constexpr size_t MarkBitsSize = Heap::ReservedSize / Heap::ObjectAlignment / 8;
+
+    // Pages of the side tables only take up memory once they're touched, they start out zeroed
+    static void* reserve(size_t size, int protection) {
+        void *memory = mmap(nullptr, size, protection, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (memory == MAP_FAILED) {
+            Logger::error("Failed to reserve %llu bytes for the managed heap!", size);
+            exit(1);
+        }
+
+        return memory;
+    }
+
+    Heap::Heap() {
+        this->m_base = static_cast<u8*>(reserve(ReservedSize, PROT_NONE));
+        this->m_oldBase = this->m_base + NurseryReservedSize;
+
+        this->m_markBits = static_cast<u64*>(reserve(MarkBitsSize, PROT_READ | PROT_WRITE));
+        this->m_cards = static_cast<u8*>(reserve(OldReservedSize >> CardShift, PROT_READ | PROT_WRITE));
+        this->m_firstBlocks = static_cast<u16*>(reserve((OldReservedSize >> CardShift) * sizeof(u16), PROT_READ | PROT_WRITE));
+
+        if (mprotect(this->m_base, NurseryReservedSize, PROT_READ | PROT_WRITE) != 0) {
+            Logger::error("Failed to commit %llu bytes for the nursery!", NurseryReservedSize);
+            exit(1);
+        }
+
+        this->m_nurseryTop = this->m_base;
+        this->m_nurseryEnd = this->m_base + NurserySize;
+    }
+
+    Heap::~Heap() {
+        munmap(this->m_firstBlocks, (OldReservedSize >> CardShift) * sizeof(u16));
+        munmap(this->m_cards, OldReservedSize >> CardShift);
+        munmap(this->m_markBits, MarkBitsSize);
+        munmap(this->m_base, ReservedSize);
+    }
+
+    void Heap::clearMarks() {
+        std::fill_n(this->m_markBits, (NurseryReservedSize + this->m_committedSize) / ObjectAlignment / 64, 0);
+    }
+
+    void Heap::clearNurseryMarks() {
+        u64 words = (getMarkBit(getNurseryTop()) + 63) / 64;
+
+        std::fill_n(this->m_markBits, words, 0);
+    }
+
+    // Everything past top is garbage now, below it are the objects that had to stay and free blocks between them
+    void Heap::resetNursery(u8 *top) {
+        this->m_nurseryTop = top;
+        this->m_nurseryEnd = top + NurserySize;
+
+        this->collectionRequested = this->fullCollectionRequested;
+    }
+
+    // Only ever grows to half of the nursery's address range, the rest is left for objects that stay in the nursery
+    bool Heap::deferNurseryCollection() {
+        if (!isNurseryFull())
+            return true;
+
+        if (this->m_nurseryEnd + NurserySize > this->m_base + NurseryReservedSize / 2)
+            return false;
+
+        this->m_nurseryEnd += NurserySize;
+
+        return true;
+    }
+
+    void Heap::startMarking() {
+        this->m_freeChunks.clear();
+        this->m_marking = true;
+        this->collectionRequested = this->fullCollectionRequested = false;
+    }
+
+    void Heap::finishMarking(OverwrittenLog &log) {
+        this->m_marking = false;
+
+        log = std::move(this->m_overwrittenLog);
+        this->m_overwrittenLog = { };
+
+        std::scoped_lock lock(this->m_overwrittenLogsMutex);
+
+        for (auto &handedOver : this->m_overwrittenLogs) {
+            log.references.insert(log.references.end(), handedOver.references.begin(), handedOver.references.end());
+            log.values.insert(log.values.end(), handedOver.values.begin(), handedOver.values.end());
+        }
+
+        this->m_overwrittenLogs.clear();
+    }
+
+    bool Heap::takeOverwrittenLogs(std::vector<OverwrittenLog> &logs) {
+        std::scoped_lock lock(this->m_overwrittenLogsMutex);
+
+        logs.swap(this->m_overwrittenLogs);
+        this->m_overwrittenLogs.clear();
+
+        return !logs.empty();
+    }
+
+    bool Heap::publishOverwrittenLog() {
+        if (this->m_overwrittenLog.references.empty() && this->m_overwrittenLog.values.empty())
+            return false;
+
+        handOverOverwrittenLog();
+
+        return true;
+    }
+
+    void Heap::handOverOverwrittenLog() {
+        std::scoped_lock lock(this->m_overwrittenLogsMutex);
+
+        this->m_overwrittenLogs.push_back(std::move(this->m_overwrittenLog));
+        this->m_overwrittenLog = { };
+    }
+
+    // Objects marked already don't need to be logged, that's most of them once marking got going
+    void Heap::logOverwrittenReference(u64 reference) {
+        if (isOldReference(reference) && !isMarked(reinterpret_cast<u8*>(reference))) {
+            this->m_overwrittenLog.references.push_back(reference);
+
+            if (this->m_overwrittenLog.references.size() == OverwrittenLogSize)
+                handOverOverwrittenLog();
+        }
+    }
+
+    void Heap::logOverwrittenValues(const u8 *start, size_t size) {
+        for (size_t offset = 0; offset + sizeof(u64) <= size; offset += sizeof(u64)) {
+            u64 value;
+            std::memcpy(&value, start + offset, sizeof(u64));
+
+            if (isOld(reinterpret_cast<u8*>(value)))
+                this->m_overwrittenLog.values.push_back(value);
+        }
+
+        if (this->m_overwrittenLog.values.size() >= OverwrittenLogSize)
+            handOverOverwrittenLog();
+    }
+
+    void Heap::retireRegion() {
+        if (this->m_oldTop != this->m_oldLimit) {
+            formatFree(this->m_oldTop, this->m_oldLimit - this->m_oldTop);
+            recordBlock(this->m_oldTop);
+        }
+
+        this->m_oldTop = this->m_oldLimit = nullptr;
+    }
+
+    const Heap::Segment* Heap::findSegment(u64 address) const {
+        auto segment = std::upper_bound(this->m_segments.begin(), this->m_segments.end(), address, [](u64 address, const Segment &segment) {
+            return address < reinterpret_cast<u64>(segment.start);
+        });
+
+        if (segment == this->m_segments.begin() || address >= reinterpret_cast<u64>((segment - 1)->end))
+            return nullptr;
+
+        return &*(segment - 1);
+    }
+
+    // Every segment starts with a block, so going back card by card always ends at one
+    u8* Heap::findBlockBefore(const u8 *address) const {
+        u64 offset = static_cast<u64>(address - this->m_oldBase);
+        u64 card = offset >> CardShift;
+
+        if (this->m_firstBlocks[card] > (offset & (CardSize - 1))) {
+            do {
+                card--;
+            } while (this->m_firstBlocks[card] == NoBlock);
+        }
+
+        return this->m_oldBase + (card << CardShift) + this->m_firstBlocks[card];
+    }
+
+    void Heap::clearBlocks(const Segment &segment) {
+        u64 first = static_cast<u64>(segment.start - this->m_oldBase) >> CardShift;
+        u64 last = static_cast<u64>(segment.end - this->m_oldBase) >> CardShift;
+
+        std::fill(this->m_firstBlocks + first, this->m_firstBlocks + last, NoBlock);
+    }
+
+    // Cards are mostly clean, so they are checked eight at a time
+    void Heap::takeDirtyCards(std::vector<u8*> &cards) {
+        u8 *card = this->m_cards;
+        size_t count = this->m_committedSize >> CardShift;
+
+        for (size_t i = 0; i < count; i += sizeof(u64)) {
+            u64 word;
+            std::memcpy(&word, card + i, sizeof(u64));
+
+            if (word == 0)
+                continue;
+
+            for (size_t j = i; j < i + sizeof(u64); j++) {
+                if (card[j] != 0)
+                    cards.push_back(this->m_oldBase + (j << CardShift));
+            }
+
+            std::memset(card + i, 0x00, sizeof(u64));
+        }
+    }
+
+    void Heap::markCards(const u8 *start, size_t size) {
+        u64 first = static_cast<u64>(start - this->m_oldBase) >> CardShift;
+        u64 last = static_cast<u64>(start + size - 1 - this->m_oldBase) >> CardShift;
+
+        std::fill(this->m_cards + first, this->m_cards + last + 1, 1);
+    }
+
+    void Heap::setFreeChunks(std::vector<FreeChunk> chunks, size_t liveSize) {
+        std::sort(chunks.begin(), chunks.end(), [](const FreeChunk &a, const FreeChunk &b) { return a.size < b.size; });
+
+        this->m_freeChunks = std::move(chunks);
+        this->m_allocatedSinceCollection = 0;
+        this->m_collectionThreshold = std::max(MinCollectionThreshold, liveSize);
+        this->collectionRequested = this->fullCollectionRequested = false;
+    }
+
+    void Heap::retireAllocationBuffer(AllocationBuffer &buffer) {
+        if (buffer.top != buffer.limit)
+            formatFree(buffer.top, buffer.limit - buffer.top);
+
+        buffer.top = buffer.limit = nullptr;
+    }
+
+    // Objects that would take up a good part of a fresh buffer get claimed on their own instead, the buffer they
+    // didn't fit into stays in use
+    u8* Heap::allocateSlow(AllocationBuffer &buffer, size_t size) {
+        if (size >= AllocationBufferSize / 4)
+            return claimNursery(size);
+
+        retireAllocationBuffer(buffer);
+
+        u8 *memory = claimNursery(AllocationBufferSize);
+        buffer.top = memory + size;
+        buffer.limit = memory + AllocationBufferSize;
+
+        return memory;
+    }
+
+    // Once the nursery is full it keeps growing until the interpreter reaches its next safepoint and collects it
+    u8* Heap::claimNursery(size_t size) {
+        u8 *memory = this->m_nurseryTop.fetch_add(size, std::memory_order_relaxed);
+
+        if (memory + size > this->m_base + NurseryReservedSize) {
+            Logger::error("Out of memory, the nursery cannot grow beyond %llu bytes!", NurseryReservedSize);
+            exit(1);
+        }
+
+        if (memory + size > this->m_nurseryEnd)
+            this->collectionRequested = true;
+
+        std::memset(memory, 0x00, size);
+
+        return memory;
+    }
+
+    // The current region is used up. The next one is the largest free chunk if the object fits, a new segment otherwise
+    u8* Heap::allocateOldSlow(size_t size) {
+        retireRegion();
+
+        if (!this->m_freeChunks.empty() && this->m_freeChunks.back().size >= size) {
+            auto chunk = this->m_freeChunks.back();
+            this->m_freeChunks.pop_back();
+
+            std::memset(chunk.start, 0x00, chunk.size);
+            startRegion(chunk.start, chunk.start + chunk.size);
+        } else {
+            addSegments((size + SegmentSize - 1) / SegmentSize);
+        }
+
+        u8 *memory = this->m_oldTop;
+        this->m_oldTop = memory + size;
+
+        return memory;
+    }
+
+    void Heap::startRegion(u8 *start, u8 *end) {
+        this->m_oldTop = start;
+        this->m_oldLimit = end;
+
+        this->m_allocatedSinceCollection += end - start;
+        if (this->m_allocatedSinceCollection >= this->m_collectionThreshold)
+            this->collectionRequested = this->fullCollectionRequested = true;
+    }
+
+    void Heap::addSegments(size_t count) {
+        size_t size = count * SegmentSize;
+        u8 *start = this->m_oldBase + this->m_committedSize;
+
+        if (NurseryReservedSize + this->m_committedSize + size > ReservedSize || mprotect(start, size, PROT_READ | PROT_WRITE) != 0) {
+            Logger::error("Out of memory, the managed heap cannot grow beyond %llu bytes!", this->m_committedSize);
+            exit(1);
+        }
+
+        this->m_committedSize += size;
+        this->m_segments.push_back({ start, start + size });
+        clearBlocks(this->m_segments.back());
+
+        startRegion(start, start + size);
+
+        Logger::debug("Old generation grew to %llu bytes", this->m_committedSize);
+    }
+
+}
@@ -3,13 +3,38 @@
 #include "native.hpp"
 #include "method.hpp"
 
-static void loadExecutable(std::string path) {
+#include <cstdlib>
+#include <cstring>
+
+struct Options {
+    std::string path = "Test2.exe";
+
+    // Count instance field accesses and write them to <path>.fieldprofile, which later runs lay out fields by
+    bool profileFields = false;
+
+    // Threads full collections mark on, 0 for one per core
+    u32 markingThreads = 0;
+
+    // Mark the old generation in the background, see Heap::concurrentMarking
+    bool concurrentMarking = false;
+};
+
+static void loadExecutable(const Options &options) {
     static ili::Context context;
 
+    auto &path = options.path;
+    context.fieldProfiling = options.profileFields;
+
+    context.heap.concurrentMarking = options.concurrentMarking;
+
+    if (options.markingThreads != 0)
+        context.gc.setMarkingThreadCount(options.markingThreads);
+
     context.dll = new ili::DLL(path);
     context.dll->validate();
+    context.dll->loadFieldProfile(path + ".fieldprofile");
 
-    context.heap = new u8[0x0010'0000];
+    context.initBoxCache();
 
     context.stack = new u8[context.dll->getStackSize()];
     context.typeStack = new Type[context.dll->getStackSize()];
@@ -24,10 +49,22 @@ static void loadExecutable(std::string path) {
 
     // Execute Main
     {
+        // Main(string[] args) gets a null array until strings and arrays are managed objects
+        for (u32 i = 0; i < context.getMethodBody(context.dll->getEntryMethodToken()).signature.parameters.size(); i++)
+            context.push<u64>(Type::O, 0);
+
         auto entryPoint = std::make_unique<ili::Method>(context, context.dll->getEntryMethodToken());
         entryPoint->run();
 
-        if (context.getUsedStackSize() == 0)
+        context.logInlineCacheStatistics();
+        context.gc.logPauseHistograms();
+
+        if (context.fieldProfiling)
+            context.dll->saveFieldProfile(path + ".fieldprofile", context.fieldAccessCounts);
+
+        if (context.exceptionPending)
+            ili::Logger::error("Program terminated due to unhandled exception of type %s", reinterpret_cast<ili::ObjectHeader*>(context.exception)->methodTable->name.c_str());
+        else if (context.getUsedStackSize() == 0)
             ili::Logger::info("Program finished");
         else
             ili::Logger::info("Program finished with exit code %d", context.pop<s32>());
@@ -36,12 +73,29 @@ static void loadExecutable(std::string path) {
 
     delete[] context.typeStack;
     delete[] context.stack;
-    delete[] context.heap;
     delete   context.dll;
 }
 
-int main() {
-    loadExecutable("Test2.exe");
+// CSharpInterpreter [--profile-fields] [--marking-threads <count>] [--concurrent-marking] [executable]
+int main(int argc, char **argv) {
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--profile-fields") == 0) {
+            options.profileFields = true;
+        } else if (std::strcmp(argv[i], "--marking-threads") == 0 && i + 1 < argc) {
+            options.markingThreads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--concurrent-marking") == 0) {
+            options.concurrentMarking = true;
+        } else if (std::strncmp(argv[i], "--", 2) == 0) {
+            ili::Logger::error("Unknown option %s!", argv[i]);
+            return 1;
+        } else {
+            options.path = argv[i];
+        }
+    }
+
+    loadExecutable(options);
 
     return 0;
 }
@@ -0,0 +1,205 @@
+#include "memory.hpp"
+
+#include "logger.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+    #include <immintrin.h>
+#endif
+
+namespace ili {
+
+    using CopyKernel = void(*)(u8 *destination, const u8 *source, size_t size);
+    using FillKernel = void(*)(u8 *destination, u8 value, size_t size);
+
+    // Copies larger than this bypass the cache with non-temporal stores since they would evict everything else anyway
+    static constexpr size_t StreamingThreshold = 0x0010'0000;
+
+    static void copyGeneric(u8 *destination, const u8 *source, size_t size) {
+        std::memcpy(destination, source, size);
+    }
+
+    static void fillGeneric(u8 *destination, u8 value, size_t size) {
+        std::memset(destination, value, size);
+    }
+
+#if defined(__x86_64__)
+
+    __attribute__((target("sse2")))
+    static void copySSE2(u8 *destination, const u8 *source, size_t size) {
+        if (size < 16) {
+            std::memcpy(destination, source, size);
+            return;
+        }
+
+        // The last, possibly overlapping, vector takes care of the tail
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + size - 16));
+
+        size_t offset = 0;
+        for (; offset + 64 <= size; offset += 64) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset +  0));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset + 16));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset + 32));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset + 48));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset +  0), a);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset + 16), b);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset + 32), c);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset + 48), d);
+        }
+
+        for (; offset + 16 <= size; offset += 16)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset), _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + offset)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + size - 16), tail);
+    }
+
+    __attribute__((target("sse2")))
+    static void fillSSE2(u8 *destination, u8 value, size_t size) {
+        if (size < 16) {
+            std::memset(destination, value, size);
+            return;
+        }
+
+        __m128i pattern = _mm_set1_epi8(static_cast<char>(value));
+
+        size_t offset = 0;
+        for (; offset + 64 <= size; offset += 64) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset +  0), pattern);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset + 16), pattern);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset + 32), pattern);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset + 48), pattern);
+        }
+
+        for (; offset + 16 <= size; offset += 16)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + offset), pattern);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + size - 16), pattern);
+    }
+
+    __attribute__((target("avx2")))
+    static void copyAVX2(u8 *destination, const u8 *source, size_t size) {
+        if (size < 32) {
+            copySSE2(destination, source, size);
+            return;
+        }
+
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + size - 32));
+
+        size_t offset = 0;
+        if (size >= StreamingThreshold) {
+            // Align the destination so the streaming stores below are legal
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)));
+            offset = 32 - (reinterpret_cast<u64>(destination) & 31);
+
+            for (; offset + 128 <= size; offset += 128) {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset +  0));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset + 32));
+                __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset + 64));
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset + 96));
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset +  0), a);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset + 32), b);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset + 64), c);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset + 96), d);
+            }
+
+            _mm_sfence();
+        } else {
+            for (; offset + 128 <= size; offset += 128) {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset +  0));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset + 32));
+                __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset + 64));
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset + 96));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset +  0), a);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset + 32), b);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset + 64), c);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset + 96), d);
+            }
+        }
+
+        for (; offset + 32 <= size; offset += 32)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + offset)));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + size - 32), tail);
+        _mm256_zeroupper();
+    }
+
+    __attribute__((target("avx2")))
+    static void fillAVX2(u8 *destination, u8 value, size_t size) {
+        if (size < 32) {
+            fillSSE2(destination, value, size);
+            return;
+        }
+
+        __m256i pattern = _mm256_set1_epi8(static_cast<char>(value));
+
+        size_t offset = 0;
+        if (size >= StreamingThreshold) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination), pattern);
+            offset = 32 - (reinterpret_cast<u64>(destination) & 31);
+
+            for (; offset + 128 <= size; offset += 128) {
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset +  0), pattern);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset + 32), pattern);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset + 64), pattern);
+                _mm256_stream_si256(reinterpret_cast<__m256i*>(destination + offset + 96), pattern);
+            }
+
+            _mm_sfence();
+        } else {
+            for (; offset + 128 <= size; offset += 128) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset +  0), pattern);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset + 32), pattern);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset + 64), pattern);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset + 96), pattern);
+            }
+        }
+
+        for (; offset + 32 <= size; offset += 32)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + offset), pattern);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + size - 32), pattern);
+        _mm256_zeroupper();
+    }
+
+#endif
+
+    static CopyKernel selectCopyKernel() {
+    #if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            Logger::debug("Using AVX2 memory copy kernel");
+            return copyAVX2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            Logger::debug("Using SSE2 memory copy kernel");
+            return copySSE2;
+        }
+    #endif
+
+        return copyGeneric;
+    }
+
+    static FillKernel selectFillKernel() {
+    #if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2"))
+            return fillAVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return fillSSE2;
+    #endif
+
+        return fillGeneric;
+    }
+
+    void Memory::copy(void *destination, const void *source, size_t size) {
+        static const CopyKernel kernel = selectCopyKernel();
+
+        kernel(static_cast<u8*>(destination), static_cast<const u8*>(source), size);
+    }
+
+    void Memory::fill(void *destination, u8 value, size_t size) {
+        static const FillKernel kernel = selectFillKernel();
+
+        kernel(static_cast<u8*>(destination), value, size);
+    }
+
+}
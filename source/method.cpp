@@ -1,46 +1,89 @@
 #include "method.hpp"
 
 #include <string>
+#include <csignal>
 
 #include "types.hpp"
 #include "tables.hpp"
 #include "dll.hpp"
 #include "opcode.hpp"
 #include "context.hpp"
+#include "gc.hpp"
 #include "logger.hpp"
+#include "memory.hpp"
+#include "signature.hpp"
 
 namespace ili  {
 
-    Method::Method(Context &ctx, u32 methodToken) : m_ctx(ctx) {
+    Method::Method(Context &ctx, u32 methodToken, const GenericContext *genericContext) : Method(ctx, methodToken, genericContext, ctx.getMethodBody(methodToken, genericContext)) {
+
+    }
+
+    Method::Method(Context &ctx, u32 methodToken, const GenericContext *genericContext, MethodBody &body) : m_ctx(ctx), m_body(&body), m_genericContext(genericContext) {
         this->m_methodDef = getDLL()->getMethodDefByMetadataToken(methodToken);
+        this->m_frame.body = &body;
+
         Logger::debug("Executing method '%s'", getDLL()->getString(this->m_methodDef->nameIndex));
     }
 
-    Method::~Method() {
-        for (u16 i = 0; i < 0xFF; i++) {
-            if (this->m_localVariable[i] == nullptr)
-                continue;
+    void Method::run() {
+        this->m_programCounter = this->m_body->code;
 
-            delete this->m_localVariable[i];
-            this->m_localVariable[i] = nullptr;
+        // The arguments pushed by the caller stay where they are and become this frame's argument slots
+        this->m_frame.arguments = this->m_ctx.stackPointer - this->m_body->argumentsSize;
+        this->m_frame.typeFrameBase = this->m_ctx.typeStackPointer - this->m_body->argumentsSize / Context::StackSlotSize;
+
+        if (this->m_frame.arguments < this->m_ctx.stack) {
+            Logger::error("Not enough arguments on the stack to call '%s'!", getDLL()->getString(this->m_methodDef->nameIndex));
+            exit(1);
         }
-    }
 
-    void Method::run() {
-        section_table_entry_t *ilHeaderSection = getDLL()->getVirtualSection(this->m_methodDef->rva);
-        u8 *methodHeader = OFFSET(getDLL()->getData(), VRA_TO_OFFSET(ilHeaderSection, this->m_methodDef->rva));
+        if (this->m_body->triggersTypeInitialization) {
+            // Bodies of generic types are shared by instantiations that each get initialized on their own
+            const GenericContext *instantiation = nullptr;
+            if (this->m_genericContext != nullptr && !this->m_genericContext->typeArguments.empty())
+                instantiation = this->m_ctx.getGenericContext(GenericContext { this->m_genericContext->typeArguments });
+
+            if (!initializeType(this->m_body->ownerTypeIndex, instantiation)) {
+                releaseFrame();
+                return;
+            }
+
+            if (instantiation == nullptr && this->m_ctx.typeInitializations[this->m_body->ownerTypeIndex] == TypeInitialization::Done)
+                this->m_body->triggersTypeInitialization = false;
+        }
+
+        for (auto &argument : this->m_body->arguments) {
+            // Floats get pushed as F but are stored with their declared width so ldarga hands out a valid float32*
+            if (argument.type.elementType == SignatureElementType::R4) {
+                float value = *reinterpret_cast<double*>(this->m_frame.arguments + argument.offset);
+                std::memset(this->m_frame.arguments + argument.offset, 0x00, Context::StackSlotSize);
+                std::memcpy(this->m_frame.arguments + argument.offset, &value, sizeof(float));
+            }
+        }
 
-        if ((*methodHeader & 0x03) == 0x02) // Tiny Header
-            this->m_programCounter = methodHeader + 1;
-        else if ((*methodHeader & 0x03) == 0x03) // Fat Header
-            this->m_programCounter = methodHeader + 12;
+        this->m_frame.locals = this->m_ctx.stackPointer;
+        std::memset(this->m_frame.locals, 0x00, this->m_body->localsSize);
+        this->m_ctx.stackPointer += this->m_body->localsSize;
 
-        for (u16 i = 0; i < 0xFF; i++)
-            this->m_localVariable[i] = nullptr;
+        this->m_frame.stackBase = this->m_ctx.stackPointer;
+        this->m_frame.typeStackBase = this->m_ctx.typeStackPointer;
 
-        u8 *methodStart = this->m_programCounter;
+        this->m_frame.caller = this->m_ctx.currentFrame;
+        this->m_ctx.currentFrame = &this->m_frame;
 
+        execute();
+
+        this->m_ctx.currentFrame = this->m_frame.caller;
+    }
+
+    // Runs until the frame is left, either by ret or by an exception propagating to the caller
+    void Method::execute() {
         while (true) {
+            // Collections only happen in between instructions, when all references are in frames or on the evaluation stack
+            if (this->m_ctx.heap.collectionRequested) [[unlikely]]
+                this->m_ctx.gc.collect();
+
             u8 currOpcode = *this->m_programCounter;
 
             this->m_programCounter++;
@@ -57,7 +100,22 @@ namespace ili  {
                     case OpcodePrefix::Call: {
                         Logger::debug("Instruction CALL");
                         u32 token = this->getNext<u32>();
-                        call(token); // TODO: Handle return value
+                        if (callArrayAccessor(token))
+                            break;
+
+                        callDirect(token);
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
+
+                        break;
+                    }
+                    case OpcodePrefix::Call_q: {
+                        Logger::debug("Instruction CALL (quickened)");
+                        call(this->m_ctx.directCalls[getNext<u32>()]);
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
 
                         break;
                     }
@@ -163,21 +221,510 @@ namespace ili  {
                         Logger::debug("Instruction LDLOC.s");
                         ldloc(getNext<u8>());
                         break;
+                    case OpcodePrefix::Ldnull:
+                        Logger::debug("Instruction LDNULL");
+                        this->m_ctx.push<u64>(Type::O, 0);
+                        break;
+                    case OpcodePrefix::Dup:
+                        Logger::debug("Instruction DUP");
+                        this->m_ctx.duplicate();
+                        break;
+                    case OpcodePrefix::Pop:
+                        Logger::debug("Instruction POP");
+                        this->m_ctx.drop();
+                        break;
+                    case OpcodePrefix::Callvirt:
+                        Logger::debug("Instruction CALLVIRT");
+                        callvirt(getNext<u32>());
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
+
+                        break;
+                    case OpcodePrefix::Callvirt_q: {
+                        Logger::debug("Instruction CALLVIRT (quickened)");
+                        callvirt(this->m_ctx.virtualCalls[getNext<u32>()]);
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
+
+                        break;
+                    }
+                    case OpcodePrefix::Ldftn_q:
+                        Logger::debug("Instruction LDFTN (quickened)");
+                        this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(&this->m_ctx.methodEntries[getNext<u32>()]));
+                        break;
+                    case OpcodePrefix::Ldvirtftn_q:
+                        Logger::debug("Instruction LDVIRTFTN (quickened)");
+                        ldvirtftn(this->m_ctx.virtualCalls[getNext<u32>()]);
+                        break;
+                    case OpcodePrefix::Newarr:
+                        Logger::debug("Instruction NEWARR");
+                        newarr(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Newarr_q:
+                        Logger::debug("Instruction NEWARR (quickened)");
+                        newarr(this->m_ctx.arrayTypes[getNext<u32>()]);
+                        break;
+                    case OpcodePrefix::Ldlen:
+                        Logger::debug("Instruction LDLEN");
+                        ldlen();
+                        break;
+                    case OpcodePrefix::Ldelema:
+                        Logger::debug("Instruction LDELEMA");
+                        ldelema(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldelema_q:
+                        Logger::debug("Instruction LDELEMA (quickened)");
+                        ldelema(this->m_ctx.arrayTypes[getNext<u32>()]);
+                        break;
+                    case OpcodePrefix::Ldelem_i1:
+                        Logger::debug("Instruction LDELEM.I1");
+                        ldelem<s8, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldelem_u1:
+                        Logger::debug("Instruction LDELEM.U1");
+                        ldelem<u8, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldelem_i2:
+                        Logger::debug("Instruction LDELEM.I2");
+                        ldelem<s16, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldelem_u2:
+                        Logger::debug("Instruction LDELEM.U2");
+                        ldelem<u16, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldelem_i4:
+                        Logger::debug("Instruction LDELEM.I4");
+                        ldelem<s32, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldelem_u4:
+                        Logger::debug("Instruction LDELEM.U4");
+                        ldelem<u32, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldelem_i8:
+                        Logger::debug("Instruction LDELEM.I8");
+                        ldelem<s64, s64>(Type::Int64);
+                        break;
+                    case OpcodePrefix::Ldelem_i:
+                        Logger::debug("Instruction LDELEM.I");
+                        ldelem<u64, u64>(Type::Native_int);
+                        break;
+                    case OpcodePrefix::Ldelem_r4:
+                        Logger::debug("Instruction LDELEM.R4");
+                        ldelem<float, double>(Type::F);
+                        break;
+                    case OpcodePrefix::Ldelem_r8:
+                        Logger::debug("Instruction LDELEM.R8");
+                        ldelem<double, double>(Type::F);
+                        break;
+                    case OpcodePrefix::Ldelem_ref:
+                        Logger::debug("Instruction LDELEM.REF");
+                        ldelem<u64, u64>(Type::O);
+                        break;
+                    case OpcodePrefix::Ldelem:
+                        Logger::debug("Instruction LDELEM");
+                        ldelem(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldelem_q:
+                        Logger::debug("Instruction LDELEM (quickened)");
+                        ldelem(this->m_ctx.arrayTypes[getNext<u32>()]);
+                        break;
+                    case OpcodePrefix::Stelem_i:
+                        Logger::debug("Instruction STELEM.I");
+                        stelem<u64, u64>();
+                        break;
+                    case OpcodePrefix::Stelem_i1:
+                        Logger::debug("Instruction STELEM.I1");
+                        stelem<u8, u64>();
+                        break;
+                    case OpcodePrefix::Stelem_i2:
+                        Logger::debug("Instruction STELEM.I2");
+                        stelem<u16, u64>();
+                        break;
+                    case OpcodePrefix::Stelem_i4:
+                        Logger::debug("Instruction STELEM.I4");
+                        stelem<u32, u64>();
+                        break;
+                    case OpcodePrefix::Stelem_i8:
+                        Logger::debug("Instruction STELEM.I8");
+                        stelem<u64, u64>();
+                        break;
+                    case OpcodePrefix::Stelem_r4:
+                        Logger::debug("Instruction STELEM.R4");
+                        stelem<float, double>();
+                        break;
+                    case OpcodePrefix::Stelem_r8:
+                        Logger::debug("Instruction STELEM.R8");
+                        stelem<double, double>();
+                        break;
+                    case OpcodePrefix::Stelem_ref:
+                        Logger::debug("Instruction STELEM.REF");
+                        stelemRef();
+                        break;
+                    case OpcodePrefix::Stelem:
+                        Logger::debug("Instruction STELEM");
+                        stelem(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Stelem_q:
+                        Logger::debug("Instruction STELEM (quickened)");
+                        stelem(this->m_ctx.arrayTypes[getNext<u32>()]);
+                        break;
+                    case OpcodePrefix::Call_array_q:
+                        Logger::debug("Instruction CALL (quickened array accessor)");
+                        callArrayAccessor(this->m_ctx.arrayAccessors[getNext<u32>()]);
+                        break;
+                    case OpcodePrefix::Ldtoken:
+                        Logger::debug("Instruction LDTOKEN");
+                        ldtoken(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldtoken_q:
+                        Logger::debug("Instruction LDTOKEN (quickened)");
+                        this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(this->m_ctx.tokenTypes[getNext<u32>()]));
+                        break;
+                    case OpcodePrefix::Ldtype:
+                        Logger::debug("Instruction LDTYPE");
+                        ldtype(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldtype_q:
+                        Logger::debug("Instruction LDTYPE (quickened)");
+                        this->m_ctx.push<u64>(Type::O, this->m_ctx.getRuntimeType(this->m_ctx.tokenTypes[getNext<u32>()]));
+                        this->m_programCounter += sizeof(u8) + sizeof(u32);
+                        break;
+                    case OpcodePrefix::Mkrefany:
+                        Logger::debug("Instruction MKREFANY");
+                        mkrefany(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Refanyval:
+                        Logger::debug("Instruction REFANYVAL");
+                        refanyval(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Cpobj:
+                        Logger::debug("Instruction CPOBJ");
+                        cpobj(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldobj:
+                        Logger::debug("Instruction LDOBJ");
+                        ldobj(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Stobj:
+                        Logger::debug("Instruction STOBJ");
+                        stobj(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Castclass:
+                        Logger::debug("Instruction CASTCLASS");
+                        castclass(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Castclass_q: {
+                        Logger::debug("Instruction CASTCLASS (quickened)");
+                        castclass(this->m_ctx.typeChecks[getNext<u32>()]);
+                        break;
+                    }
+                    case OpcodePrefix::Isinst:
+                        Logger::debug("Instruction ISINST");
+                        isinst(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Isinst_q: {
+                        Logger::debug("Instruction ISINST (quickened)");
+                        isinst(this->m_ctx.typeChecks[getNext<u32>()]);
+                        break;
+                    }
+                    case OpcodePrefix::Box:
+                        Logger::debug("Instruction BOX");
+                        box(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Unbox:
+                        Logger::debug("Instruction UNBOX");
+                        unbox(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Unbox_any:
+                        Logger::debug("Instruction UNBOX.ANY");
+                        unboxAny(getNext<u32>());
+                        break;
                     case OpcodePrefix::Ldstr:
                         Logger::debug("Instruction LDSTR");
                         this->m_ctx.push<u32>(Type::O, getNext<u32>());
                         break;
-                    case OpcodePrefix ::Ldarg_0:
+                    case OpcodePrefix::Ldarg_0:
                         Logger::debug("Instruction LDARG.0");
+                        ldarg(0);
+                        break;
+                    case OpcodePrefix::Ldarg_1:
+                        Logger::debug("Instruction LDARG.1");
+                        ldarg(1);
+                        break;
+                    case OpcodePrefix::Ldarg_2:
+                        Logger::debug("Instruction LDARG.2");
+                        ldarg(2);
+                        break;
+                    case OpcodePrefix::Ldarg_3:
+                        Logger::debug("Instruction LDARG.3");
+                        ldarg(3);
+                        break;
+                    case OpcodePrefix::Ldarg_s:
+                        Logger::debug("Instruction LDARG.S");
+                        ldarg(getNext<u8>());
+                        break;
+                    case OpcodePrefix::Ldarga_s:
+                        Logger::debug("Instruction LDARGA.S");
+                        ldarga(getNext<u8>());
+                        break;
+                    case OpcodePrefix::Starg_s:
+                        Logger::debug("Instruction STARG.S");
+                        starg(getNext<u8>());
+                        break;
+                    case OpcodePrefix::Ldloca_s:
+                        Logger::debug("Instruction LDLOCA.S");
+                        ldloca(getNext<u8>());
+                        break;
+                    case OpcodePrefix::Ldind_i1:
+                        Logger::debug("Instruction LDIND.I1");
+                        ldind<s8, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldind_u1:
+                        Logger::debug("Instruction LDIND.U1");
+                        ldind<u8, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldind_i2:
+                        Logger::debug("Instruction LDIND.I2");
+                        ldind<s16, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldind_u2:
+                        Logger::debug("Instruction LDIND.U2");
+                        ldind<u16, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldind_i4:
+                        Logger::debug("Instruction LDIND.I4");
+                        ldind<s32, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldind_u4:
+                        Logger::debug("Instruction LDIND.U4");
+                        ldind<u32, s32>(Type::Int32);
+                        break;
+                    case OpcodePrefix::Ldind_i8:
+                        Logger::debug("Instruction LDIND.I8");
+                        ldind<s64, s64>(Type::Int64);
+                        break;
+                    case OpcodePrefix::Ldind_i:
+                        Logger::debug("Instruction LDIND.I");
+                        ldind<u64, u64>(Type::Native_int);
+                        break;
+                    case OpcodePrefix::Ldind_r4:
+                        Logger::debug("Instruction LDIND.R4");
+                        ldind<float, double>(Type::F);
+                        break;
+                    case OpcodePrefix::Ldind_r8:
+                        Logger::debug("Instruction LDIND.R8");
+                        ldind<double, double>(Type::F);
+                        break;
+                    case OpcodePrefix::Ldind_ref:
+                        Logger::debug("Instruction LDIND.REF");
+                        ldind<u64, u64>(Type::O);
+                        break;
+                    case OpcodePrefix::Stind_ref:
+                        Logger::debug("Instruction STIND.REF");
+                        stindRef();
+                        break;
+                    case OpcodePrefix::Stind_i1:
+                        Logger::debug("Instruction STIND.I1");
+                        stind<u8, u64>();
+                        break;
+                    case OpcodePrefix::Stind_i2:
+                        Logger::debug("Instruction STIND.I2");
+                        stind<u16, u64>();
+                        break;
+                    case OpcodePrefix::Stind_i4:
+                        Logger::debug("Instruction STIND.I4");
+                        stind<u32, u64>();
+                        break;
+                    case OpcodePrefix::Stind_i8:
+                        Logger::debug("Instruction STIND.I8");
+                        stind<u64, u64>();
+                        break;
+                    case OpcodePrefix::Stind_i:
+                        Logger::debug("Instruction STIND.I");
+                        stind<u64, u64>();
+                        break;
+                    case OpcodePrefix::Stind_r4:
+                        Logger::debug("Instruction STIND.R4");
+                        stind<float, double>();
+                        break;
+                    case OpcodePrefix::Stind_r8:
+                        Logger::debug("Instruction STIND.R8");
+                        stind<double, double>();
+                        break;
+                    case OpcodePrefix::Ldfld:
+                        Logger::debug("Instruction LDFLD");
+                        ldfld(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldflda:
+                        Logger::debug("Instruction LDFLDA");
+                        ldflda(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Stfld:
+                        Logger::debug("Instruction STFLD");
+                        stfld(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldsfld:
+                        Logger::debug("Instruction LDSFLD");
+                        ldsfld(getNext<u32>());
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
+
+                        break;
+                    case OpcodePrefix::Ldsflda:
+                        Logger::debug("Instruction LDSFLDA");
+                        ldsflda(getNext<u32>());
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
+
+                        break;
+                    case OpcodePrefix::Stsfld:
+                        Logger::debug("Instruction STSFLD");
+                        stsfld(getNext<u32>());
+
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
+
+                        break;
+                    case OpcodePrefix::Ldfld_i4_q: {
+                        Logger::debug("Instruction LDFLD.I4 (quickened)");
+                        u32 offset = getNext<u32>();
+
+                        if (this->m_ctx.getTypeOnStack() == Type::ValueType)
+                            ldfldFromValue(SignatureElementType::I4, offset, sizeof(s32));
+                        else
+                            this->m_ctx.push<s32>(Type::Int32, *reinterpret_cast<s32*>(popInstance() + offset));
+                        break;
+                    }
+                    case OpcodePrefix::Ldfld_i8_q: {
+                        Logger::debug("Instruction LDFLD.I8 (quickened)");
+                        u32 offset = getNext<u32>();
+
+                        if (this->m_ctx.getTypeOnStack() == Type::ValueType)
+                            ldfldFromValue(SignatureElementType::I8, offset, sizeof(s64));
+                        else
+                            this->m_ctx.push<s64>(Type::Int64, *reinterpret_cast<s64*>(popInstance() + offset));
                         break;
-                    case OpcodePrefix::Br:
+                    }
+                    case OpcodePrefix::Ldfld_ref_q: {
+                        Logger::debug("Instruction LDFLD.REF (quickened)");
+                        u32 offset = getNext<u32>();
+
+                        if (this->m_ctx.getTypeOnStack() == Type::ValueType)
+                            ldfldFromValue(SignatureElementType::Object, offset, sizeof(u64));
+                        else
+                            this->m_ctx.push<u64>(Type::O, *reinterpret_cast<u64*>(popInstance() + offset));
+                        break;
+                    }
+                    case OpcodePrefix::Ldfld_q: {
+                        Logger::debug("Instruction LDFLD (quickened)");
+                        ldfld(this->m_ctx.resolvedFields[getNext<u32>()]);
+                        break;
+                    }
+                    case OpcodePrefix::Stfld_i4_q: {
+                        Logger::debug("Instruction STFLD.I4 (quickened)");
+                        u32 offset = getNext<u32>();
+                        s32 value = this->m_ctx.pop<s32>();
+
+                        *reinterpret_cast<s32*>(popInstance() + offset) = value;
+                        break;
+                    }
+                    case OpcodePrefix::Stfld_i8_q: {
+                        Logger::debug("Instruction STFLD.I8 (quickened)");
+                        u32 offset = getNext<u32>();
+                        s64 value = this->m_ctx.pop<s64>();
+
+                        *reinterpret_cast<s64*>(popInstance() + offset) = value;
+                        break;
+                    }
+                    case OpcodePrefix::Stfld_ref_q: {
+                        Logger::debug("Instruction STFLD.REF (quickened)");
+                        u32 offset = getNext<u32>();
+                        u64 value = this->m_ctx.pop<u64>();
+                        u8 *address = popInstance() + offset;
+
+                        this->m_ctx.heap.preWriteBarrier(address);
+                        *reinterpret_cast<u64*>(address) = value;
+                        this->m_ctx.heap.writeBarrier(address, value);
+                        break;
+                    }
+                    case OpcodePrefix::Stfld_q: {
+                        Logger::debug("Instruction STFLD (quickened)");
+                        stfld(this->m_ctx.resolvedFields[getNext<u32>()]);
+                        break;
+                    }
+                    case OpcodePrefix::Ldflda_q: {
+                        Logger::debug("Instruction LDFLDA (quickened)");
+                        u32 offset = getNext<u32>();
+
+                        this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(popInstance() + offset));
+                        break;
+                    }
+                    case OpcodePrefix::Ldsfld_q: {
+                        Logger::debug("Instruction LDSFLD (quickened)");
+                        auto &field = this->m_ctx.resolvedFields[getNext<u32>()];
+
+                        this->m_ctx.loadValue(field.type, field.staticAddress, field.size);
+                        break;
+                    }
+                    case OpcodePrefix::Stsfld_q: {
+                        Logger::debug("Instruction STSFLD (quickened)");
+                        auto &field = this->m_ctx.resolvedFields[getNext<u32>()];
+
+                        // Static fields are roots of every collection, they never need a card dirtied
+                        this->m_ctx.storeValue(field.type, field.staticAddress, field.size);
+                        break;
+                    }
+                    case OpcodePrefix::Ldsflda_q: {
+                        Logger::debug("Instruction LDSFLDA (quickened)");
+                        auto &field = this->m_ctx.resolvedFields[getNext<u32>()];
+
+                        this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(field.staticAddress));
+                        break;
+                    }
+                    case OpcodePrefix::Br: {
                         Logger::debug("Instruction BR");
-                        this->m_programCounter = methodStart + getNext<s32>();
+                        s32 offset = getNext<s32>();
+                        this->m_programCounter += offset;
                         break;
-                    case OpcodePrefix::Br_s:
+                    }
+                    case OpcodePrefix::Br_s: {
                         Logger::debug("Instruction BR.S");
-                        this->m_programCounter += getNext<s8>();
+                        s8 offset = getNext<s8>();
+                        this->m_programCounter += offset;
+                        break;
+                    }
+                    case OpcodePrefix::Brtrue: {
+                        Logger::debug("Instruction BRTRUE");
+                        s32 offset = getNext<s32>();
+                        if (this->m_ctx.pop<u64>() != 0)
+                            this->m_programCounter += offset;
                         break;
+                    }
+                    case OpcodePrefix::Brtrue_s: {
+                        Logger::debug("Instruction BRTRUE.S");
+                        s8 offset = getNext<s8>();
+                        if (this->m_ctx.pop<u64>() != 0)
+                            this->m_programCounter += offset;
+                        break;
+                    }
+                    case OpcodePrefix::Brfalse: {
+                        Logger::debug("Instruction BRFALSE");
+                        s32 offset = getNext<s32>();
+                        if (this->m_ctx.pop<u64>() == 0)
+                            this->m_programCounter += offset;
+                        break;
+                    }
+                    case OpcodePrefix::Brfalse_s: {
+                        Logger::debug("Instruction BRFALSE.S");
+                        s8 offset = getNext<s8>();
+                        if (this->m_ctx.pop<u64>() == 0)
+                            this->m_programCounter += offset;
+                        break;
+                    }
                     case OpcodePrefix::Add: {
                         Logger::debug("Instruction ADD");
                         Type opAType = this->m_ctx.getTypeOnStack(2);
@@ -229,51 +776,52 @@ namespace ili  {
                     case OpcodePrefix::Newobj: {
                         Logger::debug("Instruction NEWOBJ");
                         u32 token = this->getNext<u32>();
-                        if (TABLE_ID(token) == TABLE_ID_METHODDEF) {
-                            u16 typeIndex = getDLL()->findTypeDefWithMethod(token);
-
-                            table_type_def_t *type = getDLL()->getTypeDefByIndex(typeIndex);
-                            table_type_def_t *typeNext = getDLL()->getTypeDefByIndex(typeIndex + 1);
+                        if (callArrayAccessor(token))
+                            break;
 
-                            Logger::debug("Creating instance of Type %s::%s", getDLL()->getString(type->typeNamespaceIndex), getDLL()->getString(type->typeNameIndex));
+                        newobj(token);
 
-                            size_t objSize = 0;
-                            for (u16 i = type->fieldListIndex; i < typeNext->fieldListIndex && i <= getDLL()->getNumTableRows(TABLE_ID_FIELD); i++) {
-                                auto field = getDLL()->getFieldByIndex(i);
-                                auto sig = getDLL()->getBlob(field->signatureIndex);
-                                auto sigSize = getDLL()->getBlobSize(field->signatureIndex);
+                        if (this->m_ctx.exceptionPending && !catchPendingException())
+                            return;
 
-                                size_t fieldSize = getSignatureElementTypeSize(static_cast<SignatureElementType>(*(sig + sigSize - 1)));
-
-                                objSize += fieldSize;
-
-                                Logger::debug("  Field %s [0x%02x]", getDLL()->getString(field->nameIndex), fieldSize);
-                            }
-
-                            Logger::debug("Allocating %d bytes on the heap", objSize);
-
-                            u8 *newMemory = nullptr;
-                            if (this->m_ctx.heapReferences.empty()) {
-                                newMemory = this->m_ctx.heap;
-                            } else {
-                                auto lastElement = this->m_ctx.heapReferences.back();
-                                newMemory = lastElement.heapPointer + lastElement.size;
-                            }
-
-                            std::memset(newMemory, 0x00, objSize);
-                            this->m_ctx.heapReferences.push_back({ newMemory, objSize });
-
-                            this->m_ctx.push<u64>(Type::O, reinterpret_cast<u64>(newMemory));
-
-                            call(token);
-                        }
                         break;
                     }
                     case OpcodePrefix::Ret: {
                         Logger::debug("Instruction RET");
+                        ret();
 
                         return;
                     }
+                    case OpcodePrefix::Thrw: {
+                        Logger::debug("Instruction THROW");
+                        u64 exception = this->m_ctx.pop<u64>();
+
+                        if (exception == 0) {
+                            Logger::error("Threw a null reference!");
+                            exit(1);
+                        }
+
+                        if (!throwException(exception))
+                            return;
+                        break;
+                    }
+                    case OpcodePrefix::Leave: {
+                        Logger::debug("Instruction LEAVE");
+                        s32 offset = getNext<s32>();
+                        leave(getCurrentOffset() + 1 + offset);
+                        break;
+                    }
+                    case OpcodePrefix::Leave_s: {
+                        Logger::debug("Instruction LEAVE.S");
+                        s8 offset = getNext<s8>();
+                        leave(getCurrentOffset() + 1 + offset);
+                        break;
+                    }
+                    case OpcodePrefix::Endfinally:
+                        Logger::debug("Instruction ENDFINALLY");
+                        if (!endfinally())
+                            return;
+                        break;
                     default:
                         Logger::error("Unknown opcode (%02x)!", currOpcode);
                         exit(1);
@@ -284,8 +832,88 @@ namespace ili  {
                 currOpcode = *this->m_programCounter;
                 this->m_programCounter++;
 
-                switch (currOpcode) {
-
+                switch (static_cast<OpcodePrefix>(0xFE00 | currOpcode)) {
+                    case OpcodePrefix::Endfilter:
+                        Logger::debug("Instruction ENDFILTER");
+                        if (!endfilter())
+                            return;
+                        break;
+                    case OpcodePrefix::Ldarg:
+                        Logger::debug("Instruction LDARG");
+                        ldarg(getNext<u16>());
+                        break;
+                    case OpcodePrefix::Ldarga:
+                        Logger::debug("Instruction LDARGA");
+                        ldarga(getNext<u16>());
+                        break;
+                    case OpcodePrefix::Starg:
+                        Logger::debug("Instruction STARG");
+                        starg(getNext<u16>());
+                        break;
+                    case OpcodePrefix::Ldloc:
+                        Logger::debug("Instruction LDLOC");
+                        ldloc(getNext<u16>());
+                        break;
+                    case OpcodePrefix::Ldloca:
+                        Logger::debug("Instruction LDLOCA");
+                        ldloca(getNext<u16>());
+                        break;
+                    case OpcodePrefix::Stloc:
+                        Logger::debug("Instruction STLOC");
+                        stloc(getNext<u16>());
+                        break;
+                    case OpcodePrefix::Initobj:
+                        Logger::debug("Instruction INITOBJ");
+                        initobj(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Size_of:
+                        Logger::debug("Instruction SIZEOF");
+                        sizeOf(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Localloc:
+                        Logger::debug("Instruction LOCALLOC");
+                        localloc(this->m_ctx.pop<u64>());
+                        break;
+                    case OpcodePrefix::Cpblk:
+                        Logger::debug("Instruction CPBLK");
+                        cpblk();
+                        break;
+                    case OpcodePrefix::Initblk:
+                        Logger::debug("Instruction INITBLK");
+                        initblk();
+                        break;
+                    case OpcodePrefix::Unaligned:
+                        Logger::debug("Instruction UNALIGNED.");
+                        getNext<u8>(); // All memory accesses are done unaligned-safe anyway
+                        break;
+                    case OpcodePrefix::Ldftn:
+                        Logger::debug("Instruction LDFTN");
+                        ldftn(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Ldvirtftn:
+                        Logger::debug("Instruction LDVIRTFTN");
+                        ldvirtftn(getNext<u32>());
+                        break;
+                    case OpcodePrefix::Refanytype:
+                        Logger::debug("Instruction REFANYTYPE");
+                        refanytype();
+                        break;
+                    case OpcodePrefix::Volatle:
+                        Logger::debug("Instruction VOLATILE.");
+                        break;
+                    case OpcodePrefix::Constrained:
+                        Logger::debug("Instruction CONSTRAINED.");
+                        this->m_constrainedType = getNext<u32>();
+                        break;
+                    case OpcodePrefix::Rethrow:
+                        Logger::debug("Instruction RETHROW");
+                        if (!throwException(this->m_frame.exception))
+                            return;
+                        break;
+                    default:
+                        Logger::error("Unknown opcode (fe %02x)!", currOpcode);
+                        exit(1);
+                        break;
                 }
             }
         }
@@ -305,94 +933,1919 @@ namespace ili  {
         return this->m_ctx.dll;
     }
 
-    // Instruction Implementations
-
-    void Method::stloc(u8 id) {
-        if (this->m_localVariable[id] != nullptr)
-            delete this->m_localVariable[id];
-        this->m_localVariable[id] = nullptr;
+    // Offset of the instruction currently being executed. Only valid while its operands have been read,
+    // the program counter then points somewhere past the opcode byte but before the next instruction
+    u32 Method::getCurrentOffset() {
+        return (this->m_programCounter - 1) - this->m_body->code;
+    }
 
-        Type type = this->m_ctx.getTypeOnStack();
+    void Method::resetEvaluationStack() {
+        this->m_ctx.stackPointer = this->m_frame.stackBase;
+        this->m_ctx.typeStackPointer = this->m_frame.typeStackBase;
+    }
 
-        switch (type) {
-            case Type::Int32:
-                this->m_localVariable[id] = new Variable<s32>{type, this->m_ctx.pop<s32>()};
-                break;
-            case Type::Int64:
-                this->m_localVariable[id] = new Variable<s64>{type, this->m_ctx.pop<s64>()};
-                break;
-            case Type::Native_int:
-                this->m_localVariable[id] = new Variable<s32>{type, this->m_ctx.pop<s32>()};
-                break;
-            case Type::F:
-                this->m_localVariable[id] = new Variable<double>{type, this->m_ctx.pop<double>()};
-                break;
-            case Type::O:
-                this->m_localVariable[id] = new Variable<u64>{type, this->m_ctx.pop<u64>()};
-                break;
-            case Type::Pointer:
-                this->m_localVariable[id] = new Variable<u64>{type, this->m_ctx.pop<u64>()};
-                break;
-        }
+    // Drops the evaluation stack together with the arguments, locals and localloc regions of this frame
+    void Method::releaseFrame() {
+        this->m_ctx.stackPointer = this->m_frame.arguments;
+        this->m_ctx.typeStackPointer = this->m_frame.typeFrameBase;
     }
 
-    void Method::ldloc(u8 id) {
-        auto varType = this->m_localVariable[id]->type;
+    // Exception Handling
+    //
+    // Try regions cost nothing to enter, the clause table decoded in MethodBody is only consulted
+    // once a leave or a throw happens. Pending finally handlers are run front to back and the
+    // remembered continuation is applied once the last one hit its endfinally.
 
-        switch (varType) {
-            case Type::Int32:
-                this->m_ctx.push<s32>(varType, static_cast<Variable<s32>*>(this->m_localVariable[id])->value);
-                break;
-            case Type::Int64:
-                this->m_ctx.push<s64>(varType, static_cast<Variable<s64>*>(this->m_localVariable[id])->value);
-                break;
-            case Type::Native_int:
-                this->m_ctx.push<s32>(varType, static_cast<Variable<s32>*>(this->m_localVariable[id])->value);
-                break;
-            case Type::F:
-                this->m_ctx.push<double>(varType, static_cast<Variable<double>*>(this->m_localVariable[id])->value);
-                break;
-            case Type::O:
-                this->m_ctx.push<u64>(varType, static_cast<Variable<u32>*>(this->m_localVariable[id])->value);
-                break;
-            case Type::Pointer:
-                this->m_ctx.push<u64>(varType, static_cast<Variable<u64>*>(this->m_localVariable[id])->value);
-                break;
-        }
-        if (this->m_localVariable[id] != nullptr)
-            delete this->m_localVariable[id];
+    bool Method::throwException(u64 exception) {
+        suspendUnwinding();
 
-        this->m_localVariable[id] = nullptr;
+        this->m_frame.exception = exception;
+        this->m_throwOffset = getCurrentOffset();
+
+        this->m_pendingFinallies.clear();
+        this->m_nextFinally = 0;
+
+        return dispatchException(0);
     }
 
-    template<typename T>
-    void Method::ldc(Type type, T num) {
-        this->m_ctx.push(type, num);
+    bool Method::catchPendingException() {
+        this->m_ctx.exceptionPending = false;
+
+        return throwException(this->m_ctx.exception);
     }
 
-    void Method::call(u32 methodToken) {
-        switch (TABLE_ID(methodToken)) {
-            case TABLE_ID_METHODDEF:
-            {
-                auto method = getDLL()->getMethodDefByMetadataToken(methodToken);
-                auto sig = getDLL()->getBlob(method->signatureIndex);
+    bool Method::dispatchException(u32 firstClause) {
+        auto &clauses = this->m_body->exceptionClauses;
 
-                auto calledMethod = new Method(this->m_ctx, methodToken);
-                calledMethod->run();
-                delete calledMethod;
-                break;
-            }
-            case TABLE_ID_MEMBERREF:
-            {
-                auto fullMethodName = getDLL()->getFullMethodName(methodToken);
-                Logger::debug("Executing native method %s", fullMethodName.c_str());
+        for (u32 i = firstClause; i < clauses.size(); i++) {
+            auto &clause = clauses[i];
 
-                this->m_ctx.nativeFunctions[fullMethodName]();
+            if (!clause.tryContains(this->m_throwOffset))
+                continue;
 
-                break;
+            switch (clause.type) {
+                case ExceptionClauseType::Finally:
+                case ExceptionClauseType::Fault:
+                    this->m_pendingFinallies.push_back(i);
+                    break;
+                case ExceptionClauseType::Catch:
+                    if (isExceptionCaughtBy(this->m_frame.exception, clause.classToken)) {
+                        this->m_continuation = Continuation::Catch;
+                        this->m_continuationTarget = i;
+
+                        return continueUnwinding();
+                    }
+                    break;
+                case ExceptionClauseType::Filter:
+                    Logger::debug("Running exception filter at %04x", clause.filterStart);
+
+                    this->m_filterClause = i;
+                    resetEvaluationStack();
+                    this->m_ctx.push<u64>(Type::O, this->m_frame.exception);
+                    this->m_programCounter = this->m_body->code + clause.filterStart;
+
+                    return true;
             }
         }
+
+        // No handler in this frame, leave it to the caller once all finally and fault handlers ran
+        this->m_continuation = Continuation::Propagate;
+
+        return continueUnwinding();
     }
 
-}
+    bool Method::continueUnwinding() {
+        auto &clauses = this->m_body->exceptionClauses;
+
+        if (this->m_nextFinally < this->m_pendingFinallies.size()) {
+            auto &clause = clauses[this->m_pendingFinallies[this->m_nextFinally]];
+            this->m_nextFinally++;
 
+            resetEvaluationStack();
+            this->m_programCounter = this->m_body->code + clause.handlerStart;
+
+            return true;
+        }
+
+        this->m_pendingFinallies.clear();
+        this->m_nextFinally = 0;
+
+        Continuation continuation = this->m_continuation;
+        this->m_continuation = Continuation::None;
+
+        switch (continuation) {
+            case Continuation::None:
+                break;
+            case Continuation::Leave:
+                this->m_programCounter = this->m_body->code + this->m_continuationTarget;
+                resumeUnwinding(this->m_continuationTarget);
+                break;
+            case Continuation::Catch:
+                resetEvaluationStack();
+                this->m_ctx.push<u64>(Type::O, this->m_frame.exception);
+                this->m_programCounter = this->m_body->code + clauses[this->m_continuationTarget].handlerStart;
+                break;
+            case Continuation::Propagate:
+                Logger::debug("Propagating exception %016llx to caller", this->m_frame.exception);
+
+                releaseFrame();
+                this->m_ctx.exceptionPending = true;
+                this->m_ctx.exception = this->m_frame.exception;
+                return false;
+        }
+
+        return true;
+    }
+
+    // Only finally and fault handlers run while m_nextFinally is set, catch handlers start once unwinding is done
+    void Method::suspendUnwinding() {
+        if (this->m_nextFinally == 0)
+            return;
+
+        this->m_suspendedUnwinds.push_back({ std::move(this->m_pendingFinallies), this->m_nextFinally, this->m_continuation, this->m_continuationTarget, this->m_throwOffset });
+        this->m_frame.suspendedExceptions.push_back(this->m_frame.exception);
+
+        this->m_pendingFinallies.clear();
+        this->m_nextFinally = 0;
+        this->m_continuation = Continuation::None;
+    }
+
+    // Called once a nested unwind left for offset. Unwinds whose finally handler it jumped out of are abandoned,
+    // like an exception thrown out of a finally handler replaces the one that was being dispatched
+    void Method::resumeUnwinding(u32 offset) {
+        while (!this->m_suspendedUnwinds.empty()) {
+            auto unwind = std::move(this->m_suspendedUnwinds.back());
+            u64 exception = this->m_frame.suspendedExceptions.back();
+
+            this->m_suspendedUnwinds.pop_back();
+            this->m_frame.suspendedExceptions.pop_back();
+
+            if (!this->m_body->exceptionClauses[unwind.pendingFinallies[unwind.nextFinally - 1]].handlerContains(offset))
+                continue;
+
+            this->m_pendingFinallies = std::move(unwind.pendingFinallies);
+            this->m_nextFinally = unwind.nextFinally;
+            this->m_continuation = unwind.continuation;
+            this->m_continuationTarget = unwind.continuationTarget;
+            this->m_throwOffset = unwind.throwOffset;
+            this->m_frame.exception = exception;
+
+            return;
+        }
+    }
+
+    bool Method::isExceptionCaughtBy(u64 exception, u32 classToken) {
+        auto exceptionType = reinterpret_cast<ObjectHeader*>(exception)->methodTable;
+
+        return exceptionType->isSubclassOf(this->m_ctx.getMethodTable(resolveType(classToken)));
+    }
+
+    // Instruction Implementations
+
+    // Generics
+
+    TypeSignature Method::resolveType(u32 typeToken) {
+        auto type = getDLL()->resolveTypeToken(typeToken);
+
+        if (this->m_genericContext != nullptr)
+            return this->m_genericContext->substitute(type);
+
+        return type;
+    }
+
+    // Whether a token refers to something else depending on the type arguments the code runs with
+    bool Method::dependsOnGenericContext(u32 token) {
+        switch (TABLE_ID(token)) {
+            case TABLE_ID_TYPESPEC:
+                return getDLL()->resolveTypeToken(token).dependsOnGenericParameters();
+            case TABLE_ID_MEMBERREF: {
+                u32 parentToken = getDLL()->decodeMemberRefParent(getDLL()->getMemberRefByMetadataToken(token)->classIndex);
+                return TABLE_ID(parentToken) == TABLE_ID_TYPESPEC && dependsOnGenericContext(parentToken);
+            }
+            case TABLE_ID_METHODSPEC: {
+                auto methodSpec = getDLL()->getMethodSpecByIndex(TABLE_INDEX(token));
+
+                for (auto &argument : SignatureReader(getDLL(), getDLL()->getBlob(methodSpec->instantiationIndex)).readMethodSpecSignature()) {
+                    if (argument.dependsOnGenericParameters())
+                        return true;
+                }
+
+                return dependsOnGenericContext(getDLL()->decodeMethodDefOrRef(methodSpec->methodIndex));
+            }
+            default:
+                return false;
+        }
+    }
+
+    // Turns MethodSpecs and MemberRefs to methods of generic instances into the MethodDef to run and
+    // the type arguments to run it with. All other tokens are returned unchanged
+    u32 Method::resolveMethod(u32 methodToken, const GenericContext *&genericContext) {
+        GenericContext context;
+
+        if (TABLE_ID(methodToken) == TABLE_ID_METHODSPEC) {
+            auto methodSpec = getDLL()->getMethodSpecByIndex(TABLE_INDEX(methodToken));
+
+            for (auto &argument : SignatureReader(getDLL(), getDLL()->getBlob(methodSpec->instantiationIndex)).readMethodSpecSignature())
+                context.methodArguments.push_back(this->m_genericContext != nullptr ? this->m_genericContext->substitute(argument) : argument);
+
+            methodToken = getDLL()->decodeMethodDefOrRef(methodSpec->methodIndex);
+        }
+
+        if (TABLE_ID(methodToken) == TABLE_ID_MEMBERREF) {
+            u32 parentToken = getDLL()->decodeMemberRefParent(getDLL()->getMemberRefByMetadataToken(methodToken)->classIndex);
+
+            if (TABLE_ID(parentToken) == TABLE_ID_TYPESPEC)
+                context.typeArguments = resolveType(parentToken).typeArguments;
+
+            methodToken = getDLL()->resolveMethodDefinition(methodToken);
+        }
+
+        genericContext = this->m_ctx.getGenericContext(context);
+
+        return methodToken;
+    }
+
+    void Method::stloc(u16 id) {
+        auto &local = this->m_body->locals[id];
+
+        this->m_ctx.storeValue(local.type.getStorageType(), this->m_frame.locals + local.offset, local.size);
+    }
+
+    void Method::ldloc(u16 id) {
+        auto &local = this->m_body->locals[id];
+
+        this->m_ctx.loadValue(local.type.getStorageType(), this->m_frame.locals + local.offset, local.size);
+    }
+
+    void Method::ldloca(u16 id) {
+        this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(this->m_frame.locals + this->m_body->locals[id].offset));
+    }
+
+    void Method::starg(u16 id) {
+        auto &argument = this->m_body->arguments[id];
+
+        this->m_ctx.storeValue(argument.type.getStorageType(), this->m_frame.arguments + argument.offset, argument.size);
+    }
+
+    void Method::ldarg(u16 id) {
+        auto &argument = this->m_body->arguments[id];
+
+        this->m_ctx.loadValue(argument.type.getStorageType(), this->m_frame.arguments + argument.offset, argument.size);
+    }
+
+    void Method::ldarga(u16 id) {
+        this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(this->m_frame.arguments + this->m_body->arguments[id].offset));
+    }
+
+    template<typename Storage, typename Value>
+    void Method::ldind(Type type) {
+        auto address = reinterpret_cast<Storage*>(this->m_ctx.pop<u64>());
+
+        if (address == nullptr) {
+            Logger::error("Indirect load through a null pointer!");
+            exit(1);
+        }
+
+        this->m_ctx.push<Value>(type, static_cast<Value>(*address));
+    }
+
+    template<typename Storage, typename Value>
+    void Method::stind() {
+        auto value = this->m_ctx.pop<Value>();
+        auto address = reinterpret_cast<Storage*>(this->m_ctx.pop<u64>());
+
+        if (address == nullptr) {
+            Logger::error("Indirect store through a null pointer!");
+            exit(1);
+        }
+
+        *address = static_cast<Storage>(value);
+    }
+
+    // Managed pointers may point into an object
+    void Method::stindRef() {
+        u64 value = this->m_ctx.pop<u64>();
+        auto address = reinterpret_cast<u64*>(this->m_ctx.pop<u64>());
+
+        if (address == nullptr) {
+            Logger::error("Indirect store through a null pointer!");
+            exit(1);
+        }
+
+        this->m_ctx.heap.preWriteBarrier(address);
+        *address = value;
+        this->m_ctx.heap.writeBarrier(address, value);
+    }
+
+    // Arrays are laid out as the object header, an ArrayHeader and the elements right after each other.
+    // Instructions with a type token get quickened into an index into Context::arrayTypes, the typed
+    // variants know their element size and only need the bounds check
+
+    TypeSignature Method::getArrayType(u32 elementTypeToken) {
+        TypeSignature array = { SignatureElementType::SzArray };
+        array.setInnerType(resolveType(elementTypeToken));
+
+        return array;
+    }
+
+    u32 Method::resolveArrayType(u32 elementTypeToken) {
+        u32 index = this->m_ctx.arrayTypes.size();
+        this->m_ctx.arrayTypes.push_back(this->m_ctx.getMethodTable(getArrayType(elementTypeToken)));
+
+        return index;
+    }
+
+    // Indices are either int32 or native int. Negative ones get sign extended, which makes them fail the
+    // same unsigned bounds check as indices that are too large
+    u64 Method::popIndex() {
+        if (this->m_ctx.getTypeOnStack() == Type::Int32)
+            return static_cast<s64>(this->m_ctx.pop<s32>());
+
+        return this->m_ctx.pop<u64>();
+    }
+
+    u8* Method::getElementAddress(u64 array, u64 index, u32 elementSize) {
+        if (array == 0) {
+            Logger::error("Tried to access an element of a null array!");
+            exit(1);
+        }
+
+        auto arrayData = reinterpret_cast<u8*>(array);
+        u64 length = reinterpret_cast<ArrayHeader*>(arrayData + ObjectHeaderSize)->length;
+
+        if (index >= length) {
+            Logger::error("Array index %lld out of range for array of length %llu!", static_cast<s64>(index), length);
+            exit(1);
+        }
+
+        return arrayData + ArrayDataOffset + index * elementSize;
+    }
+
+    // Arrays of reference types are covariant, so a string[] may be stored in an object[] variable. Stores into
+    // arrays with a sealed element type only need to compare method tables, everything else gets cached per array type
+    void Method::checkArrayStore(MethodTable *arrayType, u64 value) {
+        auto elementType = arrayType->elementType;
+
+        if (value == 0 || elementType->type.elementType == SignatureElementType::Object)
+            return;
+
+        auto valueType = this->m_ctx.getMethodTableOf(value);
+        if (valueType == elementType || valueType == arrayType->lastStoredType)
+            return;
+
+        if (elementType->isSealed || !valueType->isAssignableTo(elementType)) {
+            Logger::error("Cannot store %s in an array of %s!", valueType->name.c_str(), elementType->name.c_str());
+            exit(1);
+        }
+
+        arrayType->lastStoredType = valueType;
+    }
+
+    void Method::newarr(u32 elementTypeToken) {
+        if (!dependsOnGenericContext(elementTypeToken)) {
+            quicken(OpcodePrefix::Newarr_q, resolveArrayType(elementTypeToken));
+            return;
+        }
+
+        newarr(this->m_ctx.getMethodTable(getArrayType(elementTypeToken)));
+    }
+
+    void Method::newarr(MethodTable *arrayType) {
+        s64 length = this->m_ctx.getTypeOnStack() == Type::Int32 ? this->m_ctx.pop<s32>() : this->m_ctx.pop<s64>();
+
+        if (length < 0) {
+            Logger::error("Tried to create an array with negative length %lld!", length);
+            exit(1);
+        }
+
+        this->m_ctx.push<u64>(Type::O, reinterpret_cast<u64>(this->m_ctx.allocateArray(arrayType, length)));
+    }
+
+    void Method::ldlen() {
+        auto array = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+
+        if (array == nullptr) {
+            Logger::error("Tried to get the length of a null array!");
+            exit(1);
+        }
+
+        this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<ArrayHeader*>(array + ObjectHeaderSize)->length);
+    }
+
+    void Method::ldelema(u32 elementTypeToken) {
+        if (!dependsOnGenericContext(elementTypeToken)) {
+            quicken(OpcodePrefix::Ldelema_q, resolveArrayType(elementTypeToken));
+            return;
+        }
+
+        ldelema(this->m_ctx.getMethodTable(getArrayType(elementTypeToken)));
+    }
+
+    void Method::ldelema(MethodTable *arrayType) {
+        u64 index = popIndex();
+        u64 array = this->m_ctx.pop<u64>();
+
+        this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(getElementAddress(array, index, arrayType->elementSize)));
+    }
+
+    void Method::ldelem(u32 elementTypeToken) {
+        if (!dependsOnGenericContext(elementTypeToken)) {
+            quicken(OpcodePrefix::Ldelem_q, resolveArrayType(elementTypeToken));
+            return;
+        }
+
+        ldelem(this->m_ctx.getMethodTable(getArrayType(elementTypeToken)));
+    }
+
+    void Method::ldelem(MethodTable *arrayType) {
+        u64 index = popIndex();
+        u64 array = this->m_ctx.pop<u64>();
+
+        this->m_ctx.loadValue(arrayType->elementStorageType, getElementAddress(array, index, arrayType->elementSize), arrayType->elementSize);
+    }
+
+    void Method::stelem(u32 elementTypeToken) {
+        if (!dependsOnGenericContext(elementTypeToken)) {
+            quicken(OpcodePrefix::Stelem_q, resolveArrayType(elementTypeToken));
+            return;
+        }
+
+        stelem(this->m_ctx.getMethodTable(getArrayType(elementTypeToken)));
+    }
+
+    void Method::stelem(MethodTable *arrayType) {
+        if (!arrayType->elementType->isValueType) {
+            stelemRef();
+            return;
+        }
+
+        // The index and array sit right below the value, however many slots that one takes up
+        u32 valueSlots = this->m_ctx.getSlotCountOnStack();
+        auto indexSlot = this->m_ctx.peekValue() - Context::StackSlotSize;
+        u64 index = this->m_ctx.getTypeOnStack(valueSlots) == Type::Int32 ? static_cast<s64>(*reinterpret_cast<s32*>(indexSlot)) : *reinterpret_cast<u64*>(indexSlot);
+        u64 array = *reinterpret_cast<u64*>(indexSlot - Context::StackSlotSize);
+
+        this->m_ctx.storeObjectValue(arrayType->elementStorageType, getElementAddress(array, index, arrayType->elementSize), arrayType->elementSize);
+        this->m_ctx.pop<u64>();
+        this->m_ctx.pop<u64>();
+    }
+
+    template<typename Storage, typename Value>
+    void Method::ldelem(Type type) {
+        u64 index = popIndex();
+        u64 array = this->m_ctx.pop<u64>();
+
+        this->m_ctx.push<Value>(type, static_cast<Value>(*reinterpret_cast<Storage*>(getElementAddress(array, index, sizeof(Storage)))));
+    }
+
+    template<typename Storage, typename Value>
+    void Method::stelem() {
+        auto value = this->m_ctx.pop<Value>();
+        u64 index = popIndex();
+        u64 array = this->m_ctx.pop<u64>();
+
+        *reinterpret_cast<Storage*>(getElementAddress(array, index, sizeof(Storage))) = static_cast<Storage>(value);
+    }
+
+    void Method::stelemRef() {
+        u64 value = this->m_ctx.pop<u64>();
+        u64 index = popIndex();
+        u64 array = this->m_ctx.pop<u64>();
+
+        auto address = getElementAddress(array, index, sizeof(u64));
+        checkArrayStore(this->m_ctx.getMethodTableOf(array), value);
+        this->m_ctx.heap.preWriteBarrier(address);
+        *reinterpret_cast<u64*>(address) = value;
+        this->m_ctx.heap.writeBarrier(address, value);
+    }
+
+    // Multidimensional arrays have no IL instructions of their own, the compiler calls the Get, Set and Address
+    // methods and the constructors the runtime provides for every array type instead. Those calls are quickened
+    // into Call_array_q and handled right here, with the index calculation unrolled for two and three dimensions
+
+    bool Method::isArrayAccessor(u32 methodToken) {
+        if (TABLE_ID(methodToken) != TABLE_ID_MEMBERREF)
+            return false;
+
+        u32 parentToken = getDLL()->decodeMemberRefParent(getDLL()->getMemberRefByMetadataToken(methodToken)->classIndex);
+        if (TABLE_ID(parentToken) != TABLE_ID_TYPESPEC)
+            return false;
+
+        auto typeSpec = getDLL()->getTypeSpecByIndex(TABLE_INDEX(parentToken));
+        return getDLL()->getBlob(typeSpec->signatureIndex)[0] == static_cast<u8>(SignatureElementType::Array);
+    }
+
+    u32 Method::resolveArrayAccessor(u32 methodToken) {
+        auto memberRef = getDLL()->getMemberRefByMetadataToken(methodToken);
+        auto arrayType = this->m_ctx.getMethodTable(resolveType(getDLL()->decodeMemberRefParent(memberRef->classIndex)));
+        std::string name = getDLL()->getString(memberRef->nameIndex);
+
+        ArrayAccessor accessor = { arrayType, ArrayAccessor::Kind::Get };
+        if (name == "Set") {
+            accessor.kind = ArrayAccessor::Kind::Set;
+        } else if (name == "Address") {
+            accessor.kind = ArrayAccessor::Kind::Address;
+        } else if (name == ".ctor") {
+            auto signature = SignatureReader(getDLL(), getDLL()->getBlob(memberRef->signatureIndex)).readMethodSignature();
+            accessor.kind = signature.parameters.size() == arrayType->rank ? ArrayAccessor::Kind::Construct : ArrayAccessor::Kind::ConstructWithLowerBounds;
+        } else if (name != "Get") {
+            Logger::error("Unknown method %s of array type %s!", name.c_str(), arrayType->name.c_str());
+            exit(1);
+        }
+
+        u32 index = this->m_ctx.arrayAccessors.size();
+        this->m_ctx.arrayAccessors.push_back(accessor);
+
+        return index;
+    }
+
+    // Returns false if the method isn't one provided by a multidimensional array type
+    bool Method::callArrayAccessor(u32 methodToken) {
+        if (!isArrayAccessor(methodToken))
+            return false;
+
+        if (!dependsOnGenericContext(methodToken)) {
+            quicken(OpcodePrefix::Call_array_q, resolveArrayAccessor(methodToken));
+            return true;
+        }
+
+        auto key = Context::getInstantiationKey(methodToken, this->m_genericContext);
+        if (!this->m_ctx.genericArrayAccessorIndices.contains(key))
+            this->m_ctx.genericArrayAccessorIndices[key] = resolveArrayAccessor(methodToken);
+
+        callArrayAccessor(this->m_ctx.arrayAccessors[this->m_ctx.genericArrayAccessorIndices[key]]);
+        return true;
+    }
+
+    void Method::callArrayAccessor(ArrayAccessor &accessor) {
+        if (accessor.kind == ArrayAccessor::Kind::Construct || accessor.kind == ArrayAccessor::Kind::ConstructWithLowerBounds) {
+            newMultiDimArray(accessor);
+            return;
+        }
+
+        switch (accessor.arrayType->rank) {
+            case 2:
+                accessMultiDimArray<2>(accessor);
+                break;
+            case 3:
+                accessMultiDimArray<3>(accessor);
+                break;
+            default:
+                accessMultiDimArray<0>(accessor);
+                break;
+        }
+    }
+
+    // Takes the array and its indices from the stack slots starting at arraySlot. A Rank of 0 reads the rank
+    // from the array type instead of having it unrolled
+    template<u32 Rank>
+    u8* Method::getMultiDimElementAddress(MethodTable *arrayType, u8 *arraySlot) {
+        auto array = *reinterpret_cast<u8**>(arraySlot);
+
+        if (array == nullptr) {
+            Logger::error("Tried to access an element of a null array!");
+            exit(1);
+        }
+
+        auto bounds = reinterpret_cast<ArrayBounds*>(array + ArrayDataOffset);
+        u32 rank = Rank != 0 ? Rank : arrayType->rank;
+
+        u64 offset = 0;
+        for (u32 dimension = 0; dimension < rank; dimension++) {
+            auto index = static_cast<u32>(*reinterpret_cast<s32*>(arraySlot + (dimension + 1) * Context::StackSlotSize) - bounds[dimension].lowerBound);
+
+            if (index >= static_cast<u32>(bounds[dimension].length)) {
+                Logger::error("Array index out of range in dimension %u of %s!", dimension, arrayType->name.c_str());
+                exit(1);
+            }
+
+            offset = offset * bounds[dimension].length + index;
+        }
+
+        return array + arrayType->dataOffset + offset * arrayType->elementSize;
+    }
+
+    template<u32 Rank>
+    void Method::accessMultiDimArray(ArrayAccessor &accessor) {
+        auto arrayType = accessor.arrayType;
+        u32 slots = (Rank != 0 ? Rank : arrayType->rank) + 1;
+
+        if (accessor.kind == ArrayAccessor::Kind::Set) {
+            // The array and the indices sit right below the value, however many slots that one takes up
+            u8 *address = getMultiDimElementAddress<Rank>(arrayType, this->m_ctx.peekValue() - slots * Context::StackSlotSize);
+
+            if (!arrayType->elementType->isValueType)
+                checkArrayStore(arrayType, *reinterpret_cast<u64*>(this->m_ctx.stackPointer - Context::StackSlotSize));
+
+            this->m_ctx.storeObjectValue(arrayType->elementStorageType, address, arrayType->elementSize);
+
+            this->m_ctx.stackPointer -= slots * Context::StackSlotSize;
+            this->m_ctx.typeStackPointer -= slots;
+            return;
+        }
+
+        u8 *arraySlot = this->m_ctx.stackPointer - slots * Context::StackSlotSize;
+        u8 *address = getMultiDimElementAddress<Rank>(arrayType, arraySlot);
+
+        this->m_ctx.stackPointer = arraySlot;
+        this->m_ctx.typeStackPointer -= slots;
+
+        if (accessor.kind == ArrayAccessor::Kind::Address)
+            this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(address));
+        else
+            this->m_ctx.loadValue(arrayType->elementStorageType, address, arrayType->elementSize);
+    }
+
+    void Method::newMultiDimArray(ArrayAccessor &accessor) {
+        auto arrayType = accessor.arrayType;
+        bool hasLowerBounds = accessor.kind == ArrayAccessor::Kind::ConstructWithLowerBounds;
+        u32 slots = arrayType->rank * (hasLowerBounds ? 2 : 1);
+
+        u8 *arguments = this->m_ctx.stackPointer - slots * Context::StackSlotSize;
+        std::vector<ArrayBounds> bounds(arrayType->rank);
+
+        u64 length = 1;
+        for (u32 dimension = 0; dimension < arrayType->rank; dimension++) {
+            auto argument = reinterpret_cast<s32*>(arguments + dimension * (hasLowerBounds ? 2 : 1) * Context::StackSlotSize);
+
+            bounds[dimension].lowerBound = hasLowerBounds ? argument[0] : 0;
+            bounds[dimension].length = hasLowerBounds ? argument[Context::StackSlotSize / sizeof(s32)] : argument[0];
+
+            if (bounds[dimension].length < 0) {
+                Logger::error("Tried to create an array with negative length %d in dimension %u!", bounds[dimension].length, dimension);
+                exit(1);
+            }
+
+            length *= bounds[dimension].length;
+        }
+
+        this->m_ctx.stackPointer = arguments;
+        this->m_ctx.typeStackPointer -= slots;
+
+        u8 *array = this->m_ctx.allocateArray(arrayType, length);
+        std::memcpy(array + ArrayDataOffset, bounds.data(), bounds.size() * sizeof(ArrayBounds));
+
+        this->m_ctx.push<u64>(Type::O, reinterpret_cast<u64>(array));
+    }
+
+    // Field instructions resolve their token on first execution and then rewrite themselves into a quickened
+    // form that carries the field offset, or an index into Context::resolvedFields, instead of the token.
+    // The program counter is moved back so the quickened instruction runs right away
+
+    ResolvedField Method::resolveFieldOperand(u32 fieldToken) {
+        u32 fieldIndex = 0;
+        const GenericContext *instantiation = nullptr;
+
+        if (TABLE_ID(fieldToken) == TABLE_ID_FIELD) {
+            fieldIndex = TABLE_INDEX(fieldToken);
+        } else if (TABLE_ID(fieldToken) == TABLE_ID_MEMBERREF) {
+            // Fields of generic types are always referenced through a MemberRef on the instantiated type
+            auto memberRef = getDLL()->getMemberRefByMetadataToken(fieldToken);
+            u32 parentToken = getDLL()->decodeMemberRefParent(memberRef->classIndex);
+            auto parent = TABLE_ID(parentToken) == TABLE_ID_TYPESPEC ? resolveType(parentToken) : TypeSignature { SignatureElementType::Class, parentToken };
+
+            if (TABLE_ID(parent.typeToken) == TABLE_ID_TYPEDEF)
+                fieldIndex = getDLL()->findFieldByName(TABLE_INDEX(parent.typeToken), getDLL()->getString(memberRef->nameIndex));
+
+            instantiation = this->m_ctx.getGenericContext(GenericContext { parent.typeArguments });
+        }
+
+        if (fieldIndex == 0) {
+            Logger::error("Cannot access external field %08x!", fieldToken);
+            exit(1);
+        }
+
+        auto field = getDLL()->getFieldByIndex(fieldIndex);
+        bool isStatic = (field->flags & FIELD_ATTRIBUTE_STATIC) != 0;
+        u32 typeIndex = getDLL()->findTypeDefWithField(fieldIndex);
+
+        if (instantiation == nullptr) {
+            auto type = SignatureReader(getDLL(), getDLL()->getBlob(field->signatureIndex)).readFieldSignature();
+            ResolvedField resolved = { fieldIndex, type.getStorageType(), getDLL()->getFieldOffset(fieldIndex), getDLL()->getTypeSize(type), nullptr, typeIndex, nullptr };
+
+            if (isStatic)
+                resolved.staticAddress = this->m_ctx.getStaticArea(typeIndex, getDLL()->getTypeLayout(typeIndex).staticSize) + resolved.offset;
+            else if (!getDLL()->isValueType(typeIndex))
+                resolved.offset += ObjectHeaderSize;
+
+            return resolved;
+        }
+
+        // Offsets and types depend on the type arguments, they come from the instantiation's layout
+        auto &layout = getDLL()->getTypeLayout(typeIndex, instantiation->typeArguments);
+        for (auto &fieldLayout : isStatic ? layout.staticFields : layout.fields) {
+            if (fieldLayout.fieldIndex != fieldIndex)
+                continue;
+
+            ResolvedField resolved = { fieldIndex, fieldLayout.type.getStorageType(), fieldLayout.offset, fieldLayout.size, nullptr, typeIndex, instantiation };
+
+            if (isStatic)
+                resolved.staticAddress = this->m_ctx.getStaticArea(typeIndex, layout.staticSize, instantiation) + resolved.offset;
+            else if (!getDLL()->isValueType(typeIndex))
+                resolved.offset += ObjectHeaderSize;
+
+            return resolved;
+        }
+
+        Logger::error("Field %08x is not part of its type's layout!", fieldToken);
+        exit(1);
+    }
+
+    u32 Method::resolveField(u32 fieldToken) {
+        auto &indices = this->m_ctx.resolvedFieldIndices;
+        auto &genericIndices = this->m_ctx.genericFieldIndices;
+        bool isGeneric = dependsOnGenericContext(fieldToken);
+        std::string key = isGeneric ? Context::getInstantiationKey(fieldToken, this->m_genericContext) : std::string();
+
+        if (!isGeneric) {
+            if (auto resolved = indices.find(fieldToken); resolved != indices.end())
+                return resolved->second;
+        } else if (auto resolved = genericIndices.find(key); resolved != genericIndices.end()) {
+            return resolved->second;
+        }
+
+        u32 index = this->m_ctx.resolvedFields.size();
+        this->m_ctx.resolvedFields.push_back(resolveFieldOperand(fieldToken));
+
+        if (isGeneric)
+            genericIndices[key] = index;
+        else
+            indices[fieldToken] = index;
+
+        return index;
+    }
+
+    void Method::quicken(OpcodePrefix opcode, u32 operand) {
+        this->m_programCounter -= sizeof(u8) + sizeof(u32);
+
+        this->m_programCounter[0] = static_cast<u8>(opcode);
+        *reinterpret_cast<u32*>(this->m_programCounter + 1) = operand;
+    }
+
+    // Two byte instructions are one byte longer than their quickened form, which gets a nop in front of it
+    void Method::quickenExtended(OpcodePrefix opcode, u32 operand) {
+        this->m_programCounter[-static_cast<s32>(sizeof(u16) + sizeof(u32))] = static_cast<u8>(OpcodePrefix::Nop);
+
+        quicken(opcode, operand);
+    }
+
+    u8* Method::popInstance() {
+        auto instance = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+
+        if (instance == nullptr) {
+            Logger::error("Tried to access a field of a null reference!");
+            exit(1);
+        }
+
+        return instance;
+    }
+
+    // ldfld also accepts the value type instance itself instead of a reference to it
+    void Method::ldfldFromValue(SignatureElementType type, u32 offset, u32 size) {
+        u32 valueSlots = this->m_ctx.getSlotCountOnStack();
+
+        this->m_ctx.loadValue(type, this->m_ctx.peekValue() + offset, size);
+        this->m_ctx.removeBelowTop(valueSlots);
+    }
+
+    // Fields of generic instantiations have a different offset and type in every one of them, code shared between
+    // instantiations accesses them without being quickened, just like their static fields
+
+    void Method::ldfld(u32 fieldToken) {
+        u32 index = resolveField(fieldToken);
+        auto &field = this->m_ctx.resolvedFields[index];
+
+        if (dependsOnGenericContext(fieldToken)) {
+            ldfld(field);
+            return;
+        }
+
+        if (this->m_ctx.fieldProfiling) {
+            quicken(OpcodePrefix::Ldfld_q, index);
+            return;
+        }
+
+        switch (field.type) {
+            case SignatureElementType::I4:
+            case SignatureElementType::U4:
+                quicken(OpcodePrefix::Ldfld_i4_q, field.offset);
+                break;
+            case SignatureElementType::I8:
+            case SignatureElementType::U8:
+                quicken(OpcodePrefix::Ldfld_i8_q, field.offset);
+                break;
+            case SignatureElementType::String:
+            case SignatureElementType::Class:
+            case SignatureElementType::Object:
+            case SignatureElementType::SzArray:
+            case SignatureElementType::Array:
+                quicken(OpcodePrefix::Ldfld_ref_q, field.offset);
+                break;
+            default:
+                quicken(OpcodePrefix::Ldfld_q, index);
+                break;
+        }
+    }
+
+    void Method::stfld(u32 fieldToken) {
+        u32 index = resolveField(fieldToken);
+        auto &field = this->m_ctx.resolvedFields[index];
+
+        if (dependsOnGenericContext(fieldToken)) {
+            stfld(field);
+            return;
+        }
+
+        if (this->m_ctx.fieldProfiling) {
+            quicken(OpcodePrefix::Stfld_q, index);
+            return;
+        }
+
+        switch (field.type) {
+            case SignatureElementType::I4:
+            case SignatureElementType::U4:
+                quicken(OpcodePrefix::Stfld_i4_q, field.offset);
+                break;
+            case SignatureElementType::I8:
+            case SignatureElementType::U8:
+                quicken(OpcodePrefix::Stfld_i8_q, field.offset);
+                break;
+            case SignatureElementType::String:
+            case SignatureElementType::Class:
+            case SignatureElementType::Object:
+            case SignatureElementType::SzArray:
+            case SignatureElementType::Array:
+                quicken(OpcodePrefix::Stfld_ref_q, field.offset);
+                break;
+            default:
+                quicken(OpcodePrefix::Stfld_q, index);
+                break;
+        }
+    }
+
+    void Method::ldflda(u32 fieldToken) {
+        auto &field = this->m_ctx.resolvedFields[resolveField(fieldToken)];
+
+        if (this->m_ctx.fieldProfiling || dependsOnGenericContext(fieldToken)) {
+            if (this->m_ctx.fieldProfiling)
+                countFieldAccess(field);
+
+            this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(popInstance() + field.offset));
+            return;
+        }
+
+        quicken(OpcodePrefix::Ldflda_q, field.offset);
+    }
+
+    void Method::ldfld(const ResolvedField &field) {
+        if (this->m_ctx.fieldProfiling)
+            countFieldAccess(field);
+
+        if (this->m_ctx.getTypeOnStack() == Type::ValueType)
+            ldfldFromValue(field.type, field.offset, field.size);
+        else
+            this->m_ctx.loadValue(field.type, popInstance() + field.offset, field.size);
+    }
+
+    void Method::stfld(const ResolvedField &field) {
+        if (this->m_ctx.fieldProfiling)
+            countFieldAccess(field);
+
+        // The instance sits right below the value, however many slots that one takes up
+        auto instance = *reinterpret_cast<u8**>(this->m_ctx.peekValue() - Context::StackSlotSize);
+
+        if (instance == nullptr) {
+            Logger::error("Tried to access a field of a null reference!");
+            exit(1);
+        }
+
+        this->m_ctx.storeObjectValue(field.type, instance + field.offset, field.size);
+        this->m_ctx.pop<u64>();
+    }
+
+    void Method::countFieldAccess(const ResolvedField &field) {
+        auto &counts = this->m_ctx.fieldAccessCounts;
+
+        if (counts.empty())
+            counts.resize(getDLL()->getNumTableRows(TABLE_ID_FIELD) + 1);
+
+        counts[field.fieldIndex]++;
+    }
+
+    // Static field instructions only get quickened once the declaring type's .cctor finished successfully,
+    // so the quickened forms never need to check for that again. Accesses from within a running .cctor stay
+    // unquickened, it might still throw. Static fields of generic instantiations live somewhere else for every
+    // instantiation, shared code accessing them can't be quickened either
+
+    bool Method::canQuickenStaticField(u32 fieldToken, const ResolvedField &field) {
+        return !dependsOnGenericContext(fieldToken) && getTypeInitialization(field.typeIndex, field.instantiation) == TypeInitialization::Done;
+    }
+
+    void Method::ldsfld(u32 fieldToken) {
+        u32 index = resolveField(fieldToken);
+        if (!initializeType(this->m_ctx.resolvedFields[index].typeIndex, this->m_ctx.resolvedFields[index].instantiation))
+            return;
+
+        auto &field = this->m_ctx.resolvedFields[index];
+
+        if (canQuickenStaticField(fieldToken, field))
+            quicken(OpcodePrefix::Ldsfld_q, index);
+        else
+            this->m_ctx.loadValue(field.type, field.staticAddress, field.size);
+    }
+
+    void Method::stsfld(u32 fieldToken) {
+        u32 index = resolveField(fieldToken);
+        if (!initializeType(this->m_ctx.resolvedFields[index].typeIndex, this->m_ctx.resolvedFields[index].instantiation))
+            return;
+
+        auto &field = this->m_ctx.resolvedFields[index];
+
+        if (canQuickenStaticField(fieldToken, field))
+            quicken(OpcodePrefix::Stsfld_q, index);
+        else
+            this->m_ctx.storeValue(field.type, field.staticAddress, field.size);
+    }
+
+    void Method::ldsflda(u32 fieldToken) {
+        u32 index = resolveField(fieldToken);
+        if (!initializeType(this->m_ctx.resolvedFields[index].typeIndex, this->m_ctx.resolvedFields[index].instantiation))
+            return;
+
+        auto &field = this->m_ctx.resolvedFields[index];
+
+        if (canQuickenStaticField(fieldToken, field))
+            quicken(OpcodePrefix::Ldsflda_q, index);
+        else
+            this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(field.staticAddress));
+    }
+
+    TypeInitialization& Method::getTypeInitialization(u32 typeDefIndex, const GenericContext *instantiation) {
+        if (instantiation != nullptr)
+            return this->m_ctx.genericTypeInitializations[Context::getInstantiationKey(typeDefIndex, *instantiation)];
+
+        return this->m_ctx.typeInitializations[typeDefIndex];
+    }
+
+    // Runs the .cctor of a type the first time it's needed. Accesses from within a running .cctor see the
+    // type as initialized already. Returns false if the .cctor threw, the exception is left pending then.
+    // It's thrown again by every later use of the type, which never gets to see its half initialized statics.
+    // Every instantiation of a generic type is initialized separately
+    bool Method::initializeType(u32 typeDefIndex, const GenericContext *instantiation) {
+        auto &state = getTypeInitialization(typeDefIndex, instantiation);
+        auto key = Context::getInstantiationKey(typeDefIndex, instantiation != nullptr ? *instantiation : GenericContext { });
+
+        if (state == TypeInitialization::Failed) {
+            this->m_ctx.exception = this->m_ctx.typeInitializationErrors[key];
+            this->m_ctx.exceptionPending = true;
+
+            return false;
+        }
+
+        if (state != TypeInitialization::Pending)
+            return true;
+
+        state = TypeInitialization::Running;
+
+        u32 classConstructor = getDLL()->findMethodByName(typeDefIndex, ".cctor");
+        if (classConstructor != 0) {
+            Logger::debug("Running class constructor of type %u", typeDefIndex);
+            call(classConstructor, instantiation);
+        }
+
+        if (this->m_ctx.exceptionPending) {
+            state = TypeInitialization::Failed;
+            this->m_ctx.typeInitializationErrors[key] = this->m_ctx.exception;
+
+            return false;
+        }
+
+        state = TypeInitialization::Done;
+
+        return true;
+    }
+
+    void Method::initobj(u32 typeToken) {
+        auto address = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+        u32 size = getDLL()->getTypeSize(resolveType(typeToken));
+
+        this->m_ctx.heap.preWriteBarrierRange(address, size);
+        std::memset(address, 0x00, size);
+    }
+
+    void Method::ldobj(u32 typeToken) {
+        auto address = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+        auto type = resolveType(typeToken);
+
+        if (address == nullptr) {
+            Logger::error("Tried to load an object through a null pointer!");
+            exit(1);
+        }
+
+        this->m_ctx.loadValue(type.getStorageType(), address, getDLL()->getTypeSize(type));
+    }
+
+    void Method::stobj(u32 typeToken) {
+        auto type = resolveType(typeToken);
+
+        // The destination address sits right below the value, however many slots that one takes up
+        auto address = *reinterpret_cast<u8**>(this->m_ctx.peekValue() - Context::StackSlotSize);
+
+        if (address == nullptr) {
+            Logger::error("Tried to store an object through a null pointer!");
+            exit(1);
+        }
+
+        this->m_ctx.storeObjectValue(type.getStorageType(), address, getDLL()->getTypeSize(type));
+        this->m_ctx.pop<u64>();
+    }
+
+    void Method::cpobj(u32 typeToken) {
+        auto source = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+        auto destination = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+        u32 size = getDLL()->getTypeSize(resolveType(typeToken));
+
+        this->m_ctx.heap.preWriteBarrierRange(destination, size);
+        Memory::copyValue(destination, source, size);
+        this->m_ctx.heap.writeBarrierRange(destination, size);
+    }
+
+    u32 Method::resolveTypeCheck(u32 typeToken) {
+        u32 index = this->m_ctx.typeChecks.size();
+        this->m_ctx.typeChecks.push_back({ this->m_ctx.getMethodTable(resolveType(typeToken)), nullptr });
+
+        return index;
+    }
+
+    // Classes are tested through the instance's type display, interfaces through the site's last hit
+    bool Method::isInstanceOf(TypeCheck &check, u64 object) {
+        auto methodTable = this->m_ctx.getMethodTableOf(object);
+
+        // Array types are covariant and don't fit into type displays
+        if (check.type->elementType != nullptr)
+            return methodTable->isAssignableTo(check.type);
+
+        if (!check.type->isInterface)
+            return methodTable->isSubclassOf(check.type);
+
+        if (methodTable == check.lastHit)
+            return true;
+
+        if (!methodTable->implements(check.type))
+            return false;
+
+        check.lastHit = methodTable;
+        return true;
+    }
+
+    // Checks against type parameters get a TypeCheck per instantiation of the code and are never quickened
+
+    void Method::castclass(u32 typeToken) {
+        if (!dependsOnGenericContext(typeToken)) {
+            quicken(OpcodePrefix::Castclass_q, resolveTypeCheck(typeToken));
+            return;
+        }
+
+        auto key = Context::getInstantiationKey(typeToken, this->m_genericContext);
+        if (!this->m_ctx.genericTypeCheckIndices.contains(key))
+            this->m_ctx.genericTypeCheckIndices[key] = resolveTypeCheck(typeToken);
+
+        castclass(this->m_ctx.typeChecks[this->m_ctx.genericTypeCheckIndices[key]]);
+    }
+
+    void Method::isinst(u32 typeToken) {
+        if (!dependsOnGenericContext(typeToken)) {
+            quicken(OpcodePrefix::Isinst_q, resolveTypeCheck(typeToken));
+            return;
+        }
+
+        auto key = Context::getInstantiationKey(typeToken, this->m_genericContext);
+        if (!this->m_ctx.genericTypeCheckIndices.contains(key))
+            this->m_ctx.genericTypeCheckIndices[key] = resolveTypeCheck(typeToken);
+
+        isinst(this->m_ctx.typeChecks[this->m_ctx.genericTypeCheckIndices[key]]);
+    }
+
+    void Method::castclass(TypeCheck &check) {
+        auto object = *reinterpret_cast<u64*>(this->m_ctx.stackPointer - Context::StackSlotSize);
+
+        if (object != 0 && !isInstanceOf(check, object)) {
+            Logger::error("Unable to cast object of type %s to type %s!", this->m_ctx.getMethodTableOf(object)->name.c_str(), check.type->name.c_str());
+            exit(1);
+        }
+    }
+
+    void Method::isinst(TypeCheck &check) {
+        auto object = reinterpret_cast<u64*>(this->m_ctx.stackPointer - Context::StackSlotSize);
+
+        if (*object != 0 && !isInstanceOf(check, *object))
+            *object = 0;
+    }
+
+    void Method::box(u32 typeToken) {
+        auto type = resolveType(typeToken);
+
+        // Boxing a reference type does nothing
+        if (!type.isValueType())
+            return;
+
+        if (type.elementType == SignatureElementType::I4) {
+            s32 value = *reinterpret_cast<s32*>(this->m_ctx.stackPointer - Context::StackSlotSize);
+
+            if (value >= Context::BoxCacheMin && value <= Context::BoxCacheMax) {
+                this->m_ctx.pop<s32>();
+                this->m_ctx.push<u64>(Type::O, this->m_ctx.boxedInt32Cache[value - Context::BoxCacheMin]);
+                return;
+            }
+        } else if (type.elementType == SignatureElementType::Boolean) {
+            s32 value = this->m_ctx.pop<s32>();
+            this->m_ctx.push<u64>(Type::O, this->m_ctx.boxedBooleanCache[value != 0]);
+            return;
+        }
+
+        u8 *object = this->m_ctx.allocateObject(this->m_ctx.getMethodTable(type));
+
+        this->m_ctx.storeValue(type.getStorageType(), object + ObjectHeaderSize, getDLL()->getTypeSize(type));
+        this->m_ctx.push<u64>(Type::O, reinterpret_cast<u64>(object));
+    }
+
+    void Method::unbox(u32 typeToken) {
+        auto object = this->m_ctx.pop<u64>();
+
+        if (object == 0) {
+            Logger::error("Tried to unbox a null reference!");
+            exit(1);
+        }
+
+        // The value is stored right after the object header
+        this->m_ctx.push<u64>(Type::Pointer, object + ObjectHeaderSize);
+    }
+
+    void Method::unboxAny(u32 typeToken) {
+        auto type = resolveType(typeToken);
+
+        // On reference types this is a castclass, which leaves the reference as it is
+        if (!type.isValueType())
+            return;
+
+        auto object = reinterpret_cast<u8*>(this->m_ctx.pop<u64>());
+
+        if (object == nullptr) {
+            Logger::error("Tried to unbox a null reference!");
+            exit(1);
+        }
+
+        this->m_ctx.loadValue(type.getStorageType(), object + ObjectHeaderSize, getDLL()->getTypeSize(type));
+    }
+
+    void Method::sizeOf(u32 typeToken) {
+        this->m_ctx.push<s32>(Type::Int32, getDLL()->getTypeSize(resolveType(typeToken)));
+    }
+
+    template<typename T>
+    void Method::ldc(Type type, T num) {
+        this->m_ctx.push(type, num);
+    }
+
+    void Method::ret() {
+        if (this->m_ctx.typeStackPointer == this->m_frame.typeStackBase) {
+            releaseFrame();
+            return;
+        }
+
+        // Move the return value down to where this frame started so the caller finds it on top of its own stack
+        u32 slots = this->m_ctx.getSlotCountOnStack();
+
+        std::memmove(this->m_frame.arguments, this->m_ctx.stackPointer - slots * Context::StackSlotSize, slots * Context::StackSlotSize);
+        std::memmove(this->m_frame.typeFrameBase, this->m_ctx.typeStackPointer - slots, slots * sizeof(Type));
+
+        this->m_ctx.stackPointer = this->m_frame.arguments + slots * Context::StackSlotSize;
+        this->m_ctx.typeStackPointer = this->m_frame.typeFrameBase + slots;
+    }
+
+    void Method::newobj(u32 constructorToken) {
+        const GenericContext *genericContext;
+        constructorToken = resolveMethod(constructorToken, genericContext);
+
+        auto methodTable = getDeclaringType(constructorToken, genericContext);
+
+        // Delegate constructors have no body, the runtime sets up the delegate itself
+        if (methodTable != nullptr && methodTable->isDelegate) {
+            newDelegate(methodTable);
+            return;
+        }
+
+        if (TABLE_ID(constructorToken) != TABLE_ID_METHODDEF) {
+            Logger::error("Cannot construct instances of external types (%08x)!", constructorToken);
+            exit(1);
+        }
+
+        auto &constructor = this->m_ctx.getMethodBody(constructorToken, genericContext);
+        u32 argumentSlots = constructor.argumentsSize / Context::StackSlotSize - 1;
+
+        Logger::debug("Creating instance of Type %u", constructor.ownerTypeIndex);
+
+        if (methodTable->isValueType) {
+            // Value types are constructed in place on the evaluation stack, below the constructor's arguments.
+            // The constructor gets a pointer to them as its 'this' and the value stays behind once it returned
+            u32 valueSlots = Context::getSlotCount(methodTable->instanceSize - ObjectHeaderSize);
+
+            u8 *value = this->m_ctx.reserve(argumentSlots, valueSlots + 1);
+            *reinterpret_cast<u64*>(value + valueSlots * Context::StackSlotSize) = reinterpret_cast<u64>(value);
+
+            this->m_ctx.setTypeOnStack(argumentSlots, Type::Pointer);
+            this->m_ctx.setTypeOnStack(argumentSlots + 1, Type::ValueType);
+            for (u32 i = 2; i <= valueSlots; i++)
+                this->m_ctx.setTypeOnStack(argumentSlots + i, Type::ValueTypePart);
+
+            call(constructorToken, genericContext);
+        } else {
+            u8 *newMemory = this->m_ctx.allocateObject(methodTable);
+
+            // The new object becomes the constructor's 'this', below all of its other arguments. A second reference
+            // below that one stays behind once the constructor returned, the collector keeps it up to date if the
+            // object moves in the meantime
+            auto slots = reinterpret_cast<u64*>(this->m_ctx.reserve(argumentSlots, 2));
+            slots[0] = slots[1] = reinterpret_cast<u64>(newMemory);
+            this->m_ctx.setTypeOnStack(argumentSlots, Type::O);
+            this->m_ctx.setTypeOnStack(argumentSlots + 1, Type::O);
+
+            call(constructorToken, genericContext);
+        }
+    }
+
+    // Delegates. ldftn and ldvirtftn push a MethodEntry which the delegate constructor stores along with the target.
+    // Invoke then calls that entry directly
+
+    u32 Method::resolveMethodEntry(u32 methodToken, const GenericContext *genericContext) {
+        auto key = Context::getInstantiationKey(methodToken, genericContext);
+        if (auto index = this->m_ctx.methodEntryIndices.find(key); index != this->m_ctx.methodEntryIndices.end())
+            return index->second;
+
+        MethodEntry entry = { methodToken, genericContext, false, false };
+
+        if (TABLE_ID(methodToken) == TABLE_ID_METHODDEF) {
+            entry.isStatic = (getDLL()->getMethodDefByMetadataToken(methodToken)->flags & METHOD_ATTRIBUTE_STATIC) != 0;
+            entry.isValueTypeMethod = !entry.isStatic && getDLL()->isValueType(getDLL()->findTypeDefWithMethod(methodToken));
+        } else {
+            auto memberRef = getDLL()->getMemberRefByMetadataToken(methodToken);
+            entry.isStatic = !SignatureReader(getDLL(), getDLL()->getBlob(memberRef->signatureIndex)).readMethodSignature().hasThis;
+        }
+
+        u32 index = this->m_ctx.methodEntries.size();
+        this->m_ctx.methodEntries.push_back(entry);
+        this->m_ctx.methodEntryIndices[key] = index;
+
+        return index;
+    }
+
+    void Method::ldftn(u32 methodToken) {
+        const GenericContext *genericContext;
+        u32 method = resolveMethod(methodToken, genericContext);
+        u32 index = resolveMethodEntry(method, genericContext);
+
+        if (dependsOnGenericContext(methodToken))
+            this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(&this->m_ctx.methodEntries[index]));
+        else
+            quickenExtended(OpcodePrefix::Ldftn_q, index);
+    }
+
+    void Method::ldvirtftn(u32 methodToken) {
+        if (dependsOnGenericContext(methodToken))
+            ldvirtftn(this->m_ctx.virtualCalls[resolveGenericVirtualCall(methodToken)]);
+        else
+            quickenExtended(OpcodePrefix::Ldvirtftn_q, resolveVirtualCall(methodToken));
+    }
+
+    void Method::ldvirtftn(VirtualCall &site) {
+        u64 object = this->m_ctx.pop<u64>();
+
+        if (object == 0) {
+            Logger::error("Tried to load a virtual function of a null reference!");
+            exit(1);
+        }
+
+        InlineCacheEntry entry = { nullptr, site.methodToken, site.genericContext };
+        if (site.isDispatched() && (TABLE_ID(site.methodToken) == TABLE_ID_METHODDEF || this->m_ctx.isHeapObject(object)))
+            entry = lookupInlineCache(site, this->m_ctx.getMethodTableOf(object));
+
+        u32 index = resolveMethodEntry(entry.target, entry.genericContext);
+        this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(&this->m_ctx.methodEntries[index]));
+    }
+
+    // Delegate constructors take the target and the MethodEntry pushed by ldftn or ldvirtftn
+    void Method::newDelegate(MethodTable *delegateType) {
+        auto entry = reinterpret_cast<const MethodEntry*>(this->m_ctx.pop<u64>());
+        u64 target = this->m_ctx.pop<u64>();
+
+        if (entry == nullptr) {
+            Logger::error("Tried to create a %s without a method!", delegateType->name.c_str());
+            exit(1);
+        }
+
+        u8 *object = this->m_ctx.allocateObject(delegateType);
+
+        auto &data = *reinterpret_cast<DelegateData*>(object + ObjectHeaderSize);
+        data.target = target;
+        data.entry = entry;
+
+        this->m_ctx.push<u64>(Type::O, reinterpret_cast<u64>(object));
+    }
+
+    // Multicast delegates call all but their last target on a copy of the arguments and drop what those return
+    void Method::invokeDelegate(u32 thisDepth, u8 *thisSlot) {
+        u64 delegate = *reinterpret_cast<u64*>(thisSlot);
+
+        if (delegate == 0) {
+            Logger::error("Tried to invoke a null delegate!");
+            exit(1);
+        }
+
+        u64 invocationCount = reinterpret_cast<DelegateData*>(delegate + ObjectHeaderSize)->invocationCount;
+        if (invocationCount == 0) {
+            invokeDelegateTarget(delegate, thisDepth, thisSlot);
+            return;
+        }
+
+        // The targets may move the delegate, it's read from its slot again for every one of them
+        auto getData = [thisSlot]() -> DelegateData& {
+            return *reinterpret_cast<DelegateData*>(*reinterpret_cast<u64*>(thisSlot) + ObjectHeaderSize);
+        };
+
+        u32 slots = thisDepth + 1;
+        for (u64 i = 0; i + 1 < invocationCount; i++) {
+            u8 *stackEnd = this->m_ctx.stackPointer;
+            Type *typeStackEnd = this->m_ctx.typeStackPointer;
+
+            std::memcpy(stackEnd, thisSlot, slots * Context::StackSlotSize);
+            std::memcpy(typeStackEnd, typeStackEnd - slots, slots * sizeof(Type));
+            this->m_ctx.stackPointer += slots * Context::StackSlotSize;
+            this->m_ctx.typeStackPointer += slots;
+
+            invokeDelegateTarget(getData().getInvocationList()[i], thisDepth, stackEnd);
+
+            if (this->m_ctx.exceptionPending)
+                return;
+
+            this->m_ctx.stackPointer = stackEnd;
+            this->m_ctx.typeStackPointer = typeStackEnd;
+        }
+
+        invokeDelegateTarget(getData().getInvocationList()[invocationCount - 1], thisDepth, thisSlot);
+    }
+
+    // Replaces the delegate in the 'this' slot by whatever the target method expects there and calls it
+    void Method::invokeDelegateTarget(u64 delegate, u32 thisDepth, u8 *thisSlot) {
+        auto &data = *reinterpret_cast<DelegateData*>(delegate + ObjectHeaderSize);
+
+        if (data.entry->isStatic && data.target == 0) {
+            // Static methods not closed over their first argument don't get one, the others move down to take its place
+            std::memmove(thisSlot, thisSlot + Context::StackSlotSize, thisDepth * Context::StackSlotSize);
+            std::memmove(this->m_ctx.typeStackPointer - thisDepth - 1, this->m_ctx.typeStackPointer - thisDepth, thisDepth * sizeof(Type));
+
+            this->m_ctx.stackPointer -= Context::StackSlotSize;
+            this->m_ctx.typeStackPointer--;
+        } else if (data.entry->isValueTypeMethod) {
+            *reinterpret_cast<u64*>(thisSlot) = data.target + ObjectHeaderSize;
+            this->m_ctx.setTypeOnStack(thisDepth, Type::Pointer);
+        } else {
+            *reinterpret_cast<u64*>(thisSlot) = data.target;
+            this->m_ctx.setTypeOnStack(thisDepth, Type::O);
+        }
+
+        call(data.entry->methodToken, data.entry->genericContext);
+    }
+
+    // Reflection. Type handles are the type's MethodTable and method handles its MethodEntry. Nothing
+    // consumes field handles yet, they are the field's token
+
+    u32 Method::resolveTokenType(u32 typeToken) {
+        u32 index = this->m_ctx.tokenTypes.size();
+        this->m_ctx.tokenTypes.push_back(this->m_ctx.getMethodTable(resolveType(typeToken)));
+
+        return index;
+    }
+
+    void Method::ldtoken(u32 token) {
+        switch (TABLE_ID(token)) {
+            case TABLE_ID_TYPEDEF:
+            case TABLE_ID_TYPEREF:
+            case TABLE_ID_TYPESPEC:
+                if (!dependsOnGenericContext(token)) {
+                    quicken(OpcodePrefix::Ldtoken_q, resolveTokenType(token));
+                    return;
+                }
+
+                this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(this->m_ctx.getMethodTable(resolveType(token))));
+                break;
+            case TABLE_ID_MEMBERREF:
+                if (getDLL()->getBlob(getDLL()->getMemberRefByMetadataToken(token)->signatureIndex)[0] == SIGNATURE_FIELD) {
+                    this->m_ctx.push<u64>(Type::Native_int, token);
+                    break;
+                }
+                [[fallthrough]];
+            case TABLE_ID_METHODDEF:
+            case TABLE_ID_METHODSPEC: {
+                const GenericContext *genericContext;
+                u32 method = resolveMethod(token, genericContext);
+
+                this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(&this->m_ctx.methodEntries[resolveMethodEntry(method, genericContext)]));
+                break;
+            }
+            case TABLE_ID_FIELD:
+                this->m_ctx.push<u64>(Type::Native_int, token);
+                break;
+            default:
+                Logger::error("Invalid ldtoken operand %08x!", token);
+                exit(1);
+        }
+    }
+
+    // typeof(T) pushes the type's System.Type object right away instead of going through its handle
+    void Method::ldtype(u32 typeToken) {
+        if (!dependsOnGenericContext(typeToken)) {
+            quicken(OpcodePrefix::Ldtype_q, resolveTokenType(typeToken));
+            return;
+        }
+
+        this->m_ctx.push<u64>(Type::O, this->m_ctx.getRuntimeType(this->m_ctx.getMethodTable(resolveType(typeToken))));
+    }
+
+    void Method::mkrefany(u32 typeToken) {
+        TypedReference reference = { reinterpret_cast<u8*>(this->m_ctx.pop<u64>()), this->m_ctx.getMethodTable(resolveType(typeToken)) };
+
+        this->m_ctx.pushValue(&reference, sizeof(TypedReference));
+    }
+
+    void Method::refanyval(u32 typeToken) {
+        TypedReference reference;
+        this->m_ctx.popValue(&reference, sizeof(TypedReference));
+
+        auto type = this->m_ctx.getMethodTable(resolveType(typeToken));
+        if (reference.type != type) {
+            Logger::error("Typed reference to %s is not a reference to %s!", reference.type->name.c_str(), type->name.c_str());
+            exit(1);
+        }
+
+        this->m_ctx.push<u64>(Type::Pointer, reinterpret_cast<u64>(reference.address));
+    }
+
+    void Method::refanytype() {
+        TypedReference reference;
+        this->m_ctx.popValue(&reference, sizeof(TypedReference));
+
+        this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(reference.type));
+    }
+
+    void Method::localloc(u64 size) {
+        // The evaluation stack has to be empty apart from the size operand, so the new region is carved out
+        // right at the stack pointer and the evaluation stack of this frame continues above it until ret
+        u8 *region = reinterpret_cast<u8*>((reinterpret_cast<u64>(this->m_ctx.stackPointer) + 15) & ~15ULL);
+        u8 *regionEnd = region + ((size + 15) & ~15ULL);
+
+        if (regionEnd > this->m_ctx.stack + getDLL()->getStackSize()) {
+            Logger::error("Stack overflow while allocating %llu bytes on the stack!", size);
+            exit(1);
+        }
+
+        if (this->m_body->initLocals)
+            Memory::fill(region, 0x00, size);
+
+        Logger::debug("Allocated %llu bytes on the stack at %p", size, region);
+
+        this->m_ctx.stackPointer = regionEnd;
+        this->m_frame.stackBase = regionEnd;
+
+        this->m_ctx.push<u64>(Type::Native_int, reinterpret_cast<u64>(region));
+    }
+
+    // Blocks may lie inside old objects and copy references along, so they are treated like stores of value types
+    void Method::cpblk() {
+        u64 size = this->m_ctx.pop<u64>();
+        u64 source = this->m_ctx.pop<u64>();
+        u64 destination = this->m_ctx.pop<u64>();
+
+        this->m_ctx.heap.preWriteBarrierRange(reinterpret_cast<void*>(destination), size);
+        Memory::copy(reinterpret_cast<void*>(destination), reinterpret_cast<void*>(source), size);
+        this->m_ctx.heap.writeBarrierRange(reinterpret_cast<void*>(destination), size);
+    }
+
+    void Method::initblk() {
+        u64 size = this->m_ctx.pop<u64>();
+        u8 value = this->m_ctx.pop<u64>();
+        u64 address = this->m_ctx.pop<u64>();
+
+        this->m_ctx.heap.preWriteBarrierRange(reinterpret_cast<void*>(address), size);
+        Memory::fill(reinterpret_cast<void*>(address), value, size);
+        this->m_ctx.heap.writeBarrierRange(reinterpret_cast<void*>(address), size);
+    }
+
+    void Method::leave(u32 target) {
+        u32 offset = getCurrentOffset();
+
+        suspendUnwinding();
+
+        // Every finally whose try region is exited by this jump needs to run first, innermost first
+        for (u32 i = 0; i < this->m_body->exceptionClauses.size(); i++) {
+            auto &clause = this->m_body->exceptionClauses[i];
+
+            if (clause.type == ExceptionClauseType::Finally && clause.tryContains(offset) && !clause.tryContains(target))
+                this->m_pendingFinallies.push_back(i);
+        }
+
+        resetEvaluationStack();
+
+        this->m_continuation = Continuation::Leave;
+        this->m_continuationTarget = target;
+
+        continueUnwinding();
+    }
+
+    bool Method::endfinally() {
+        return continueUnwinding();
+    }
+
+    bool Method::endfilter() {
+        auto &clause = this->m_body->exceptionClauses[this->m_filterClause];
+
+        if (this->m_ctx.pop<s32>() != 0) {
+            this->m_continuation = Continuation::Catch;
+            this->m_continuationTarget = this->m_filterClause;
+
+            return continueUnwinding();
+        }
+
+        Logger::debug("Exception filter at %04x rejected the exception", clause.filterStart);
+
+        return dispatchException(this->m_filterClause + 1);
+    }
+
+    u32 Method::getArgumentSlots(const MethodSignature &signature) {
+        u32 slots = 0;
+
+        for (auto &parameter : signature.parameters)
+            slots += Context::getSlotCount(getDLL()->getTypeSize(parameter));
+
+        return slots;
+    }
+
+    // MethodTable of the type declaring a method, nullptr if there is none
+    MethodTable* Method::getDeclaringType(u32 methodToken, const GenericContext *genericContext) {
+        if (TABLE_ID(methodToken) == TABLE_ID_METHODDEF) {
+            u32 typeDefIndex = getDLL()->findTypeDefWithMethod(methodToken);
+
+            if (genericContext == nullptr || genericContext->typeArguments.empty())
+                return this->m_ctx.getMethodTable(typeDefIndex);
+
+            return this->m_ctx.getMethodTable(TypeSignature { SignatureElementType::GenericInst, (TABLE_ID_TYPEDEF << 24) | typeDefIndex, SignatureElementType::Class, genericContext->typeArguments });
+        }
+
+        if (TABLE_ID(methodToken) == TABLE_ID_MEMBERREF) {
+            u32 parentToken = getDLL()->decodeMemberRefParent(getDLL()->getMemberRefByMetadataToken(methodToken)->classIndex);
+
+            if (TABLE_ID(parentToken) == TABLE_ID_TYPESPEC)
+                return this->m_ctx.getMethodTable(resolveType(parentToken));
+            if (TABLE_ID(parentToken) == TABLE_ID_TYPEDEF || TABLE_ID(parentToken) == TABLE_ID_TYPEREF)
+                return this->m_ctx.getMethodTable(TypeSignature { SignatureElementType::Class, parentToken });
+        }
+
+        return nullptr;
+    }
+
+    // callvirt resolves its method token once and is then quickened into a plain vtable lookup
+    u32 Method::resolveVirtualCall(u32 methodToken) {
+        VirtualCall site;
+        site.methodToken = resolveMethod(methodToken, site.genericContext);
+
+        const char *name;
+        u32 signatureIndex;
+        if (TABLE_ID(site.methodToken) == TABLE_ID_METHODDEF) {
+            auto methodDef = getDLL()->getMethodDefByMetadataToken(site.methodToken);
+            name = getDLL()->getString(methodDef->nameIndex);
+            signatureIndex = methodDef->signatureIndex;
+        } else if (TABLE_ID(site.methodToken) == TABLE_ID_MEMBERREF) {
+            auto memberRef = getDLL()->getMemberRefByMetadataToken(site.methodToken);
+            name = getDLL()->getString(memberRef->nameIndex);
+            signatureIndex = memberRef->signatureIndex;
+        } else {
+            Logger::error("Unsupported callvirt target %08x!", methodToken);
+            exit(1);
+        }
+
+        auto signature = SignatureReader(getDLL(), getDLL()->getBlob(signatureIndex)).readMethodSignature();
+        site.thisDepth = getArgumentSlots(site.genericContext != nullptr ? site.genericContext->substitute(signature) : signature);
+
+        // Building the declaring type's MethodTable assigns its virtual methods their slots. All instantiations of
+        // a generic type use the same slots
+        auto declaringType = getDeclaringType(site.methodToken, site.genericContext);
+
+        if (declaringType != nullptr && declaringType->isDelegate && std::strcmp(name, "Invoke") == 0) {
+            site.isDelegateInvoke = true;
+        } else if (TABLE_ID(site.methodToken) == TABLE_ID_METHODDEF) {
+            site.hasGenericOwner = site.genericContext != nullptr && !site.genericContext->typeArguments.empty();
+
+            if (declaringType->isInterface)
+                site.interfaceMethodId = this->m_ctx.getInterfaceMethodId(site.methodToken);
+            else if ((getDLL()->getMethodDefByMetadataToken(site.methodToken)->flags & METHOD_ATTRIBUTE_VIRTUAL) != 0)
+                site.slot = this->m_ctx.vtableSlots[site.methodToken];
+        } else {
+            site.interfaceMethodId = this->m_ctx.getInterfaceMethodId(site.methodToken);
+        }
+
+        u32 index = this->m_ctx.virtualCalls.size();
+        this->m_ctx.virtualCalls.push_back(site);
+
+        return index;
+    }
+
+    // Methods of generic instances and generic methods called with type parameters of the caller need a call site
+    // per instantiation of the caller, their target and argument sizes differ between them
+    u32 Method::resolveGenericVirtualCall(u32 methodToken) {
+        auto key = Context::getInstantiationKey(methodToken, this->m_genericContext);
+        if (!this->m_ctx.genericVirtualCallIndices.contains(key))
+            this->m_ctx.genericVirtualCallIndices[key] = resolveVirtualCall(methodToken);
+
+        return this->m_ctx.genericVirtualCallIndices[key];
+    }
+
+    void Method::callvirt(u32 methodToken) {
+        if (dependsOnGenericContext(methodToken))
+            callvirt(this->m_ctx.virtualCalls[resolveGenericVirtualCall(methodToken)]);
+        else
+            quicken(OpcodePrefix::Callvirt_q, resolveVirtualCall(methodToken));
+    }
+
+    void Method::callvirt(VirtualCall &site) {
+        u8 *thisSlot = this->m_ctx.stackPointer - (site.thisDepth + 1) * Context::StackSlotSize;
+
+        if (site.isDelegateInvoke) {
+            invokeDelegate(site.thisDepth, thisSlot);
+            return;
+        }
+
+        if (this->m_constrainedType != 0 && constrainedCallvirt(site, thisSlot))
+            return;
+
+        auto instance = *reinterpret_cast<ObjectHeader**>(thisSlot);
+
+        if (instance == nullptr) {
+            Logger::error("Tried to call a method on a null reference!");
+            exit(1);
+        }
+
+        // Things like user strings have no header to dispatch on
+        if (site.isDispatched() && (TABLE_ID(site.methodToken) == TABLE_ID_METHODDEF || this->m_ctx.isHeapObject(reinterpret_cast<u64>(instance)))) {
+            auto entry = lookupInlineCache(site, instance->methodTable);
+            call(entry.target, entry.genericContext);
+        } else {
+            call(site.methodToken, site.genericContext);
+        }
+    }
+
+    // With a constrained. prefix 'this' is a managed pointer. Reference types get dereferenced, value types that
+    // implement the method themselves get it called on the pointer directly and all others are boxed.
+    // Returns true if the call was made already
+    bool Method::constrainedCallvirt(VirtualCall &site, u8 *thisSlot) {
+        auto type = resolveType(this->m_constrainedType);
+        auto address = *reinterpret_cast<u8**>(thisSlot);
+        this->m_constrainedType = 0;
+
+        if (!type.isValueType()) {
+            *reinterpret_cast<u64*>(thisSlot) = *reinterpret_cast<u64*>(address);
+            this->m_ctx.setTypeOnStack(site.thisDepth, Type::O);
+            return false;
+        }
+
+        auto methodTable = this->m_ctx.getMethodTable(type);
+        InlineCacheEntry entry = { methodTable, site.methodToken, site.genericContext };
+        if (site.isDispatched())
+            entry = findVirtualCallTarget(site, methodTable);
+
+        if (TABLE_ID(entry.target) == TABLE_ID_METHODDEF && TABLE_ID(type.typeToken) == TABLE_ID_TYPEDEF
+            && getDLL()->findTypeDefWithMethod(entry.target) == TABLE_INDEX(type.typeToken)) {
+            call(entry.target, entry.genericContext);
+            return true;
+        }
+
+        u8 *object = this->m_ctx.allocateObject(methodTable);
+        Memory::copyValue(object + ObjectHeaderSize, address, getDLL()->getTypeSize(type));
+
+        *reinterpret_cast<u64*>(thisSlot) = reinterpret_cast<u64>(object);
+        this->m_ctx.setTypeOnStack(site.thisDepth, Type::O);
+
+        return false;
+    }
+
+    // Methods of other assemblies have no slot, an override of one is found by name and signature instead
+    u32 Method::findOverride(MethodTable *methodTable, u32 methodToken) {
+        for (u32 slot = methodTable->vtable.size(); slot > 0; slot--) {
+            if (getDLL()->hasSameNameAndSignature(methodTable->vtable[slot - 1], methodToken))
+                return methodTable->vtable[slot - 1];
+        }
+
+        return methodToken;
+    }
+
+    // Methods of generic types run with the type arguments the instance's type gave their declaring type,
+    // generic methods additionally with the method arguments of the call site
+    const GenericContext* Method::getTargetContext(const VirtualCall &site, MethodTable *methodTable, u32 target) {
+        if (TABLE_ID(target) != TABLE_ID_METHODDEF)
+            return nullptr;
+
+        auto typeContext = methodTable->getInstantiationOf(getDLL()->findTypeDefWithMethod(target));
+        if (site.genericContext == nullptr || site.genericContext->methodArguments.empty())
+            return typeContext;
+
+        GenericContext context = { { }, site.genericContext->methodArguments };
+        if (typeContext != nullptr)
+            context.typeArguments = typeContext->typeArguments;
+
+        return this->m_ctx.getGenericContext(context);
+    }
+
+    InlineCacheEntry Method::findVirtualCallTarget(const VirtualCall &site, MethodTable *methodTable) {
+        u32 target = site.methodToken;
+
+        if (site.slot != VirtualCall::NoSlot) {
+            target = methodTable->vtable[site.slot];
+        } else if (site.interfaceMethodId != 0) {
+            target = methodTable->getInterfaceMethod(site.interfaceMethodId);
+
+            // Overrides of methods of other assemblies are found by name and signature once per type, then they go
+            // into its IMT like any other interface method
+            if (target == 0 && TABLE_ID(site.methodToken) == TABLE_ID_MEMBERREF) {
+                target = findOverride(methodTable, site.methodToken);
+                methodTable->setInterfaceMethod(site.interfaceMethodId, target);
+            } else if (target == 0) {
+                Logger::error("%s doesn't implement interface method %08x!", methodTable->name.c_str(), site.methodToken);
+                exit(1);
+            }
+        }
+
+        return { methodTable, target, getTargetContext(site, methodTable, target) };
+    }
+
+    // Monomorphic sites find their target with a single MethodTable comparison, polymorphic ones by comparing against
+    // every cached entry. Megamorphic sites don't look at the cache anymore, they'd only ever miss it. They go
+    // through the vtable or the IMT on every call instead, generic methods additionally look up their type arguments
+    InlineCacheEntry Method::lookupInlineCache(VirtualCall &site, MethodTable *methodTable) {
+        if (site.megamorphic) [[unlikely]] {
+            site.misses++;
+            return findVirtualCallTarget(site, methodTable);
+        }
+
+        if (site.cache[0].methodTable == methodTable) [[likely]] {
+            site.hits++;
+            return site.cache[0];
+        }
+
+        for (u32 i = 1; i < site.cacheSize; i++) {
+            if (site.cache[i].methodTable == methodTable) {
+                site.hits++;
+                return site.cache[i];
+            }
+        }
+
+        site.misses++;
+        auto entry = findVirtualCallTarget(site, methodTable);
+
+        if (site.cacheSize < VirtualCall::PolymorphicCacheSize) {
+            site.cache[site.cacheSize] = entry;
+            site.cacheSize++;
+        } else {
+            site.megamorphic = true;
+            Logger::debug("callvirt %08x became megamorphic", site.methodToken);
+        }
+
+        return entry;
+    }
+
+    // Runs a body MethodBody::classifyTrivialBody recognized directly on the caller's evaluation stack. The arguments
+    // are consumed exactly like the body would and no frame is set up for it
+    void Method::callTrivial(MethodBody &body) {
+        auto &trivial = body.trivial;
+
+        switch (trivial.kind) {
+            case TrivialBodyKind::Getter: {
+                u8 *instance = popInstance();
+
+                if (this->m_ctx.fieldProfiling)
+                    countFieldAccess({ trivial.fieldIndex });
+
+                this->m_ctx.loadValue(trivial.fieldType, instance + trivial.fieldOffset, trivial.fieldSize);
+                break;
+            }
+            case TrivialBodyKind::Setter: {
+                u8 *instance = *reinterpret_cast<u8**>(this->m_ctx.stackPointer - body.argumentsSize);
+
+                if (instance == nullptr) {
+                    Logger::error("Tried to access a field of a null reference!");
+                    exit(1);
+                }
+
+                if (this->m_ctx.fieldProfiling)
+                    countFieldAccess({ trivial.fieldIndex });
+
+                this->m_ctx.storeObjectValue(trivial.fieldType, instance + trivial.fieldOffset, trivial.fieldSize);
+                this->m_ctx.pop<u64>();
+                break;
+            }
+            case TrivialBodyKind::Constant:
+                this->m_ctx.stackPointer -= body.argumentsSize;
+                this->m_ctx.typeStackPointer -= body.argumentsSize / Context::StackSlotSize;
+                this->m_ctx.push<u64>(trivial.constantType, trivial.constant);
+                break;
+            case TrivialBodyKind::Forward:
+                call(trivial.forwardTarget);
+                break;
+            case TrivialBodyKind::None:
+                break;
+        }
+    }
+
+    void Method::call(u32 methodToken, const GenericContext *genericContext) {
+        switch (TABLE_ID(methodToken)) {
+            case TABLE_ID_METHODDEF:
+            {
+                auto &body = this->m_ctx.getMethodBody(methodToken, genericContext);
+                if (body.trivial.kind != TrivialBodyKind::None && !body.triggersTypeInitialization) {
+                    callTrivial(body);
+                    break;
+                }
+
+                auto calledMethod = new Method(this->m_ctx, methodToken, genericContext, body);
+                calledMethod->run();
+                delete calledMethod;
+                break;
+            }
+            case TABLE_ID_MEMBERREF:
+            {
+                auto fullMethodName = getDLL()->getFullMethodName(methodToken);
+                Logger::debug("Executing native method %s", fullMethodName.c_str());
+
+                this->m_ctx.nativeFunctions[fullMethodName]();
+
+                break;
+            }
+        }
+    }
+
+    u32 Method::resolveDirectCall(u32 methodToken) {
+        DirectCall site;
+        site.methodToken = resolveMethod(methodToken, site.genericContext);
+
+        switch (TABLE_ID(site.methodToken)) {
+            case TABLE_ID_METHODDEF:
+                site.body = &this->m_ctx.getMethodBody(site.methodToken, site.genericContext);
+                break;
+            case TABLE_ID_MEMBERREF:
+                site.native = &this->m_ctx.nativeFunctions[getDLL()->getFullMethodName(site.methodToken)];
+                break;
+        }
+
+        u32 index = this->m_ctx.directCalls.size();
+        this->m_ctx.directCalls.push_back(site);
+
+        return index;
+    }
+
+    // Generic methods called with type parameters of the caller and methods of generic instances that use them run
+    // with different type arguments and bodies in every instantiation of the caller, see resolveGenericVirtualCall
+    u32 Method::resolveGenericDirectCall(u32 methodToken) {
+        auto key = Context::getInstantiationKey(methodToken, this->m_genericContext);
+        if (!this->m_ctx.genericDirectCallIndices.contains(key))
+            this->m_ctx.genericDirectCallIndices[key] = resolveDirectCall(methodToken);
+
+        return this->m_ctx.genericDirectCallIndices[key];
+    }
+
+    void Method::callDirect(u32 methodToken) {
+        if (dependsOnGenericContext(methodToken))
+            call(this->m_ctx.directCalls[resolveGenericDirectCall(methodToken)]);
+        else
+            quicken(OpcodePrefix::Call_q, resolveDirectCall(methodToken));
+    }
+
+    // Same as call with a token, but neither resolves the token nor looks up the body or native function again.
+    // Whether a body triggers type initialization can change between calls, so that is still checked every time
+    void Method::call(DirectCall &site) {
+        if (site.native != nullptr) {
+            (*site.native)();
+            return;
+        }
+
+        if (site.body == nullptr)
+            return;
+
+        auto &body = *site.body;
+        if (body.trivial.kind != TrivialBodyKind::None && !body.triggersTypeInitialization) {
+            callTrivial(body);
+            return;
+        }
+
+        auto calledMethod = new Method(this->m_ctx, site.methodToken, site.genericContext, body);
+        calledMethod->run();
+        delete calledMethod;
+    }
+
+}
@@ -0,0 +1,377 @@
+#include "method_body.hpp"
+
+#include "dll.hpp"
+#include "method_table.hpp"
+#include "tables.hpp"
+#include "logger.hpp"
+#include "opcode.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ili {
+
+    static u32 getSlotsSize(u32 size) {
+        return std::max<u32>(8, (size + 7) & ~7);
+    }
+
+    MethodBody::MethodBody(DLL *dll, u32 methodToken, const GenericContext *canonicalContext) {
+        table_method_def_t *methodDef = dll->getMethodDefByMetadataToken(methodToken);
+        section_table_entry_t *ilHeaderSection = dll->getVirtualSection(methodDef->rva);
+        u8 *methodHeader = OFFSET(dll->getData(), VRA_TO_OFFSET(ilHeaderSection, methodDef->rva));
+
+        bool hasMoreSections = false;
+
+        if ((*methodHeader & 0x03) == METHOD_HEADER_TINY) {
+            this->code = methodHeader + 1;
+            this->codeSize = *methodHeader >> 2;
+            this->maxStack = 8;
+        } else if ((*methodHeader & 0x03) == METHOD_HEADER_FAT) {
+            auto fatHeader = reinterpret_cast<fat_method_header_t*>(methodHeader);
+
+            this->code = methodHeader + (fatHeader->flagsAndSize >> 12) * sizeof(u32);
+            this->codeSize = fatHeader->codeSize;
+            this->maxStack = fatHeader->maxStack;
+            this->localVarSigToken = fatHeader->localVarSigToken;
+            this->initLocals = (fatHeader->flagsAndSize & METHOD_HEADER_INIT_LOCALS) != 0;
+
+            hasMoreSections = (fatHeader->flagsAndSize & METHOD_HEADER_MORE_SECTS) != 0;
+        } else {
+            Logger::error("Invalid method header (%02x)!", *methodHeader);
+            exit(1);
+        }
+
+        // Extra data sections start at the next 4 byte boundary after the code
+        u8 *section = this->code + this->codeSize;
+        while (hasMoreSections) {
+            section = reinterpret_cast<u8*>((reinterpret_cast<u64>(section) + 3) & ~3ULL);
+
+            u8 kind = section[0];
+            bool fatFormat = (kind & SECTION_FAT_FORMAT) != 0;
+            u32 dataSize = fatFormat ? (section[1] | (section[2] << 8) | (section[3] << 16)) : section[1];
+
+            if ((kind & SECTION_EH_TABLE) != 0) {
+                if (fatFormat) {
+                    auto clauses = reinterpret_cast<fat_exception_clause_t*>(section + 4);
+                    for (u32 i = 0; i < (dataSize - 4) / sizeof(fat_exception_clause_t); i++) {
+                        auto &clause = clauses[i];
+                        this->exceptionClauses.push_back({
+                            static_cast<ExceptionClauseType>(clause.flags & 0x07),
+                            clause.tryOffset, clause.tryOffset + clause.tryLength,
+                            clause.handlerOffset, clause.handlerOffset + clause.handlerLength,
+                            clause.classTokenOrFilterOffset, clause.classTokenOrFilterOffset
+                        });
+                    }
+                } else {
+                    auto clauses = reinterpret_cast<small_exception_clause_t*>(section + 4);
+                    for (u32 i = 0; i < (dataSize - 4) / sizeof(small_exception_clause_t); i++) {
+                        auto &clause = clauses[i];
+                        this->exceptionClauses.push_back({
+                            static_cast<ExceptionClauseType>(clause.flags & 0x07),
+                            clause.tryOffset, static_cast<u32>(clause.tryOffset + clause.tryLength),
+                            clause.handlerOffset, static_cast<u32>(clause.handlerOffset + clause.handlerLength),
+                            clause.classTokenOrFilterOffset, clause.classTokenOrFilterOffset
+                        });
+                    }
+                }
+            }
+
+            hasMoreSections = (kind & SECTION_MORE_SECTS) != 0;
+            section += dataSize;
+        }
+
+        // Code specialized for value type arguments gets a copy of its own to quicken. The image might have been
+        // quickened by other instantiations already, but only where that turned out the same for all of them
+        if (canonicalContext != nullptr && canonicalContext->hasValueTypeArguments()) {
+            this->m_specializedCode = std::make_unique<u8[]>(this->codeSize);
+            std::memcpy(this->m_specializedCode.get(), this->code, this->codeSize);
+            this->code = this->m_specializedCode.get();
+        }
+
+        // Lay out arguments and locals
+        {
+            this->signature = SignatureReader(dll, dll->getBlob(methodDef->signatureIndex)).readMethodSignature();
+            if (canonicalContext != nullptr)
+                this->signature = canonicalContext->substitute(this->signature);
+            this->ownerTypeIndex = dll->findTypeDefWithMethod(methodToken);
+
+            // Without BeforeFieldInit the type initializer has to run precisely before the first static method
+            // call or instance construction, not just before the first static field access
+            auto ownerType = dll->getTypeDefByIndex(this->ownerTypeIndex);
+            bool isStaticOrConstructor = (methodDef->flags & METHOD_ATTRIBUTE_STATIC) != 0 || std::strcmp(dll->getString(methodDef->nameIndex), ".ctor") == 0;
+
+            this->triggersTypeInitialization = isStaticOrConstructor
+                && (ownerType->flags & TYPE_ATTRIBUTE_BEFORE_FIELD_INIT) == 0
+                && std::strcmp(dll->getString(methodDef->nameIndex), ".cctor") != 0
+                && dll->findMethodByName(this->ownerTypeIndex, ".cctor") != 0;
+
+            if (this->signature.hasThis) {
+                TypeSignature thisType;
+                thisType.typeToken = (TABLE_ID_TYPEDEF << 24) | this->ownerTypeIndex;
+
+                // Methods of value types get a managed pointer to the instance instead of a reference
+                if (dll->isValueType(TABLE_INDEX(thisType.typeToken))) {
+                    thisType.elementType = SignatureElementType::ByRef;
+                    thisType.innerType = SignatureElementType::ValueType;
+                } else {
+                    thisType.elementType = SignatureElementType::Class;
+                }
+
+                this->arguments.push_back({ thisType, this->argumentsSize, 8 });
+                this->argumentsSize += 8;
+            }
+
+            for (auto &parameter : this->signature.parameters) {
+                u32 size = dll->getTypeSize(parameter);
+
+                this->arguments.push_back({ parameter, this->argumentsSize, size });
+                this->argumentsSize += getSlotsSize(size);
+            }
+
+            if (this->localVarSigToken != 0) {
+                auto localsSignature = dll->getStandAloneSigByIndex(TABLE_INDEX(this->localVarSigToken));
+
+                for (auto &local : SignatureReader(dll, dll->getBlob(localsSignature->signatureIndex)).readLocalsSignature()) {
+                    if (canonicalContext != nullptr)
+                        local = canonicalContext->substitute(local);
+
+                    u32 size = dll->getTypeSize(local);
+
+                    this->locals.push_back({ local, this->localsSize, size });
+                    this->localsSize += getSlotsSize(size);
+                }
+            }
+        }
+
+        eliminateBoxing(dll, canonicalContext);
+        fuseTypeOf(dll);
+        classifyTrivialBody(dll, methodToken, canonicalContext);
+
+        Logger::debug("Decoded method body: %u bytes of code, %u exception clauses", this->codeSize, this->exceptionClauses.size());
+    }
+
+    // Offsets control can arrive at from somewhere other than the previous instruction
+    std::vector<bool> MethodBody::findBranchTargets() const {
+        std::vector<bool> targets(this->codeSize + 1, false);
+
+        for (auto &clause : this->exceptionClauses) {
+            targets[clause.tryStart] = targets[clause.handlerStart] = true;
+            if (clause.type == ExceptionClauseType::Filter)
+                targets[clause.filterStart] = true;
+        }
+
+        for (u32 offset = 0; offset < this->codeSize; offset += getInstructionSize(this->code + offset)) {
+            u8 *instruction = this->code + offset;
+            OpcodePrefix opcode = readOpcode(instruction);
+            u32 next = offset + getInstructionSize(instruction);
+
+            auto markTarget = [&](s64 target) {
+                if (target >= 0 && target <= this->codeSize)
+                    targets[target] = true;
+            };
+
+            if ((opcode >= OpcodePrefix::Br_s && opcode <= OpcodePrefix::Blt_un_s) || opcode == OpcodePrefix::Leave_s)
+                markTarget(next + *reinterpret_cast<s8*>(instruction + 1));
+            else if ((opcode >= OpcodePrefix::Br && opcode <= OpcodePrefix::Blt_un) || opcode == OpcodePrefix::Leave)
+                markTarget(next + *reinterpret_cast<s32*>(instruction + 1));
+            else if (opcode == OpcodePrefix::Swtch) {
+                u32 count = *reinterpret_cast<u32*>(instruction + 1);
+                for (u32 i = 0; i < count; i++)
+                    markTarget(next + reinterpret_cast<s32*>(instruction + 5)[i]);
+            }
+        }
+
+        return targets;
+    }
+
+    // Boxing a value only to unbox it again or to compare it against null never needs a heap allocation.
+    // Both patterns get rewritten in place once, unless something branches in between the two instructions
+    void MethodBody::eliminateBoxing(DLL *dll, const GenericContext *canonicalContext) {
+        std::vector<bool> targets;
+
+        for (u32 offset = 0; offset < this->codeSize; offset += getInstructionSize(this->code + offset)) {
+            u8 *box = this->code + offset;
+            if (readOpcode(box) != OpcodePrefix::Box || offset + 5 >= this->codeSize)
+                continue;
+
+            if (targets.empty())
+                targets = findBranchTargets();
+
+            u8 *next = box + 5;
+            if (targets[offset + 5])
+                continue;
+
+            u32 typeToken = *reinterpret_cast<u32*>(box + 1);
+            OpcodePrefix nextOpcode = readOpcode(next);
+
+            if (nextOpcode == OpcodePrefix::Unbox_any && *reinterpret_cast<u32*>(next + 1) == typeToken) {
+                // box T; unbox.any T leaves the same value on the stack
+                std::memset(box, static_cast<u8>(OpcodePrefix::Nop), 10);
+                continue;
+            }
+
+            bool isBranchOnTrue = nextOpcode == OpcodePrefix::Brtrue || nextOpcode == OpcodePrefix::Brtrue_s;
+            bool isBranchOnFalse = nextOpcode == OpcodePrefix::Brfalse || nextOpcode == OpcodePrefix::Brfalse_s;
+            if (!isBranchOnTrue && !isBranchOnFalse)
+                continue;
+
+            // A boxed value type is never null. Nullable<T> boxes to null, so generic instances are left alone.
+            // Generic parameters are only known to be value types in code specialized for them
+            auto type = dll->resolveTypeToken(typeToken);
+            if (canonicalContext != nullptr)
+                type = canonicalContext->substitute(type);
+
+            if (!type.isValueType() || type.elementType == SignatureElementType::GenericInst)
+                continue;
+
+            box[0] = static_cast<u8>(OpcodePrefix::Pop);
+            std::memset(box + 1, static_cast<u8>(OpcodePrefix::Nop), 4);
+
+            if (isBranchOnTrue)
+                next[0] = static_cast<u8>(nextOpcode == OpcodePrefix::Brtrue ? OpcodePrefix::Br : OpcodePrefix::Br_s);
+            else
+                std::memset(next, static_cast<u8>(OpcodePrefix::Nop), getInstructionSize(next));
+        }
+    }
+
+    // typeof(T) compiles to ldtoken T; call Type.GetTypeFromHandle. The pair is rewritten into an Ldtype, which pushes
+    // the type's System.Type object directly, followed by the nops the call leaves behind
+    void MethodBody::fuseTypeOf(DLL *dll) {
+        std::vector<bool> targets;
+
+        for (u32 offset = 0; offset < this->codeSize; offset += getInstructionSize(this->code + offset)) {
+            u8 *ldtoken = this->code + offset;
+            if (readOpcode(ldtoken) != OpcodePrefix::Ldtoken || offset + 5 >= this->codeSize)
+                continue;
+
+            u32 token = *reinterpret_cast<u32*>(ldtoken + 1);
+            if (TABLE_ID(token) != TABLE_ID_TYPEDEF && TABLE_ID(token) != TABLE_ID_TYPEREF && TABLE_ID(token) != TABLE_ID_TYPESPEC)
+                continue;
+
+            u8 *call = ldtoken + 5;
+            u32 methodToken = *reinterpret_cast<u32*>(call + 1);
+            if (readOpcode(call) != OpcodePrefix::Call || TABLE_ID(methodToken) != TABLE_ID_MEMBERREF)
+                continue;
+
+            u32 parentToken = dll->decodeMemberRefParent(dll->getMemberRefByMetadataToken(methodToken)->classIndex);
+            if (TABLE_ID(parentToken) != TABLE_ID_TYPEREF || !dll->getFullMethodName(methodToken).ends_with("]System.Type::GetTypeFromHandle"))
+                continue;
+
+            if (targets.empty())
+                targets = findBranchTargets();
+
+            if (targets[offset + 5])
+                continue;
+
+            ldtoken[0] = static_cast<u8>(OpcodePrefix::Ldtype);
+            std::memset(call, static_cast<u8>(OpcodePrefix::Nop), 5);
+        }
+    }
+
+    // Argument number a ldarg instruction loads, -1 for all other instructions
+    static s32 getLoadedArgument(u8 *instruction) {
+        switch (readOpcode(instruction)) {
+            case OpcodePrefix::Ldarg_0: return 0;
+            case OpcodePrefix::Ldarg_1: return 1;
+            case OpcodePrefix::Ldarg_2: return 2;
+            case OpcodePrefix::Ldarg_3: return 3;
+            case OpcodePrefix::Ldarg_s: return instruction[1];
+            case OpcodePrefix::Ldarg:   return *reinterpret_cast<u16*>(instruction + 2);
+            default:                    return -1;
+        }
+    }
+
+    // Auto-properties and similar one-liners are recognized once here, calls to them then skip setting up a frame.
+    // Only non-generic code qualifies, so everything the body accesses can be resolved right away
+    void MethodBody::classifyTrivialBody(DLL *dll, u32 methodToken, const GenericContext *canonicalContext) {
+        if (canonicalContext != nullptr || !this->exceptionClauses.empty() || this->signature.genericParameterCount != 0)
+            return;
+
+        std::vector<u8*> instructions;
+        for (u32 offset = 0; offset < this->codeSize; offset += getInstructionSize(this->code + offset)) {
+            if (readOpcode(this->code + offset) != OpcodePrefix::Nop)
+                instructions.push_back(this->code + offset);
+        }
+
+        if (instructions.size() < 2 || readOpcode(instructions.back()) != OpcodePrefix::Ret)
+            return;
+
+        auto resolveField = [&](u8 *instruction) {
+            u32 fieldToken = *reinterpret_cast<u32*>(instruction + 1);
+            if (TABLE_ID(fieldToken) != TABLE_ID_FIELD)
+                return false;
+
+            u32 fieldIndex = TABLE_INDEX(fieldToken);
+            auto field = dll->getFieldByIndex(fieldIndex);
+            if ((field->flags & FIELD_ATTRIBUTE_STATIC) != 0)
+                return false;
+
+            auto type = SignatureReader(dll, dll->getBlob(field->signatureIndex)).readFieldSignature();
+
+            this->trivial.fieldIndex = fieldIndex;
+            this->trivial.fieldType = type.getStorageType();
+            this->trivial.fieldOffset = dll->getFieldOffset(fieldIndex);
+            this->trivial.fieldSize = dll->getTypeSize(type);
+
+            if (!dll->isValueType(dll->findTypeDefWithField(fieldIndex)))
+                this->trivial.fieldOffset += ObjectHeaderSize;
+
+            return true;
+        };
+
+        OpcodePrefix first = readOpcode(instructions[0]);
+        u8 *operand = instructions[0] + 1;
+
+        // Checked first, a forwarder without arguments that returns a value looks like a constant up to its opcode
+        if (instructions.size() == this->arguments.size() + 2 && readOpcode(instructions[instructions.size() - 2]) == OpcodePrefix::Call) {
+            for (u32 i = 0; i < this->arguments.size(); i++) {
+                if (getLoadedArgument(instructions[i]) != static_cast<s32>(i))
+                    return;
+            }
+
+            // Generic methods are called through a MethodSpec, so a MethodDef target never needs type arguments
+            u32 target = *reinterpret_cast<u32*>(instructions[instructions.size() - 2] + 1);
+            if (TABLE_ID(target) != TABLE_ID_METHODDEF || target == methodToken)
+                return;
+
+            this->trivial.kind = TrivialBodyKind::Forward;
+            this->trivial.forwardTarget = target;
+        } else if (instructions.size() == 2 && this->signature.returnType.elementType != SignatureElementType::Void) {
+            auto &trivial = this->trivial;
+
+            if (first >= OpcodePrefix::Ldc_i4_m1 && first <= OpcodePrefix::Ldc_i4_8) {
+                trivial.constantType = Type::Int32;
+                trivial.constant = static_cast<u32>(static_cast<s32>(first) - static_cast<s32>(OpcodePrefix::Ldc_i4_0));
+            } else if (first == OpcodePrefix::Ldc_i4_s) {
+                trivial.constantType = Type::Int32;
+                trivial.constant = static_cast<u32>(static_cast<s32>(*reinterpret_cast<s8*>(operand)));
+            } else if (first == OpcodePrefix::Ldc_i4) {
+                trivial.constantType = Type::Int32;
+                trivial.constant = *reinterpret_cast<u32*>(operand);
+            } else if (first == OpcodePrefix::Ldc_i8) {
+                trivial.constantType = Type::Int64;
+                trivial.constant = *reinterpret_cast<u64*>(operand);
+            } else if (first == OpcodePrefix::Ldc_r4 || first == OpcodePrefix::Ldc_r8) {
+                double value = first == OpcodePrefix::Ldc_r4 ? *reinterpret_cast<float*>(operand) : *reinterpret_cast<double*>(operand);
+                trivial.constantType = Type::F;
+                std::memcpy(&trivial.constant, &value, sizeof(double));
+            } else if (first == OpcodePrefix::Ldnull) {
+                trivial.constantType = Type::O;
+            } else {
+                return;
+            }
+
+            trivial.kind = TrivialBodyKind::Constant;
+        } else if (instructions.size() == 3 && this->signature.hasThis && getLoadedArgument(instructions[0]) == 0
+                && readOpcode(instructions[1]) == OpcodePrefix::Ldfld) {
+            if (resolveField(instructions[1]))
+                this->trivial.kind = TrivialBodyKind::Getter;
+        } else if (instructions.size() == 4 && this->signature.hasThis && this->signature.parameters.size() == 1
+                && getLoadedArgument(instructions[0]) == 0 && getLoadedArgument(instructions[1]) == 1
+                && readOpcode(instructions[2]) == OpcodePrefix::Stfld) {
+            if (resolveField(instructions[2]))
+                this->trivial.kind = TrivialBodyKind::Setter;
+        }
+    }
+
+}
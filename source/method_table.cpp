@@ -0,0 +1,393 @@
+#include "method_table.hpp"
+
+#include "context.hpp"
+#include "dll.hpp"
+#include "tables.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+
+namespace ili {
+
+    // Delegate types of other assemblies can only be recognized by their name
+    static bool isDelegateTypeName(const std::string &name) {
+        return name == "System.Delegate" || name == "System.MulticastDelegate" || name.starts_with("System.Action")
+            || name.starts_with("System.Func`") || name.starts_with("System.Predicate`") || name.starts_with("System.Comparison`")
+            || name.starts_with("System.Converter`") || name.starts_with("System.EventHandler");
+    }
+
+    MethodTable::MethodTable(Context &ctx, const TypeSignature &type) : type(type) {
+        DLL *dll = ctx.dll;
+
+        bool isNamedType = type.elementType == SignatureElementType::Class || type.elementType == SignatureElementType::ValueType
+            || type.elementType == SignatureElementType::GenericInst;
+
+        if (isNamedType && TABLE_ID(type.typeToken) == TABLE_ID_TYPEDEF) {
+            u32 typeDefIndex = TABLE_INDEX(type.typeToken);
+            auto typeDef = dll->getTypeDefByIndex(typeDefIndex);
+
+            this->name = std::string(dll->getString(typeDef->typeNamespaceIndex)) + "." + dll->getString(typeDef->typeNameIndex);
+            this->isValueType = dll->isValueType(typeDefIndex);
+            this->isInterface = dll->isInterface(typeDefIndex);
+            this->isSealed = this->isValueType || (typeDef->flags & TYPE_ATTRIBUTE_SEALED) != 0;
+
+            if (type.elementType == SignatureElementType::GenericInst) {
+                this->instantiation = ctx.getGenericContext(GenericContext { type.typeArguments, { } });
+                this->type.innerType = this->isValueType ? SignatureElementType::ValueType : SignatureElementType::Class;
+
+                for (u32 i = 0; i < type.typeArguments.size(); i++)
+                    this->name += (i == 0 ? "<" : ",") + ctx.getMethodTable(type.typeArguments[i])->name;
+                this->name += ">";
+            } else {
+                this->type.elementType = this->isValueType ? SignatureElementType::ValueType : SignatureElementType::Class;
+            }
+
+            this->instanceSize = ObjectHeaderSize + (this->isValueType ? dll->getTypeSize(this->type) : dll->getTypeLayout(typeDefIndex, type.typeArguments).size);
+
+            u32 baseToken = dll->decodeTypeDefOrRef(typeDef->extendsIndex);
+            if (TABLE_INDEX(baseToken) != 0) {
+                auto baseType = dll->resolveTypeToken(baseToken);
+
+                this->parent = ctx.getMethodTable(this->instantiation != nullptr ? this->instantiation->substitute(baseType) : baseType);
+                this->vtable = this->parent->vtable;
+                this->isDelegate = this->parent->isDelegate;
+            }
+
+            if (this->isDelegate)
+                this->instanceSize = ObjectHeaderSize + sizeof(DelegateData);
+
+            if (!this->isInterface)
+                buildVTable(ctx, typeDefIndex);
+
+            buildInterfaceTable(ctx, typeDefIndex);
+        } else if (isNamedType && TABLE_ID(type.typeToken) == TABLE_ID_TYPEREF) {
+            // Types of other assemblies only get what's needed to tell them apart
+            auto typeRef = dll->getTypeRefByIndex(TABLE_INDEX(type.typeToken));
+
+            this->name = std::string(dll->getString(typeRef->typeNamespaceIndex)) + "." + dll->getString(typeRef->typeNameIndex);
+            this->parent = ctx.getMethodTable(TypeSignature { SignatureElementType::Object });
+
+            this->isDelegate = isDelegateTypeName(this->name);
+            if (this->isDelegate)
+                this->instanceSize = ObjectHeaderSize + sizeof(DelegateData);
+        } else if (type.elementType == SignatureElementType::SzArray || type.elementType == SignatureElementType::Array) {
+            auto elementType = dll->getElementType(type);
+
+            this->elementType = ctx.getMethodTable(elementType);
+            this->elementStorageType = elementType.getStorageType();
+            this->elementSize = elementType.isValueType() ? dll->getTypeSize(elementType) : sizeof(u64);
+
+            if (type.elementType == SignatureElementType::SzArray) {
+                this->rank = 1;
+                this->dataOffset = ArrayDataOffset;
+                this->name = this->elementType->name + "[]";
+            } else {
+                this->rank = type.rank;
+                this->dataOffset = ArrayDataOffset + type.rank * sizeof(ArrayBounds);
+                this->name = this->elementType->name + "[" + std::string(std::max<u32>(1, type.rank) - 1, ',') + "]";
+            }
+
+            this->instanceSize = this->dataOffset;
+            this->parent = ctx.getMethodTable(TypeSignature { SignatureElementType::Object });
+        } else {
+            this->name = "<primitive " + std::to_string(static_cast<u32>(type.elementType)) + ">";
+            this->isValueType = type.isValueType();
+            this->isSealed = this->isValueType || type.elementType == SignatureElementType::String;
+            this->instanceSize = ObjectHeaderSize + getSignatureElementTypeSize(type.elementType);
+
+            if (this->isValueType || type.elementType == SignatureElementType::String)
+                this->parent = ctx.getMethodTable(TypeSignature { SignatureElementType::Object });
+        }
+
+        buildTypeDisplay();
+
+        Logger::debug("Created MethodTable for %s with %u vtable slots", this->name.c_str(), this->vtable.size());
+    }
+
+    MethodTable::MethodTable(Context &ctx, const std::string &name, u32 instanceSize) : type({ SignatureElementType::Class }), name(name) {
+        this->instanceSize = ObjectHeaderSize + instanceSize;
+        this->isSealed = true;
+        this->parent = ctx.getMethodTable(TypeSignature { SignatureElementType::Object });
+
+        buildTypeDisplay();
+
+        Logger::debug("Created MethodTable for runtime type %s", this->name.c_str());
+    }
+
+    // Fields of value types are stored inline, their references become references of the containing type
+    void MethodTable::addReferenceOffsets(Context &ctx, const TypeSignature &type, u32 offset) {
+        switch (type.elementType) {
+            case SignatureElementType::Class: case SignatureElementType::Object: case SignatureElementType::String:
+            case SignatureElementType::SzArray: case SignatureElementType::Array:
+                this->referenceOffsets.push_back(offset);
+                break;
+            case SignatureElementType::GenericInst:
+            case SignatureElementType::ValueType:
+                if (!type.isValueType()) {
+                    this->referenceOffsets.push_back(offset);
+                    break;
+                }
+
+                for (u32 inner : ctx.getMethodTable(type)->getReferenceOffsets(ctx))
+                    this->referenceOffsets.push_back(offset + inner - ObjectHeaderSize);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Built lazily since value type fields need the MethodTables of their types, which might not be complete yet
+    // while this one is being created
+    const std::vector<u32>& MethodTable::getReferenceOffsets(Context &ctx) {
+        if (this->hasReferenceMap)
+            return this->referenceOffsets;
+
+        this->hasReferenceMap = true;
+
+        bool isNamedType = this->type.elementType == SignatureElementType::Class || this->type.elementType == SignatureElementType::ValueType
+            || this->type.elementType == SignatureElementType::GenericInst;
+
+        // Delegates hold DelegateData instead of their declared fields
+        if (this->isDelegate) {
+            this->referenceOffsets = { ObjectHeaderSize + offsetof(DelegateData, target), ObjectHeaderSize + offsetof(DelegateData, invocationList) };
+            return this->referenceOffsets;
+        }
+
+        if (!isNamedType || TABLE_ID(this->type.typeToken) != TABLE_ID_TYPEDEF || this->isInterface)
+            return this->referenceOffsets;
+
+        if (this->parent != nullptr && !this->isValueType)
+            this->referenceOffsets = this->parent->getReferenceOffsets(ctx);
+
+        auto &layout = ctx.dll->getTypeLayout(TABLE_INDEX(this->type.typeToken), this->type.typeArguments);
+        for (auto &field : layout.fields)
+            addReferenceOffsets(ctx, field.type, ObjectHeaderSize + field.offset);
+
+        return this->referenceOffsets;
+    }
+
+    // Virtual methods without NewSlot override the closest inherited slot with the same name and signature,
+    // all others get a new slot. MethodImpl rows then override the slots of their declarations explicitly
+    void MethodTable::buildVTable(Context &ctx, u32 typeDefIndex) {
+        DLL *dll = ctx.dll;
+
+        for (u32 i = dll->getTypeDefByIndex(typeDefIndex)->methodListIndex; i < dll->getMethodListEnd(typeDefIndex); i++) {
+            auto methodDef = dll->getMethodDefByIndex(i);
+            u32 methodToken = (TABLE_ID_METHODDEF << 24) | i;
+
+            if ((methodDef->flags & METHOD_ATTRIBUTE_VIRTUAL) == 0)
+                continue;
+
+            u32 slot = this->vtable.size();
+            if ((methodDef->flags & METHOD_ATTRIBUTE_NEW_SLOT) == 0) {
+                for (u32 inherited = this->vtable.size(); inherited > 0; inherited--) {
+                    u32 inheritedToken = this->vtable[inherited - 1];
+                    auto inheritedInstantiation = this->parent->getInstantiationOf(dll->findTypeDefWithMethod(inheritedToken));
+
+                    if (dll->hasSameNameAndSignature(inheritedToken, methodToken, inheritedInstantiation, this->instantiation)) {
+                        slot = inherited - 1;
+                        break;
+                    }
+                }
+            }
+
+            if (slot == this->vtable.size())
+                this->vtable.push_back(methodToken);
+            else
+                this->vtable[slot] = methodToken;
+
+            ctx.vtableSlots[methodToken] = slot;
+        }
+
+        for (u32 i = 1; i <= dll->getNumTableRows(TABLE_ID_METHOD_IMPL); i++) {
+            auto methodImpl = dll->getMethodImplByIndex(i);
+
+            if (methodImpl->classIndex != typeDefIndex)
+                continue;
+
+            u32 declaration = dll->resolveMethodDefinition(dll->decodeMethodDefOrRef(methodImpl->methodDeclarationIndex));
+            u32 body = dll->decodeMethodDefOrRef(methodImpl->methodBodyIndex);
+
+            if (auto slot = ctx.vtableSlots.find(declaration); slot != ctx.vtableSlots.end() && slot->second < this->vtable.size())
+                this->vtable[slot->second] = body;
+        }
+    }
+
+    void MethodTable::buildInterfaceTable(Context &ctx, u32 typeDefIndex) {
+        DLL *dll = ctx.dll;
+
+        if (this->parent != nullptr) {
+            for (auto interface : this->parent->interfaces)
+                addInterface(interface);
+        }
+
+        for (u32 i = 1; i <= dll->getNumTableRows(TABLE_ID_INTERFACE_IMPL); i++) {
+            auto interfaceImpl = dll->getInterfaceImplByIndex(i);
+
+            if (interfaceImpl->classIndex != typeDefIndex)
+                continue;
+
+            auto interfaceType = dll->resolveTypeToken(dll->decodeTypeDefOrRef(interfaceImpl->interfaceIndex));
+
+            addInterface(ctx.getMethodTable(this->instantiation != nullptr ? this->instantiation->substitute(interfaceType) : interfaceType));
+        }
+
+        if (this->isInterface)
+            return;
+
+        // Methods of interfaces from other assemblies aren't known, only their explicit implementations can be found.
+        // Walking from the most derived type on makes re-implementations win over inherited ones
+        for (auto current = this; current != nullptr && TABLE_ID(current->type.typeToken) == TABLE_ID_TYPEDEF; current = current->parent) {
+            for (u32 i = 1; i <= dll->getNumTableRows(TABLE_ID_METHOD_IMPL); i++) {
+                auto methodImpl = dll->getMethodImplByIndex(i);
+                u32 declaration = dll->resolveMethodDefinition(dll->decodeMethodDefOrRef(methodImpl->methodDeclarationIndex));
+
+                if (methodImpl->classIndex != TABLE_INDEX(current->type.typeToken) || TABLE_ID(declaration) != TABLE_ID_MEMBERREF)
+                    continue;
+
+                u32 interfaceMethodId = ctx.getInterfaceMethodId(declaration);
+                if (getInterfaceMethod(interfaceMethodId) == 0)
+                    setInterfaceMethod(interfaceMethodId, getMostDerivedImplementation(ctx, dll->decodeMethodDefOrRef(methodImpl->methodBodyIndex)));
+            }
+        }
+
+        for (auto interface : this->interfaces) {
+            if (TABLE_ID(interface->type.typeToken) != TABLE_ID_TYPEDEF)
+                continue;
+
+            u32 interfaceIndex = TABLE_INDEX(interface->type.typeToken);
+            for (u32 i = dll->getTypeDefByIndex(interfaceIndex)->methodListIndex; i < dll->getMethodListEnd(interfaceIndex); i++) {
+                u32 methodToken = (TABLE_ID_METHODDEF << 24) | i;
+
+                if (u32 target = findInterfaceImplementation(ctx, methodToken, interface); target != 0)
+                    setInterfaceMethod(ctx.getInterfaceMethodId(methodToken), target);
+            }
+        }
+
+        Logger::debug("%s implements %u interfaces", this->name.c_str(), this->interfaces.size());
+    }
+
+    void MethodTable::addInterface(MethodTable *interface) {
+        if (std::find(this->interfaces.begin(), this->interfaces.end(), interface) != this->interfaces.end())
+            return;
+
+        this->interfaces.push_back(interface);
+
+        for (auto base : interface->interfaces)
+            addInterface(base);
+    }
+
+    void MethodTable::setInterfaceMethod(u32 interfaceMethodId, u32 target) {
+        auto &entry = this->imt[interfaceMethodId % ImtSize];
+
+        if (entry.method.interfaceMethodId == 0 || entry.method.interfaceMethodId == interfaceMethodId) {
+            entry.method = { interfaceMethodId, target };
+            return;
+        }
+
+        for (auto &conflict : entry.conflicts) {
+            if (conflict.interfaceMethodId == interfaceMethodId) {
+                conflict.target = target;
+                return;
+            }
+        }
+
+        entry.conflicts.push_back({ interfaceMethodId, target });
+    }
+
+    // An interface method is implemented by the MethodImpl naming it or else by the virtual method with the same name
+    // and signature, searching from the most derived type up. Non-abstract interface methods are their own default
+    u32 MethodTable::findInterfaceImplementation(Context &ctx, u32 methodToken, const MethodTable *interface) {
+        DLL *dll = ctx.dll;
+
+        for (auto current = this; current != nullptr && TABLE_ID(current->type.typeToken) == TABLE_ID_TYPEDEF; current = current->parent) {
+            u32 typeDefIndex = TABLE_INDEX(current->type.typeToken);
+
+            for (u32 i = 1; i <= dll->getNumTableRows(TABLE_ID_METHOD_IMPL); i++) {
+                auto methodImpl = dll->getMethodImplByIndex(i);
+
+                if (methodImpl->classIndex == typeDefIndex && dll->resolveMethodDefinition(dll->decodeMethodDefOrRef(methodImpl->methodDeclarationIndex)) == methodToken)
+                    return getMostDerivedImplementation(ctx, dll->decodeMethodDefOrRef(methodImpl->methodBodyIndex));
+            }
+
+            for (u32 i = dll->getTypeDefByIndex(typeDefIndex)->methodListIndex; i < dll->getMethodListEnd(typeDefIndex); i++) {
+                u32 candidate = (TABLE_ID_METHODDEF << 24) | i;
+
+                if ((dll->getMethodDefByIndex(i)->flags & METHOD_ATTRIBUTE_VIRTUAL) != 0
+                    && dll->hasSameNameAndSignature(candidate, methodToken, current->instantiation, interface->instantiation))
+                    return getMostDerivedImplementation(ctx, candidate);
+            }
+        }
+
+        if ((dll->getMethodDefByMetadataToken(methodToken)->flags & METHOD_ATTRIBUTE_ABSTRACT) == 0)
+            return methodToken;
+
+        return 0;
+    }
+
+    // Implementations found in a base type may have been overridden further down
+    u32 MethodTable::getMostDerivedImplementation(Context &ctx, u32 methodToken) {
+        if (auto slot = ctx.vtableSlots.find(methodToken); slot != ctx.vtableSlots.end() && slot->second < this->vtable.size())
+            return this->vtable[slot->second];
+
+        return methodToken;
+    }
+
+    void MethodTable::buildTypeDisplay() {
+        if (this->parent != nullptr) {
+            this->depth = this->parent->depth + 1;
+            std::copy(std::begin(this->parent->typeDisplay), std::end(this->parent->typeDisplay), this->typeDisplay);
+        }
+
+        if (this->depth < TypeDisplaySize)
+            this->typeDisplay[this->depth] = this;
+    }
+
+    // Ancestors too deep for the type display are found by walking the parent chain
+    bool MethodTable::isDeepSubclassOf(const MethodTable *other) const {
+        for (auto current = this; current != nullptr; current = current->parent) {
+            if (current == other)
+                return true;
+        }
+
+        return false;
+    }
+
+    // Arrays of reference types are covariant, which includes arrays of arrays
+    bool MethodTable::isArrayAssignableTo(const MethodTable *other) const {
+        if (this == other)
+            return true;
+
+        if (this->type.elementType != other->type.elementType || this->rank != other->rank)
+            return false;
+
+        if (this->elementType->isValueType || other->elementType->isValueType)
+            return this->elementType == other->elementType;
+
+        return this->elementType->isAssignableTo(other->elementType);
+    }
+
+    bool MethodTable::implements(const MethodTable *interface) const {
+        return std::find(this->interfaces.begin(), this->interfaces.end(), interface) != this->interfaces.end();
+    }
+
+    const GenericContext* MethodTable::getInstantiationOf(u32 typeDefIndex) const {
+        auto isInstanceOf = [typeDefIndex](const MethodTable *methodTable) {
+            return TABLE_ID(methodTable->type.typeToken) == TABLE_ID_TYPEDEF && TABLE_INDEX(methodTable->type.typeToken) == typeDefIndex;
+        };
+
+        for (auto current = this; current != nullptr; current = current->parent) {
+            if (isInstanceOf(current))
+                return current->instantiation;
+        }
+
+        // Default implementations of generic interface methods
+        for (auto interface : this->interfaces) {
+            if (isInstanceOf(interface))
+                return interface->instantiation;
+        }
+
+        return nullptr;
+    }
+
+}
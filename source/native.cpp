@@ -2,11 +2,348 @@
 
 #include "context.hpp"
 #include "dll.hpp"
+#include "method.hpp"
 
-
+#include <vector>
 
 namespace ili {
 
+    // Single cast delegates a delegate consists of, in invocation order
+    static std::vector<u64> getInvocationList(u64 delegate) {
+        auto &data = *reinterpret_cast<DelegateData*>(delegate + ObjectHeaderSize);
+
+        if (data.invocationCount == 0)
+            return { delegate };
+
+        return std::vector<u64>(data.getInvocationList(), data.getInvocationList() + data.invocationCount);
+    }
+
+    static bool hasSameTarget(u64 delegateA, u64 delegateB) {
+        auto &dataA = *reinterpret_cast<DelegateData*>(delegateA + ObjectHeaderSize);
+        auto &dataB = *reinterpret_cast<DelegateData*>(delegateB + ObjectHeaderSize);
+
+        return dataA.target == dataB.target && dataA.entry == dataB.entry;
+    }
+
+    // Lists of more than one delegate get a new multicast delegate that shares the type of the combined ones and
+    // reports the last of them as its own target
+    static u64 createMulticastDelegate(Context &ctx, MethodTable *delegateType, const std::vector<u64> &invocationList) {
+        if (invocationList.size() <= 1)
+            return invocationList.empty() ? 0 : invocationList[0];
+
+        u8 *object = ctx.allocateObject(delegateType);
+        auto &data = *reinterpret_cast<DelegateData*>(object + ObjectHeaderSize);
+        auto &last = *reinterpret_cast<DelegateData*>(invocationList.back() + ObjectHeaderSize);
+
+        data.target = last.target;
+        data.entry = last.entry;
+        // The list is an object[] of its own, so the collector can find and trace it like any other array. Long
+        // ones end up in the old generation, which needs its cards dirtied
+        auto listType = ctx.getMethodTable(TypeSignature { SignatureElementType::SzArray, 0, SignatureElementType::Object });
+        data.invocationList = reinterpret_cast<u64>(ctx.allocateArray(listType, invocationList.size()));
+        data.invocationCount = invocationList.size();
+        std::memcpy(data.getInvocationList(), invocationList.data(), invocationList.size() * sizeof(u64));
+        ctx.heap.writeBarrierRange(data.getInvocationList(), invocationList.size() * sizeof(u64));
+
+        return reinterpret_cast<u64>(object);
+    }
+
+    static void combineDelegates(Context &ctx) {
+        u64 second = ctx.pop<u64>();
+        u64 first = ctx.pop<u64>();
+
+        if (first == 0 || second == 0) {
+            ctx.push<u64>(Type::O, first != 0 ? first : second);
+            return;
+        }
+
+        auto invocationList = getInvocationList(first);
+        for (auto delegate : getInvocationList(second))
+            invocationList.push_back(delegate);
+
+        ctx.push<u64>(Type::O, createMulticastDelegate(ctx, reinterpret_cast<ObjectHeader*>(first)->methodTable, invocationList));
+    }
+
+    // Removes the last occurrence of the value's invocation list from the source's
+    static void removeDelegate(Context &ctx) {
+        u64 value = ctx.pop<u64>();
+        u64 source = ctx.pop<u64>();
+
+        if (source == 0 || value == 0) {
+            ctx.push<u64>(Type::O, source);
+            return;
+        }
+
+        auto invocationList = getInvocationList(source);
+        auto removed = getInvocationList(value);
+
+        for (size_t start = invocationList.size() + 1; start > removed.size(); start--) {
+            size_t first = start - 1 - removed.size();
+
+            bool matches = true;
+            for (size_t i = 0; i < removed.size() && matches; i++)
+                matches = hasSameTarget(invocationList[first + i], removed[i]);
+
+            if (matches) {
+                invocationList.erase(invocationList.begin() + first, invocationList.begin() + first + removed.size());
+                ctx.push<u64>(Type::O, createMulticastDelegate(ctx, reinterpret_cast<ObjectHeader*>(source)->methodTable, invocationList));
+                return;
+            }
+        }
+
+        ctx.push<u64>(Type::O, source);
+    }
+
+    // There's only ever one thread, the exchange doesn't need to be atomic
+    static void compareExchange(Context &ctx) {
+        Type type = ctx.getTypeOnStack();
+        u64 comparand = ctx.pop<u64>();
+        u64 value = ctx.pop<u64>();
+        auto location = reinterpret_cast<u8*>(ctx.pop<u64>());
+
+        u64 original = 0;
+        std::memcpy(&original, location, getTypeSize(type));
+
+        if (original == comparand) {
+            if (type == Type::O)
+                ctx.heap.preWriteBarrier(location);
+
+            std::memcpy(location, &value, getTypeSize(type));
+
+            if (type == Type::O)
+                ctx.heap.writeBarrier(location, value);
+        }
+
+        ctx.push<u64>(type, original);
+    }
+
+    // SZ arrays only have one dimension starting at 0 and keep no ArrayBounds
+    static ArrayBounds getArrayBounds(Context &ctx, u32 dimension) {
+        auto array = reinterpret_cast<u8*>(ctx.pop<u64>());
+
+        if (array == nullptr) {
+            Logger::error("Tried to get the bounds of a null array!");
+            exit(1);
+        }
+
+        auto arrayType = reinterpret_cast<ObjectHeader*>(array)->methodTable;
+        if (dimension >= arrayType->rank) {
+            Logger::error("Dimension %u is out of range for %s!", dimension, arrayType->name.c_str());
+            exit(1);
+        }
+
+        if (arrayType->type.elementType == SignatureElementType::SzArray)
+            return { static_cast<s32>(reinterpret_cast<ArrayHeader*>(array + ObjectHeaderSize)->length), 0 };
+
+        return reinterpret_cast<ArrayBounds*>(array + ArrayDataOffset)[dimension];
+    }
+
+    static void getArrayLength(Context &ctx) {
+        auto array = reinterpret_cast<u8*>(ctx.pop<u64>());
+
+        if (array == nullptr) {
+            Logger::error("Tried to get the length of a null array!");
+            exit(1);
+        }
+
+        ctx.push<s32>(Type::Int32, reinterpret_cast<ArrayHeader*>(array + ObjectHeaderSize)->length);
+    }
+
+    static InvokerValue getInvokerValue(Context &ctx, const TypeSignature &type) {
+        if (type.elementType == SignatureElementType::Void)
+            return { nullptr, SignatureElementType::Void, 0 };
+
+        return { ctx.getMethodTable(type), type.getStorageType(), ctx.dll->getTypeSize(type) };
+    }
+
+    // Invokers are built once per method and instantiation, everything reflection needs to know about the
+    // signature is decoded here
+    static const MethodInvoker* getMethodInvoker(Context &ctx, u32 methodToken, const GenericContext *genericContext) {
+        auto key = Context::getInstantiationKey(methodToken, genericContext);
+        if (auto invoker = ctx.methodInvokers.find(key); invoker != ctx.methodInvokers.end())
+            return invoker->second.get();
+
+        auto signature = SignatureReader(ctx.dll, ctx.dll->getBlob(ctx.dll->getMethodDefByMetadataToken(methodToken)->signatureIndex)).readMethodSignature();
+        if (genericContext != nullptr)
+            signature = genericContext->substitute(signature);
+
+        auto invoker = std::make_unique<MethodInvoker>();
+        invoker->methodToken = methodToken;
+        invoker->genericContext = genericContext;
+        invoker->hasThis = signature.hasThis;
+        invoker->isValueTypeMethod = signature.hasThis && ctx.dll->isValueType(ctx.dll->findTypeDefWithMethod(methodToken));
+        invoker->returnValue = getInvokerValue(ctx, signature.returnType);
+
+        for (auto &parameter : signature.parameters)
+            invoker->parameters.push_back(getInvokerValue(ctx, parameter));
+
+        return ctx.methodInvokers.emplace(key, std::move(invoker)).first->second.get();
+    }
+
+    // Pushes the target and the unboxed arguments, runs the method and boxes what it returned. Methods returning
+    // void leave null behind
+    static void invokeMethod(Context &ctx, const MethodInvoker &invoker, u64 target, const u64 *arguments) {
+        if (invoker.hasThis) {
+            if (target == 0) {
+                Logger::error("Tried to invoke an instance method on a null reference!");
+                exit(1);
+            }
+
+            if (invoker.isValueTypeMethod)
+                ctx.push<u64>(Type::Pointer, target + ObjectHeaderSize);
+            else
+                ctx.push<u64>(Type::O, target);
+        }
+
+        for (u32 i = 0; i < invoker.parameters.size(); i++) {
+            auto &parameter = invoker.parameters[i];
+
+            if (!parameter.type->isValueType) {
+                ctx.push<u64>(Type::O, arguments[i]);
+                continue;
+            }
+
+            if (arguments[i] == 0) {
+                Logger::error("Tried to pass null as an argument of type %s!", parameter.type->name.c_str());
+                exit(1);
+            }
+
+            ctx.loadValue(parameter.storageType, reinterpret_cast<u8*>(arguments[i] + ObjectHeaderSize), parameter.size);
+        }
+
+        Method(ctx, invoker.methodToken, invoker.genericContext).run();
+
+        if (ctx.exceptionPending)
+            return;
+
+        auto &returnValue = invoker.returnValue;
+        if (returnValue.type == nullptr) {
+            ctx.push<u64>(Type::O, 0);
+        } else if (returnValue.type->isValueType) {
+            u8 *object = ctx.allocateObject(returnValue.type);
+            ctx.storeValue(returnValue.storageType, object + ObjectHeaderSize, returnValue.size);
+            ctx.push<u64>(Type::O, reinterpret_cast<u64>(object));
+        }
+    }
+
+    static MethodTable* getRuntimeTypeOf(u64 runtimeType) {
+        if (runtimeType == 0) {
+            Logger::error("Tried to use a null Type!");
+            exit(1);
+        }
+
+        return reinterpret_cast<RuntimeTypeData*>(runtimeType + ObjectHeaderSize)->type;
+    }
+
+    static void getObjectType(Context &ctx) {
+        u64 object = ctx.pop<u64>();
+
+        if (object == 0) {
+            Logger::error("Tried to get the type of a null reference!");
+            exit(1);
+        }
+
+        ctx.push<u64>(Type::O, ctx.getRuntimeType(ctx.getMethodTableOf(object)));
+    }
+
+    // Only finds methods declared by the type itself. MethodInfo objects are cached, so asking twice hands out the same one
+    static void getMethod(Context &ctx) {
+        auto name = ctx.dll->decodeUserString(ctx.pop<u64>());
+        auto type = getRuntimeTypeOf(ctx.pop<u64>());
+
+        u32 typeToken = type->type.typeToken;
+        if (TABLE_ID(typeToken) != TABLE_ID_TYPEDEF || type->rank != 0) {
+            ctx.push<u64>(Type::O, 0);
+            return;
+        }
+
+        u32 methodToken = ctx.dll->findMethodByName(TABLE_INDEX(typeToken), name.c_str());
+        if (methodToken == 0) {
+            ctx.push<u64>(Type::O, 0);
+            return;
+        }
+
+        auto key = Context::getInstantiationKey(methodToken, type->instantiation);
+        auto methodInfo = ctx.methodInfos.find(key);
+
+        if (methodInfo == ctx.methodInfos.end()) {
+            if (ctx.runtimeMethodInfoTable == nullptr)
+                ctx.runtimeMethodInfoTable = std::make_unique<MethodTable>(ctx, "System.Reflection.RuntimeMethodInfo", sizeof(RuntimeMethodData));
+
+            u8 *object = ctx.allocateObject(ctx.runtimeMethodInfoTable.get());
+            reinterpret_cast<RuntimeMethodData*>(object + ObjectHeaderSize)->invoker = getMethodInvoker(ctx, methodToken, type->instantiation);
+
+            methodInfo = ctx.methodInfos.emplace(key, reinterpret_cast<u64>(object)).first;
+        }
+
+        ctx.push<u64>(Type::O, methodInfo->second);
+    }
+
+    static void invokeMethodInfo(Context &ctx) {
+        u64 arguments = ctx.pop<u64>();
+        u64 target = ctx.pop<u64>();
+        u64 methodInfo = ctx.pop<u64>();
+
+        if (methodInfo == 0) {
+            Logger::error("Tried to invoke a null MethodInfo!");
+            exit(1);
+        }
+
+        auto &invoker = *reinterpret_cast<RuntimeMethodData*>(methodInfo + ObjectHeaderSize)->invoker;
+        u64 argumentCount = arguments == 0 ? 0 : reinterpret_cast<ArrayHeader*>(arguments + ObjectHeaderSize)->length;
+
+        if (argumentCount != invoker.parameters.size()) {
+            Logger::error("Method expects %u arguments but got %llu!", invoker.parameters.size(), argumentCount);
+            exit(1);
+        }
+
+        invokeMethod(ctx, invoker, target, reinterpret_cast<const u64*>(arguments + ArrayDataOffset));
+    }
+
+    // Value types are created zeroed, reference types by their parameterless constructor
+    static void createInstance(Context &ctx) {
+        auto type = getRuntimeTypeOf(ctx.pop<u64>());
+
+        if (type->isValueType) {
+            ctx.push<u64>(Type::O, reinterpret_cast<u64>(ctx.allocateObject(type)));
+            return;
+        }
+
+        if (type->defaultConstructor == nullptr) {
+            u32 typeToken = type->type.typeToken;
+
+            if (TABLE_ID(typeToken) == TABLE_ID_TYPEDEF && type->rank == 0) {
+                u32 typeDefIndex = TABLE_INDEX(typeToken);
+
+                for (u32 i = ctx.dll->getTypeDefByIndex(typeDefIndex)->methodListIndex; i < ctx.dll->getMethodListEnd(typeDefIndex); i++) {
+                    if (std::strcmp(ctx.dll->getString(ctx.dll->getMethodDefByIndex(i)->nameIndex), ".ctor") != 0)
+                        continue;
+
+                    auto constructor = getMethodInvoker(ctx, (TABLE_ID_METHODDEF << 24) | i, type->instantiation);
+                    if (constructor->parameters.empty()) {
+                        type->defaultConstructor = constructor;
+                        break;
+                    }
+                }
+            }
+
+            if (type->defaultConstructor == nullptr) {
+                Logger::error("%s has no parameterless constructor!", type->name.c_str());
+                exit(1);
+            }
+        }
+
+        // The object stays on the stack below the constructor's 'this', where the collector can update it
+        u64 object = reinterpret_cast<u64>(ctx.allocateObject(type));
+        ctx.push<u64>(Type::O, object);
+        invokeMethod(ctx, *type->defaultConstructor, object, nullptr);
+
+        if (ctx.exceptionPending)
+            return;
+
+        ctx.pop<u64>();
+    }
+
     void NativeMethods::registerMethod(Context &ctx, std::string methodName, std::function<void()> method) {
         ctx.nativeFunctions.insert({ methodName, method });
     }
@@ -17,12 +354,33 @@ namespace ili {
 
 
     void NativeMethods::loadMSCORLIBLibrary(Context &ctx) {
-        registerMethod(ctx, "[mscorlib]System.Object::.ctor", []{ /* ... */ } );
+        registerMethod(ctx, "[mscorlib]System.Object::.ctor", [&ctx]{ ctx.pop<u64>(); } );
+        registerMethod(ctx, "[mscorlib]System.Exception::.ctor", [&ctx]{ ctx.pop<u64>(); } );
         registerMethod(ctx, "[mscorlib]System.Console::WriteLine", [&ctx]{ callMethod(ctx, "[NX]NX.Console::WriteLine"); } );
+        registerMethod(ctx, "[mscorlib]System.Delegate::Combine", [&ctx]{ combineDelegates(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Delegate::Remove", [&ctx]{ removeDelegate(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Threading.Interlocked::CompareExchange", [&ctx]{ compareExchange(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Array::get_Length", [&ctx]{ getArrayLength(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Array::get_Rank", [&ctx]{ ctx.push<s32>(Type::Int32, ctx.getMethodTableOf(ctx.pop<u64>())->rank); } );
+        registerMethod(ctx, "[mscorlib]System.Array::GetLength", [&ctx]{ u32 dimension = ctx.pop<s32>(); ctx.push<s32>(Type::Int32, getArrayBounds(ctx, dimension).length); } );
+        registerMethod(ctx, "[mscorlib]System.Array::GetLowerBound", [&ctx]{ u32 dimension = ctx.pop<s32>(); ctx.push<s32>(Type::Int32, getArrayBounds(ctx, dimension).lowerBound); } );
+        registerMethod(ctx, "[mscorlib]System.Array::GetUpperBound", [&ctx]{
+            u32 dimension = ctx.pop<s32>();
+            auto bounds = getArrayBounds(ctx, dimension);
+            ctx.push<s32>(Type::Int32, bounds.lowerBound + bounds.length - 1);
+        });
+        registerMethod(ctx, "[mscorlib]System.Object::GetType", [&ctx]{ getObjectType(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Type::GetTypeFromHandle", [&ctx]{ ctx.push<u64>(Type::O, ctx.getRuntimeType(reinterpret_cast<MethodTable*>(ctx.pop<u64>()))); } );
+        registerMethod(ctx, "[mscorlib]System.Type::op_Equality", [&ctx]{ ctx.push<s32>(Type::Int32, ctx.pop<u64>() == ctx.pop<u64>()); } );
+        registerMethod(ctx, "[mscorlib]System.Type::op_Inequality", [&ctx]{ ctx.push<s32>(Type::Int32, ctx.pop<u64>() != ctx.pop<u64>()); } );
+        registerMethod(ctx, "[mscorlib]System.Type::GetMethod", [&ctx]{ getMethod(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Reflection.MethodBase::Invoke", [&ctx]{ invokeMethodInfo(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Reflection.MethodInfo::Invoke", [&ctx]{ invokeMethodInfo(ctx); } );
+        registerMethod(ctx, "[mscorlib]System.Activator::CreateInstance", [&ctx]{ createInstance(ctx); } );
     }
 
     void NativeMethods::loadNXLibrary(Context &ctx) {
-        registerMethod(ctx, "[NX]NX.Console::WriteLine", [&ctx]{ printf("%s\n", ctx.dll->decodeUserString(ctx.pop<u32>()).c_str()); } );
+        registerMethod(ctx, "[NX]NX.Console::WriteLine", [&ctx]{ printf("%s\n", ctx.dll->decodeUserString(ctx.pop<u64>()).c_str()); } );
     }
 
 }
\ No newline at end of file
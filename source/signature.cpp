@@ -0,0 +1,308 @@
+#include "signature.hpp"
+
+#include "dll.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+
+namespace ili {
+
+    SignatureReader::SignatureReader(DLL *dll, u8 *signature) : m_dll(dll), m_pointer(signature) {
+
+    }
+
+    u8 SignatureReader::readByte() {
+        return *this->m_pointer++;
+    }
+
+    // ECMA-335 II.23.2
+    u32 SignatureReader::readCompressed() {
+        u8 first = readByte();
+
+        if ((first & 0x80) == 0x00)
+            return first;
+
+        if ((first & 0xC0) == 0x80)
+            return ((first & 0x3F) << 8) | readByte();
+
+        u32 value = (first & 0x1F) << 24;
+        value |= readByte() << 16;
+        value |= readByte() << 8;
+        value |= readByte();
+
+        return value;
+    }
+
+    u32 SignatureReader::readTypeDefOrRef() {
+        return this->m_dll->decodeTypeDefOrRef(readCompressed());
+    }
+
+    TypeSignature SignatureReader::readType() {
+        TypeSignature type;
+        type.elementType = static_cast<SignatureElementType>(readByte());
+
+        switch (type.elementType) {
+            case SignatureElementType::CmodReqd:
+            case SignatureElementType::CmodOpt:
+                readTypeDefOrRef();
+                return readType();
+            case SignatureElementType::Pinned: {
+                auto pinned = readType();
+                pinned.isPinned = true;
+                return pinned;
+            }
+            case SignatureElementType::ValueType:
+            case SignatureElementType::Class:
+                type.typeToken = readTypeDefOrRef();
+                break;
+            case SignatureElementType::Ptr:
+            case SignatureElementType::ByRef:
+            case SignatureElementType::SzArray:
+                type.setInnerType(readType());
+                break;
+            case SignatureElementType::Array: {
+                type.setInnerType(readType());
+
+                type.rank = readCompressed();
+                for (u32 sizes = readCompressed(); sizes > 0; sizes--)
+                    readCompressed();
+                for (u32 lowerBounds = readCompressed(); lowerBounds > 0; lowerBounds--)
+                    readCompressed();
+                break;
+            }
+            case SignatureElementType::GenericInst: {
+                type.innerType = static_cast<SignatureElementType>(readByte());
+                type.typeToken = readTypeDefOrRef();
+
+                for (u32 arguments = readCompressed(); arguments > 0; arguments--)
+                    type.typeArguments.push_back(readType());
+                break;
+            }
+            case SignatureElementType::Var:
+            case SignatureElementType::MVar:
+                type.typeToken = readCompressed();
+                break;
+            case SignatureElementType::FuncPtr:
+                readMethodSignature();
+                break;
+            default:
+                break;
+        }
+
+        return type;
+    }
+
+    MethodSignature SignatureReader::readMethodSignature() {
+        MethodSignature signature;
+
+        u8 callingConvention = readByte();
+        signature.hasThis = (callingConvention & SIGNATURE_HAS_THIS) != 0 && (callingConvention & SIGNATURE_EXPLICIT_THIS) == 0;
+
+        if ((callingConvention & SIGNATURE_GENERIC) != 0)
+            signature.genericParameterCount = readCompressed();
+
+        u32 parameterCount = readCompressed();
+        signature.returnType = readType();
+
+        for (u32 i = 0; i < parameterCount; i++) {
+            if (*this->m_pointer == static_cast<u8>(SignatureElementType::Sentinel))
+                readByte();
+
+            signature.parameters.push_back(readType());
+        }
+
+        return signature;
+    }
+
+    std::vector<TypeSignature> SignatureReader::readLocalsSignature() {
+        std::vector<TypeSignature> locals;
+
+        if (readByte() != SIGNATURE_LOCAL) {
+            Logger::error("Invalid local variable signature!");
+            exit(1);
+        }
+
+        for (u32 count = readCompressed(); count > 0; count--)
+            locals.push_back(readType());
+
+        return locals;
+    }
+
+    TypeSignature SignatureReader::readFieldSignature() {
+        if (readByte() != SIGNATURE_FIELD) {
+            Logger::error("Invalid field signature!");
+            exit(1);
+        }
+
+        return readType();
+    }
+
+    std::vector<TypeSignature> SignatureReader::readMethodSpecSignature() {
+        std::vector<TypeSignature> arguments;
+
+        if (readByte() != SIGNATURE_GENERIC_INST) {
+            Logger::error("Invalid method instantiation signature!");
+            exit(1);
+        }
+
+        for (u32 count = readCompressed(); count > 0; count--)
+            arguments.push_back(readType());
+
+        return arguments;
+    }
+
+    void TypeSignature::setInnerType(const TypeSignature &inner) {
+        this->innerType = inner.elementType;
+        this->typeToken = inner.typeToken;
+        this->typeArguments = inner.typeArguments;
+        this->nestedType.clear();
+
+        switch (inner.elementType) {
+            case SignatureElementType::Ptr: case SignatureElementType::ByRef:
+            case SignatureElementType::SzArray: case SignatureElementType::Array:
+                this->nestedType.push_back(inner);
+                break;
+            default:
+                break;
+        }
+    }
+
+    bool TypeSignature::dependsOnGenericParameters() const {
+        auto isGenericParameter = [](SignatureElementType type) {
+            return type == SignatureElementType::Var || type == SignatureElementType::MVar;
+        };
+
+        if (isGenericParameter(this->elementType) || isGenericParameter(this->innerType))
+            return true;
+
+        for (auto &argument : this->typeArguments) {
+            if (argument.dependsOnGenericParameters())
+                return true;
+        }
+
+        for (auto &nested : this->nestedType) {
+            if (nested.dependsOnGenericParameters())
+                return true;
+        }
+
+        return false;
+    }
+
+    std::string getTypeKey(const TypeSignature &type) {
+        std::string key;
+
+        key += static_cast<char>(type.elementType);
+        key += static_cast<char>(type.innerType);
+
+        // Primitives resolved from a TypeRef still carry its token, it doesn't make them a different type
+        switch (type.innerType == SignatureElementType::End ? type.elementType : type.innerType) {
+            case SignatureElementType::Class: case SignatureElementType::ValueType:
+            case SignatureElementType::GenericInst:
+            case SignatureElementType::Var: case SignatureElementType::MVar:
+                key.append(reinterpret_cast<const char*>(&type.typeToken), sizeof(type.typeToken));
+                break;
+            default:
+                break;
+        }
+
+        if (type.elementType == SignatureElementType::Array)
+            key.append(reinterpret_cast<const char*>(&type.rank), sizeof(type.rank));
+
+        if (!type.typeArguments.empty()) {
+            key += '<';
+            for (auto &argument : type.typeArguments)
+                key += getTypeKey(argument);
+            key += '>';
+        }
+
+        for (auto &nested : type.nestedType) {
+            key += '[';
+            key += getTypeKey(nested);
+            key += ']';
+        }
+
+        return key;
+    }
+
+    // Generic parameters without an argument are left alone, so signatures can be substituted partially
+    TypeSignature GenericContext::substitute(const TypeSignature &type) const {
+        auto getArgument = [this](SignatureElementType elementType, u32 number) -> const TypeSignature* {
+            auto &arguments = elementType == SignatureElementType::Var ? this->typeArguments : this->methodArguments;
+
+            if ((elementType != SignatureElementType::Var && elementType != SignatureElementType::MVar) || number >= arguments.size())
+                return nullptr;
+
+            return &arguments[number];
+        };
+
+        if (auto argument = getArgument(type.elementType, type.typeToken); argument != nullptr)
+            return *argument;
+
+        TypeSignature result = type;
+
+        if (auto argument = getArgument(type.innerType, type.typeToken); argument != nullptr) {
+            result.setInnerType(*argument);
+        } else {
+            for (auto &typeArgument : result.typeArguments)
+                typeArgument = substitute(typeArgument);
+            for (auto &nested : result.nestedType)
+                nested = substitute(nested);
+        }
+
+        return result;
+    }
+
+    MethodSignature GenericContext::substitute(const MethodSignature &signature) const {
+        MethodSignature result = signature;
+
+        result.returnType = substitute(signature.returnType);
+        for (auto &parameter : result.parameters)
+            parameter = substitute(parameter);
+
+        return result;
+    }
+
+    static TypeSignature getCanonicalType(const TypeSignature &type) {
+        if (!type.isValueType())
+            return TypeSignature { SignatureElementType::Object };
+
+        TypeSignature result = type;
+        for (auto &argument : result.typeArguments)
+            argument = getCanonicalType(argument);
+
+        return result;
+    }
+
+    GenericContext GenericContext::getCanonicalForm() const {
+        GenericContext canonical;
+
+        for (auto &argument : this->typeArguments)
+            canonical.typeArguments.push_back(getCanonicalType(argument));
+        for (auto &argument : this->methodArguments)
+            canonical.methodArguments.push_back(getCanonicalType(argument));
+
+        return canonical;
+    }
+
+    bool GenericContext::hasValueTypeArguments() const {
+        auto isValueType = [](const TypeSignature &type) { return type.isValueType(); };
+
+        return std::any_of(this->typeArguments.begin(), this->typeArguments.end(), isValueType)
+            || std::any_of(this->methodArguments.begin(), this->methodArguments.end(), isValueType);
+    }
+
+    std::string GenericContext::getKey() const {
+        std::string key;
+
+        for (auto &argument : this->typeArguments)
+            key += getTypeKey(argument);
+
+        key += '|';
+
+        for (auto &argument : this->methodArguments)
+            key += getTypeKey(argument);
+
+        return key;
+    }
+
+}
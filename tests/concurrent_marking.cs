@@ -0,0 +1,138 @@
+using System;
+
+// Full collections that mark in the background while the program keeps overwriting references in the old generation.
+// Trees are mirrored and the promoted part of a list is mostly only reachable through the nursery, everything has to
+// survive anyway. Depths are given as linked lists of Level objects, see gc_stress
+
+class Level {
+    public Level next;
+
+    public Level(Level next) {
+        this.next = next;
+    }
+}
+
+class Tree {
+    public Tree left;
+    public Tree right;
+    public object[] payload = new object[32];
+
+    public Tree(Tree left, Tree right) {
+        this.left = left;
+        this.right = right;
+    }
+}
+
+class Node {
+    public Node next;
+    public object payload = new Level(null);
+
+    public Node(Node next) {
+        this.next = next;
+    }
+}
+
+class Holder {
+    public Node list;
+}
+
+class Program {
+    // Every node also replaces the head of the list, whose previous head is then only reachable through the nursery
+    static Tree Build(Level level, Holder holder) {
+        if (level == null)
+            return null;
+
+        holder.list = new Node(holder.list);
+
+        return new Tree(Build(level.next, holder), Build(level.next, holder));
+    }
+
+    static void Mirror(Tree tree) {
+        if (tree == null)
+            return;
+
+        var left = tree.left;
+        tree.left = tree.right;
+        tree.right = left;
+
+        Mirror(tree.left);
+        Mirror(tree.right);
+    }
+
+    static void Prepend(Holder holder, Level level) {
+        if (level == null) {
+            holder.list = new Node(holder.list);
+            return;
+        }
+
+        Prepend(holder, level.next);
+        Prepend(holder, level.next);
+    }
+
+    static bool Check(Tree tree, Level level) {
+        if (level == null) {
+            if (tree == null)
+                return true;
+
+            return false;
+        }
+
+        if (tree == null || tree.payload == null)
+            return false;
+
+        return Check(tree.left, level.next) && Check(tree.right, level.next);
+    }
+
+    static bool CheckList(Node node) {
+        while (node != null) {
+            if (node.payload == null)
+                return false;
+
+            node = node.next;
+        }
+
+        return true;
+    }
+
+    static int Main() {
+        var depth = new Level(new Level(new Level(new Level(new Level(new Level(new Level(
+            new Level(new Level(new Level(new Level(new Level(new Level(new Level(null))))))))))))));
+        var half = depth.next.next.next.next;
+
+        var holder = new Holder();
+        var kept = Build(depth, holder);
+        Prepend(holder, half);
+
+        var replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+        Mirror(kept);
+        Prepend(holder, half);
+        replaced = Build(depth, holder);
+
+        if (!Check(kept, depth)) return 1;
+        if (!Check(replaced, depth)) return 2;
+        if (!CheckList(holder.list)) return 3;
+
+        return 0;
+    }
+}
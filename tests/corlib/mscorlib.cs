@@ -0,0 +1,86 @@
+// Just enough of mscorlib for the tests to compile against. Everything the interpreter runs from it is provided
+// natively, see NativeMethods::loadMSCORLIBLibrary, so none of the bodies here ever run
+
+namespace System {
+
+    public class Object {
+        public Object() { }
+
+        public virtual string ToString() { return null; }
+        public virtual bool Equals(object other) { return false; }
+        public virtual int GetHashCode() { return 0; }
+
+        public Type GetType() { return null; }
+    }
+
+    public abstract class ValueType { }
+    public abstract class Enum : ValueType { }
+
+    public struct Void { }
+    public struct Boolean { }
+    public struct Char { }
+    public struct SByte { }
+    public struct Byte { }
+    public struct Int16 { }
+    public struct UInt16 { }
+    public struct Int32 { }
+    public struct UInt32 { }
+    public struct Int64 { }
+    public struct UInt64 { }
+    public struct Single { }
+    public struct Double { }
+    public struct IntPtr { }
+    public struct UIntPtr { }
+
+    public struct RuntimeTypeHandle { }
+    public struct RuntimeFieldHandle { }
+    public struct RuntimeMethodHandle { }
+
+    public struct Nullable<T> where T : struct {
+        public T value;
+        public bool hasValue;
+    }
+
+    public sealed class String { }
+    public abstract class Array { }
+    public abstract class Delegate { }
+    public abstract class MulticastDelegate : Delegate { }
+
+    public class Exception {
+        public Exception() { }
+    }
+
+    public abstract class Type {
+        public static Type GetTypeFromHandle(RuntimeTypeHandle handle) { return null; }
+    }
+
+    public interface IDisposable {
+        void Dispose();
+    }
+
+    public class Attribute { }
+
+    public enum AttributeTargets {
+        All = 0x7FFF
+    }
+
+    public sealed class AttributeUsageAttribute : Attribute {
+        public AttributeUsageAttribute(AttributeTargets targets) { }
+
+        public bool AllowMultiple { get; set; }
+        public bool Inherited { get; set; }
+    }
+
+    public static class Console {
+        public static void WriteLine(string value) { }
+    }
+
+}
+
+namespace System.Runtime.CompilerServices {
+
+    public static class RuntimeHelpers {
+        public static void InitializeArray(Array array, RuntimeFieldHandle field) { }
+    }
+
+}
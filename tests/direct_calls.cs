@@ -0,0 +1,35 @@
+using System;
+
+// Quickened calls. A call whose target depends on the caller's type arguments must not reuse the target resolved
+// for another instantiation of the caller
+
+class A { }
+class B { }
+
+class Program {
+    static object As<T>(object value) where T : class {
+        return value as T;
+    }
+
+    static object Via<T>(object value) where T : class {
+        return As<T>(value);
+    }
+
+    static object Self(object value) {
+        return value;
+    }
+
+    static int Main() {
+        object a = new A();
+
+        if (Self(a) == null) return 1;
+        if (Self(a) == null) return 2;
+
+        if (Via<A>(a) == null) return 3;
+        if (Via<B>(a) != null) return 4;
+        if (Via<A>(a) == null) return 5;
+        if (Via<B>(a) != null) return 6;
+
+        return 0;
+    }
+}
@@ -0,0 +1,35 @@
+using System;
+
+// Field accesses of a profiled run, which doesn't quicken them into the offset carrying forms. The profile it writes
+// lays out the fields of the next run
+
+class Node {
+    public int number;
+    public object reference;
+    public bool flag;
+    public Node next;
+
+    public Node Next { get { return next; } set { next = value; } }
+}
+
+class Program {
+    static void Set(ref object target, object value) {
+        target = value;
+    }
+
+    static int Main() {
+        var node = new Node();
+        node.number = 7;
+        node.flag = true;
+        node.Next = new Node();
+        Set(ref node.reference, node);
+
+        if (!node.flag) return 1;
+        if (node.Next == null) return 2;
+        if (node.Next.Next != null) return 3;
+        if ((node.reference as Node).Next == null) return 4;
+
+        node.number = node.Next.flag ? 5 : 0;
+        return node.number;
+    }
+}
@@ -0,0 +1,68 @@
+using System;
+
+// Builds complete binary trees that get promoted and start full collections, then checks that every node survived.
+// Depths are given as linked lists of Level objects, since the trees are built without arithmetic
+
+class Level {
+    public Level next;
+
+    public Level(Level next) {
+        this.next = next;
+    }
+}
+
+class Tree {
+    public Tree left;
+    public Tree right;
+
+    // Makes each node large enough that a few trees fill the old generation
+    public object[] payload = new object[32];
+
+    public Tree(Tree left, Tree right) {
+        this.left = left;
+        this.right = right;
+    }
+}
+
+class Program {
+    static Tree Build(Level level) {
+        if (level == null)
+            return null;
+
+        return new Tree(Build(level.next), Build(level.next));
+    }
+
+    static bool Check(Tree tree, Level level) {
+        if (level == null) {
+            if (tree == null)
+                return true;
+
+            return false;
+        }
+
+        if (tree == null)
+            return false;
+
+        return Check(tree.left, level.next) && Check(tree.right, level.next);
+    }
+
+    static int Main() {
+        var depth = new Level(new Level(new Level(new Level(new Level(new Level(new Level(
+            new Level(new Level(new Level(new Level(new Level(new Level(new Level(null))))))))))))));
+
+        var kept = Build(depth);
+        var replaced = Build(depth);
+        replaced = Build(depth);
+        replaced = Build(depth);
+        replaced = Build(depth);
+        replaced = Build(depth);
+        replaced = Build(depth);
+        replaced = Build(depth);
+        replaced = Build(depth);
+
+        if (!Check(kept, depth)) return 1;
+        if (!Check(replaced, depth)) return 2;
+
+        return 0;
+    }
+}
@@ -0,0 +1,30 @@
+using System;
+
+// Arrays of arrays are told apart by their element's element type
+
+class A { }
+class B : A { }
+
+class Program {
+    static int Main() {
+        object ints = new int[1][];
+        object strings = new string[1][];
+        object bs = new B[1][];
+
+        if ((ints as int[][]) == null) return 1;
+        if ((ints as string[][]) != null) return 2;
+        if ((strings as int[][]) != null) return 3;
+        if ((strings as string[][]) == null) return 4;
+
+        // Arrays of reference types are covariant at every level
+        if ((bs as A[][]) == null) return 5;
+        if ((bs as object[]) == null) return 6;
+        if ((new A[1][] as object) as B[][] != null) return 7;
+
+        object[] covariant = new string[1][];
+        covariant[0] = new string[2];
+        if (covariant[0] == null) return 8;
+
+        return 0;
+    }
+}
@@ -0,0 +1,104 @@
+using System;
+
+// A try/finally inside a finally handler that runs because of an exception. Its leave must not drop the exception or
+// run the outer finally handlers ahead of its own
+
+class TestException : Exception { }
+
+class Step { }
+class A : Step { }
+class B : Step { }
+class C : Step { }
+class D : Step { }
+class Caught : Step { }
+
+class Trace {
+    public Step step;
+    public Trace previous;
+
+    public Trace(Step step, Trace previous) {
+        this.step = step;
+        this.previous = previous;
+    }
+}
+
+class Program {
+    static Trace trace;
+
+    static void Record(Step step) {
+        trace = new Trace(step, trace);
+    }
+
+    static void Throw() {
+        try {
+            try {
+                throw new TestException();
+            } finally {
+                try {
+                    Record(new A());
+                } finally {
+                    Record(new B());
+                }
+
+                Record(new C());
+            }
+        } finally {
+            Record(new D());
+        }
+    }
+
+    static void CatchInsideFinally() {
+        try {
+            throw new TestException();
+        } finally {
+            try {
+                throw new TestException();
+            } catch (TestException) {
+                Record(new A());
+            }
+
+            Record(new B());
+        }
+    }
+
+    static int Main() {
+        try {
+            Throw();
+            return 1;
+        } catch (TestException) {
+            Record(new Caught());
+        }
+
+        // Expected A, B, C, D, Caught, most recent first
+        var t = trace;
+        if (!(t.step is Caught)) return 2;
+        t = t.previous;
+        if (!(t.step is D)) return 3;
+        t = t.previous;
+        if (!(t.step is C)) return 4;
+        t = t.previous;
+        if (!(t.step is B)) return 5;
+        t = t.previous;
+        if (!(t.step is A)) return 6;
+        if (t.previous != null) return 7;
+
+        trace = null;
+
+        try {
+            CatchInsideFinally();
+            return 8;
+        } catch (TestException) {
+            Record(new Caught());
+        }
+
+        t = trace;
+        if (!(t.step is Caught)) return 9;
+        t = t.previous;
+        if (!(t.step is B)) return 10;
+        t = t.previous;
+        if (!(t.step is A)) return 11;
+        if (t.previous != null) return 12;
+
+        return 0;
+    }
+}
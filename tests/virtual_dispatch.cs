@@ -0,0 +1,72 @@
+using System;
+
+// Call sites going from monomorphic to megamorphic, for a virtual method of this assembly, an interface method and
+// an override of a method of another assembly
+
+class Base {
+    public virtual Base Self() { return null; }
+}
+
+class Derived1 : Base { public override Base Self() { return this; } }
+class Derived2 : Base { public override Base Self() { return this; } }
+class Derived3 : Base { public override Base Self() { return this; } }
+class Derived4 : Base { public override Base Self() { return this; } }
+class Derived5 : Base { public override Base Self() { return this; } }
+
+interface IShape {
+    IShape Self();
+}
+
+class Shape1 : IShape { public IShape Self() { return this; } }
+class Shape2 : IShape { public IShape Self() { return this; } }
+class Shape3 : IShape { public IShape Self() { return this; } }
+class Shape4 : IShape { public IShape Self() { return this; } }
+class Shape5 : IShape { public IShape Self() { return this; } }
+
+class Equal1 { public override bool Equals(object other) { return true; } public override int GetHashCode() { return 0; } }
+class Equal2 { public override bool Equals(object other) { return true; } public override int GetHashCode() { return 0; } }
+class Equal3 { public override bool Equals(object other) { return true; } public override int GetHashCode() { return 0; } }
+class Equal4 { public override bool Equals(object other) { return true; } public override int GetHashCode() { return 0; } }
+class Unequal { public override bool Equals(object other) { return false; } public override int GetHashCode() { return 0; } }
+
+class Program {
+    // One call site per method, so every type passes through the same inline cache
+    static Base Self(Base value) {
+        return value.Self();
+    }
+
+    static IShape Self(IShape value) {
+        return value.Self();
+    }
+
+    static bool AreEqual(object value) {
+        return value.Equals(null);
+    }
+
+    static int Check(Base[] bases, IShape[] shapes, object[] objects) {
+        if (Self(bases[0]) == null || Self(bases[1]) == null || Self(bases[2]) == null || Self(bases[3]) == null || Self(bases[4]) == null) return 1;
+        if (Self(bases[5]) != null) return 2;
+
+        if (Self(shapes[0]) == null || Self(shapes[1]) == null || Self(shapes[2]) == null || Self(shapes[3]) == null || Self(shapes[4]) == null) return 3;
+
+        if (!AreEqual(objects[0]) || !AreEqual(objects[1]) || !AreEqual(objects[2]) || !AreEqual(objects[3])) return 4;
+        if (AreEqual(objects[4])) return 5;
+
+        return 0;
+    }
+
+    static int Main() {
+        var bases = new Base[] { new Derived1(), new Derived2(), new Derived3(), new Derived4(), new Derived5(), new Base() };
+        var shapes = new IShape[] { new Shape1(), new Shape2(), new Shape3(), new Shape4(), new Shape5() };
+        var objects = new object[] { new Equal1(), new Equal2(), new Equal3(), new Equal4(), new Unequal() };
+
+        // The first round fills the caches and turns the sites megamorphic, the later ones dispatch without them
+        int result = Check(bases, shapes, objects);
+        if (result != 0) return result;
+
+        result = Check(bases, shapes, objects);
+        if (result != 0) return result;
+
+        return Check(bases, shapes, objects);
+    }
+}